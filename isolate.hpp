@@ -7,27 +7,349 @@
 #include "mewstack.hpp"
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fcntl.h>
+#ifdef _WIN32
+	#include <io.h>
+#else
+	#include <unistd.h>
+#endif
+
+#ifndef ISOLATE_CHUNK
+	#define ISOLATE_CHUNK (16*1024)
+#endif
+
+#ifndef ISOLATE_BUFFER
+	#define ISOLATE_BUFFER (64*1024)
+#endif
+
+#ifndef ISOLATE_RING
+	#define ISOLATE_RING (256*1024)
+#endif
+
+#ifndef ISOLATE_MAX_FILE
+	#define ISOLATE_MAX_FILE (256ULL*1024*1024)
+#endif
 
 namespace Virtual {
 	constexpr const u64 stack_word = sizeof(uint);
 
+	/*
+		isolated file body in fixed chunks, appends fill the last chunk and
+		add new ones without moving what is already written. a null chunk
+		is a hole and reads as zeros
+	*/
 	struct IsolateFile {
-		mew::stack<u8> data;
+		std::vector<std::unique_ptr<u8[]>> chunks;
+		u64 size = 0;
+
+		/* overwrites or extends at `offset`, a gap past the end reads as zeros */
+		void Write(u64 offset, const u8* data, u64 count) {
+			MewUserAssert(offset <= ISOLATE_MAX_FILE && count <= ISOLATE_MAX_FILE - offset,
+				"isolated file too large");
+			if (offset > size) { Zero(size, offset); }
+			u64 end = offset + count;
+			if (chunks.size() * ISOLATE_CHUNK < end) {
+				chunks.resize((end + ISOLATE_CHUNK - 1) / ISOLATE_CHUNK);
+			}
+			while (count) {
+				u64 idx = offset / ISOLATE_CHUNK, used = offset % ISOLATE_CHUNK;
+				if (!chunks[idx]) { chunks[idx].reset(new u8[ISOLATE_CHUNK]()); }
+				u64 part = ISOLATE_CHUNK - used < count ? ISOLATE_CHUNK - used : count;
+				memcpy(chunks[idx].get()+used, data, part);
+				data += part; count -= part; offset += part;
+			}
+			if (end > size) { size = end; }
+		}
+
+		/* bytes [from, to) past the old end, whole chunks become holes */
+		void Zero(u64 from, u64 to) {
+			for (u64 idx = from / ISOLATE_CHUNK; idx < chunks.size() && idx * ISOLATE_CHUNK < to; ++idx) {
+				if (!chunks[idx]) { continue; }
+				u64 first = idx * ISOLATE_CHUNK, last = first + ISOLATE_CHUNK;
+				u64 begin = from > first ? from : first, stop = to < last ? to : last;
+				if (begin == first && stop == last) { chunks[idx].reset(); }
+				else { memset(chunks[idx].get() + (begin - first), 0, stop - begin); }
+			}
+		}
+
+		inline void Append(const u8* data, u64 count) { Write(size, data, count); }
+
+		u64 Read(u64 offset, u8* dest, u64 count) const {
+			if (offset >= size) { return 0; }
+			if (count > size - offset) { count = size - offset; }
+			for (u64 left = count; left;) {
+				u64 idx = offset / ISOLATE_CHUNK, used = offset % ISOLATE_CHUNK;
+				u64 part = ISOLATE_CHUNK - used < left ? ISOLATE_CHUNK - used : left;
+				if (chunks[idx]) { memcpy(dest, chunks[idx].get()+used, part); }
+				else { memset(dest, 0, part); }
+				dest += part; offset += part; left -= part;
+			}
+			return count;
+		}
+
+		/* keeps the chunks for the next writes */
+		void Clear() { size = 0; }
+	};
+
+	struct IsolateHandle {
+		IsolateFile* file = nullptr;
+		u64 read_pos = 0;
+	};
+
+	/*
+		write-behind queue of one descriptor. the vm thread fills [head..),
+		the writer thread drains [tail, head) without the lock, both counters
+		only grow and index the ring modulo capacity
+	*/
+	struct IsolateRing {
+		std::unique_ptr<u8[]> data;
+		u64 capacity = 0;
+		u64 head = 0, tail = 0;
+		bool failed = false;
+
+		inline bool pending() const { return head != tail && !failed; }
+	};
+
+	/*
+		open host file. sequential writes collect in `buffer` and go through
+		`append_fd` in one call, so like an isolated file they always land
+		at the current end. positional io flushes it first so the file
+		always reads what was written
+	*/
+	struct IsolateDescriptor {
+		int fd = -1;
+		int append_fd = -1; // O_APPEND, the os picks the offset
+		u64 offset = 0;     // READ position
+		std::string path; // as opened, path calls flush it first
+		std::vector<u8> buffer;
+		std::unique_ptr<IsolateRing> ring; // write-behind only
 	};
 	
 	class Isolate {
-		typedef mew::map<const char*, IsolateFile>  isolate_disk_t;
+		/* keyed by path contents, nodes keep IsolateFile* stable for handles */
+		typedef std::unordered_map<std::string, IsolateFile> isolate_disk_t;
 	private:
 		bool m_is_isolate = false;
 		isolate_disk_t m_space;
-		mew::stack<const char*> m_opened_files;
+		std::vector<IsolateHandle> m_opened_files;
+		std::vector<u32> m_free_descriptors;
+
+		std::vector<IsolateDescriptor> m_descriptors;
+		/* write-behind, m_wb_lock guards m_descriptors layout and the rings */
+		bool m_write_behind = false;
+		bool m_wb_stop = false;
+		std::thread m_writer;
+		std::mutex m_wb_lock;
+		std::condition_variable m_wb_work, m_wb_done;
+
+		IsolateHandle& GetHandle(u64 descriptor) {
+			MewUserAssert(descriptor < m_opened_files.size() && m_opened_files[descriptor].file != nullptr,
+				"invalid descriptor");
+			return m_opened_files[descriptor];
+		}
+
+		IsolateDescriptor& GetDescriptor(u64 descriptor) {
+			MewUserAssert(descriptor < m_descriptors.size() && m_descriptors[descriptor].fd >= 0,
+				"invalid descriptor");
+			return m_descriptors[descriptor];
+		}
+
+		u32 TakeDescriptor(u64 count) {
+			if (!m_free_descriptors.empty()) {
+				u32 descriptor = m_free_descriptors.back();
+				m_free_descriptors.pop_back();
+				return descriptor;
+			}
+			return (u32)count;
+		}
+
+		static u64 HostPRead(int fd, u8* dest, u64 size, u64 offset) {
+			u64 done = 0;
+			while (done < size) {
+#ifdef _WIN32
+				if (_lseeki64(fd, offset+done, SEEK_SET) < 0) { break; }
+				int got = _read(fd, dest+done, (unsigned)(size-done));
+#else
+				ssize_t got = pread(fd, dest+done, size-done, offset+done);
+#endif
+				if (got <= 0) { break; }
+				done += got;
+			}
+			return done;
+		}
+
+		static u64 HostPWrite(int fd, const u8* data, u64 size, u64 offset) {
+			u64 done = 0;
+			while (done < size) {
+#ifdef _WIN32
+				if (_lseeki64(fd, offset+done, SEEK_SET) < 0) { break; }
+				int put = _write(fd, data+done, (unsigned)(size-done));
+#else
+				ssize_t put = pwrite(fd, data+done, size-done, offset+done);
+#endif
+				if (put <= 0) { break; }
+				done += put;
+			}
+			return done;
+		}
+
+		static u64 HostAppend(int fd, const u8* data, u64 size) {
+			u64 done = 0;
+			while (done < size) {
+#ifdef _WIN32
+				int put = _write(fd, data+done, (unsigned)(size-done));
+#else
+				ssize_t put = write(fd, data+done, size-done);
+#endif
+				if (put <= 0) { break; }
+				done += put;
+			}
+			return done;
+		}
+
+		static void HostClose(int fd) {
+#ifdef _WIN32
+			_close(fd);
+#else
+			close(fd);
+#endif
+		}
+
+		bool HasPending() {
+			for (auto& d: m_descriptors) {
+				if (d.ring && d.ring->pending()) { return true; }
+			}
+			return false;
+		}
+
+		/* coalesces everything queued on a descriptor into at most two pwrites */
+		void WriterLoop() {
+			std::unique_lock<std::mutex> lock(m_wb_lock);
+			while (true) {
+				m_wb_work.wait(lock, [this] { return m_wb_stop || HasPending(); });
+				if (!HasPending()) { return; }
+				for (size_t i = 0; i < m_descriptors.size(); ++i) {
+					IsolateRing* r = m_descriptors[i].ring.get();
+					if (r == nullptr || !r->pending()) { continue; }
+					int fd = m_descriptors[i].append_fd;
+					u64 tail = r->tail, count = r->head - r->tail;
+					lock.unlock();
+					u64 at = tail % r->capacity;
+					u64 first = r->capacity - at < count ? r->capacity - at : count;
+					u64 done = HostAppend(fd, r->data.get()+at, first);
+					if (done == first && first < count) {
+						done += HostAppend(fd, r->data.get(), count-first);
+					}
+					lock.lock();
+					r->tail += done;
+					if (done != count) { r->failed = true; }
+					m_wb_done.notify_all();
+				}
+			}
+		}
+
+		void Queue(IsolateDescriptor& d, const u8* data, u64 size) {
+			std::unique_lock<std::mutex> lock(m_wb_lock);
+			if (!d.ring) {
+				d.ring.reset(new IsolateRing());
+				d.ring->data.reset(new u8[ISOLATE_RING]);
+				d.ring->capacity = ISOLATE_RING;
+			}
+			IsolateRing& r = *d.ring;
+			while (size) {
+				m_wb_done.wait(lock, [&r] { return r.head - r.tail < r.capacity || r.failed; });
+				MewUserAssert(!r.failed, "failed to write file");
+				u64 at = r.head % r.capacity;
+				u64 part = r.capacity - (r.head - r.tail);
+				if (r.capacity - at < part) { part = r.capacity - at; }
+				if (size < part) { part = size; }
+				memcpy(r.data.get()+at, data, part);
+				r.head += part; data += part; size -= part;
+				m_wb_work.notify_one();
+			}
+		}
+
+		/* waits until the writer caught up, then the file holds every queued write */
+		bool Drain(IsolateDescriptor& d) {
+			if (!d.ring) { return true; }
+			std::unique_lock<std::mutex> lock(m_wb_lock);
+			IsolateRing& r = *d.ring;
+			m_wb_done.wait(lock, [&r] { return !r.pending(); });
+			if (!r.failed) { return true; }
+			r.head = r.tail;
+			r.failed = false;
+			return false;
+		}
+
+		/* path calls bypass the descriptor buffers and rings */
+		void FlushPath(const char* path) {
+			for (auto& d: m_descriptors) {
+				if (d.fd >= 0 && d.path == path) { Flush(d); }
+			}
+		}
+
+		void Flush(IsolateDescriptor& d) {
+			MewUserAssert(Drain(d), "failed to write file");
+			if (d.buffer.empty()) { return; }
+			bool ok = HostAppend(d.append_fd, d.buffer.data(), d.buffer.size()) == d.buffer.size();
+			d.buffer.clear();
+			MewUserAssert(ok, "failed to write file");
+		}
 	public:
 		Isolate() {}
 		Isolate(bool is_isolate): m_is_isolate(is_isolate) {}
+		Isolate(const Isolate&) = delete;
+		Isolate& operator=(const Isolate&) = delete;
+
+		~Isolate() {
+			CloseAll();
+			SetWriteBehind(false);
+		}
+
+		/*
+			write-behind for host files: sequential writes go to a per descriptor
+			ring and a background thread drains them in batches, the vm only
+			blocks when a ring is full. reads, positional io, Flush and Sync
+			wait for the ring first
+		*/
+		void SetWriteBehind(bool enable) {
+			if (m_is_isolate || enable == m_write_behind) { return; }
+			if (enable) {
+				for (auto& d: m_descriptors) {
+					if (d.fd >= 0) { Flush(d); }
+				}
+				m_wb_stop = false;
+				m_writer = std::thread(&Isolate::WriterLoop, this);
+			} else {
+				for (auto& d: m_descriptors) {
+					if (d.fd >= 0) { Drain(d); }
+				}
+				{
+					std::lock_guard<std::mutex> lock(m_wb_lock);
+					m_wb_stop = true;
+				}
+				m_wb_work.notify_one();
+				m_writer.join();
+				for (auto& d: m_descriptors) { d.ring.reset(); }
+			}
+			m_write_behind = enable;
+		}
+
+		bool IsWriteBehind() const {
+			return m_write_behind;
+		}
 
 		bool IsExist(const char* path) {
 			if (m_is_isolate) {
-				return m_space.contains(path);
+				return m_space.find(path) != m_space.end();
 			} else {
 				FILE *fp = fopen(path, "r");
 				bool is_exist = false;
@@ -42,31 +364,107 @@ namespace Virtual {
 		u32 Open(const char* path) {
 			MewUserAssert(IsFile(path), "is not a path");
 			if (m_is_isolate) {
-				m_opened_files.push(path);
-				return (u32)(m_opened_files.count() - 1);
+				u32 descriptor = TakeDescriptor(m_opened_files.size());
+				if (descriptor == m_opened_files.size()) { m_opened_files.emplace_back(); }
+				m_opened_files[descriptor] = {&m_space.find(path)->second, 0};
+				return descriptor;
 			} 
-			FILE* fp = fopen(path, "rb+");
-			MewUserAssert(fp != nullptr, "failed to open file");
-			return (u32)_fileno(fp);
+#ifdef _WIN32
+			int fd = _open(path, _O_RDWR | _O_BINARY);
+			int append_fd = fd < 0 ? -1 : _open(path, _O_WRONLY | _O_APPEND | _O_BINARY);
+#else
+			int fd = open(path, O_RDWR | O_CLOEXEC);
+			int append_fd = fd < 0 ? -1 : open(path, O_WRONLY | O_APPEND | O_CLOEXEC);
+#endif
+			if (fd >= 0 && append_fd < 0) { HostClose(fd); fd = -1; }
+			MewUserAssert(fd >= 0, "failed to open file");
+			u32 descriptor = TakeDescriptor(m_descriptors.size());
+			std::lock_guard<std::mutex> lock(m_wb_lock);
+			if (descriptor == m_descriptors.size()) { m_descriptors.emplace_back(); }
+			m_descriptors[descriptor].fd = fd;
+			m_descriptors[descriptor].append_fd = append_fd;
+			m_descriptors[descriptor].offset = 0;
+			m_descriptors[descriptor].path = path;
+			return descriptor;
 		}
 
 		bool Close(u32 descriptor) {
 			if (m_is_isolate) {
-				MewUserAssert(descriptor < m_opened_files.count(), "invalid descriptor");
-				m_opened_files.erase(descriptor);
+				GetHandle(descriptor) = IsolateHandle();
+				m_free_descriptors.push_back(descriptor);
 				return true;
 			} 
-			FILE* fp = _fdopen(descriptor, "rb+");
-			if (fp == nullptr) {
-				return false;
+			IsolateDescriptor& d = GetDescriptor(descriptor);
+			bool flushed = Drain(d);
+			flushed = (d.buffer.empty() ||
+				HostAppend(d.append_fd, d.buffer.data(), d.buffer.size()) == d.buffer.size()) && flushed;
+#ifdef _WIN32
+			int result = _close(d.fd) | _close(d.append_fd);
+#else
+			int result = close(d.fd) | close(d.append_fd);
+#endif
+			{
+				std::lock_guard<std::mutex> lock(m_wb_lock);
+				d = IsolateDescriptor();
+			}
+			m_free_descriptors.push_back(descriptor);
+			return flushed && result == 0;
+		}
+
+		/* closes every descriptor, on vm teardown and reuse */
+		void CloseAll() {
+			for (u32 i = 0; i < m_descriptors.size(); ++i) {
+				if (m_descriptors[i].fd >= 0) { Close(i); }
+			}
+			{
+				std::lock_guard<std::mutex> lock(m_wb_lock);
+				m_descriptors.clear();
 			}
-			int result = fclose(fp);
-			return result == 0;
+			m_opened_files.clear();
+			m_free_descriptors.clear();
+		}
+
+		/* Flush and then asks the os to put the file on disk, a durability point */
+		bool Sync(u64 descriptor) {
+			Flush(descriptor);
+			if (m_is_isolate) { return true; }
+#ifdef _WIN32
+			return _commit(GetDescriptor(descriptor).fd) == 0;
+#else
+			return fsync(GetDescriptor(descriptor).fd) == 0;
+#endif
+		}
+
+		/* pushes buffered sequential writes of `descriptor` to the file */
+		void Flush(u64 descriptor) {
+			if (m_is_isolate) { GetHandle(descriptor); return; }
+			Flush(GetDescriptor(descriptor));
+		}
+
+		/* reads at `offset` without moving the descriptor, returns bytes read */
+		u64 PRead(u64 descriptor, byte* dest, u64 size, u64 offset) {
+			if (m_is_isolate) {
+				return GetHandle(descriptor).file->Read(offset, dest, size);
+			}
+			IsolateDescriptor& d = GetDescriptor(descriptor);
+			Flush(d);
+			return HostPRead(d.fd, dest, size, offset);
+		}
+
+		/* writes at `offset` without moving the descriptor, returns bytes written */
+		u64 PWrite(u64 descriptor, const byte* data, u64 size, u64 offset) {
+			if (m_is_isolate) {
+				GetHandle(descriptor).file->Write(offset, data, size);
+				return size;
+			}
+			IsolateDescriptor& d = GetDescriptor(descriptor);
+			Flush(d);
+			return HostPWrite(d.fd, data, size, offset);
 		}
 
 		bool IsFile(const char* path) {
 			if (m_is_isolate) {
-				return m_space.contains(path);
+				return m_space.find(path) != m_space.end();
 			} else {
 				FILE* fp = fopen(path, "rb");
 				if (fp == nullptr) return false;
@@ -78,25 +476,31 @@ namespace Virtual {
 		
 		void WriteToFile(u64 descriptor, byte* data, u64 size) {
 			if (m_is_isolate) {
-				MewUserAssert(descriptor < m_opened_files.count(), "invalid descriptor");
-				auto& file = m_space.at(m_opened_files[descriptor]);
-				file.data.resize(size);
-				memcpy(file.data.begin(), data, size);
+				GetHandle(descriptor).file->Append(data, size);
 				return;
 			}
-			FILE* fp = _fdopen((int)descriptor, "rb+");
-			MewUserAssert(fp != nullptr, "failed to get file from descriptor");
-			fwrite(data, 1, size, fp);
+			IsolateDescriptor& d = GetDescriptor(descriptor);
+			if (m_write_behind) {
+				Queue(d, data, size);
+				return;
+			}
+			if (d.buffer.size() + size > ISOLATE_BUFFER) { Flush(d); }
+			if (size >= ISOLATE_BUFFER) {
+				MewUserAssert(HostAppend(d.append_fd, data, size) == size, "failed to write file");
+				return;
+			}
+			d.buffer.insert(d.buffer.end(), data, data+size);
 		}
 
 		void WriteToFile(const char* path, const char* content) {
 			MewUserAssert(IsFile(path), "is not a path");
 			if (m_is_isolate) {
-				auto& file = m_space.at(path);
-				file.data.resize(strlen(content));
-				memcpy(file.data.begin(), content, strlen(content));
+				auto& file = m_space.find(path)->second;
+				file.Clear();
+				file.Append((const u8*)content, strlen(content));
 				return;
 			}
+			FlushPath(path);
 			FILE* fp = fopen(path, "wb");
 			if (fp == nullptr) {
 				return;
@@ -107,25 +511,30 @@ namespace Virtual {
 
 		void ReadFromFile(u64 descriptor, byte* dest, u64 size) {
 			if (m_is_isolate) {
-				MewUserAssert(descriptor < m_opened_files.count(), "invalid descriptor");
-				auto& file = m_space.at(m_opened_files[descriptor]);
-				MewUserAssert(file.data.count() >= size, "read size exceeds file size");
-				memcpy(dest, file.data.begin(), size);
+				IsolateHandle& handle = GetHandle(descriptor);
+				/* a path write may have shortened the file under the handle */
+				MewUserAssert(handle.read_pos <= handle.file->size && handle.file->size - handle.read_pos >= size,
+					"read size exceeds file size");
+				handle.read_pos += handle.file->Read(handle.read_pos, dest, size);
 				return;
 			}
-			FILE* fp = _fdopen((int)descriptor, "rb");
-			MewUserAssert(fp != nullptr, "failed to get file from descriptor");
-			fread(dest, 1, size, fp);
+			IsolateDescriptor& d = GetDescriptor(descriptor);
+			Flush(d);
+			d.offset += HostPRead(d.fd, dest, size, d.offset);
 		}
 
 
 		const char* ReadFromFile(const char* path, size_t* fsize = nullptr) {
 			MewUserAssert(IsFile(path), "is not a path");
 			if (m_is_isolate) {
-				auto& file = m_space.at(path);
-				if (fsize) { *fsize = file.data.size();}
-				return (const char*)file.data.begin();
+				auto& file = m_space.find(path)->second;
+				if (fsize) { *fsize = file.size; }
+				char* buffer = new char[file.size + 1];
+				file.Read(0, (u8*)buffer, file.size);
+				buffer[file.size] = '\0';
+				return buffer;
 			}
+			FlushPath(path);
 			FILE* fp = fopen(path, "rb");
 			if (fp == nullptr) {
 				return nullptr;
@@ -144,8 +553,7 @@ namespace Virtual {
 		void CreateFileIfNotExist(const char* path) {
 			if (IsExist(path)) return;
 			if (m_is_isolate) {
-				IsolateFile file;
-				m_space.insert(path, file);
+				m_space.try_emplace(path);
 			} else {
 				FILE* fp = fopen(path, "wb");
 				if (fp != nullptr) {
@@ -155,8 +563,9 @@ namespace Virtual {
 		}
 
 		static void CreateFileIfNotExists(const char* path) {
-			if (IsExist(path)) return;
-			FILE* fp = fopen(path, "wb");
+			FILE* fp = fopen(path, "r");
+			if (fp != nullptr) { fclose(fp); return; }
+			fp = fopen(path, "wb");
 			if (fp != nullptr) {
 				fclose(fp);
 			}
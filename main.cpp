@@ -30,6 +30,18 @@ using namespace std;
 		"-h, --help\tShow this help page\n" \
 		"--version\tDisplay current vm version\n"\
 		"--get_test\tGenerate hellow word file\n"\
+		"--test\t\tRun engine, loader and io tests\n"\
+		"--bench\t\tRun interpreter benchmarks\n"\
+		"--threaded\tUse direct-threaded interpreter\n"\
+		"--decoded\tRun from pre-decoded instruction stream\n"\
+		"--profile\tPrint hottest opcode sequences after run\n"\
+		"\t\tcant be combined with --decoded, it would run twice\n"\
+		"--jit\t\tCompile hot blocks to native code (x86-64)\n"\
+		"--debug\t\tTrack last executed instruction\n"\
+		"--unchecked\tSkip heap lock and range checks\n"\
+		"--cache\t\tReuse decoded code from $NANVM_CACHE (.nanvm_cache)\n"\
+		"--write-behind\tDrain file writes on a background thread\n"\
+		"--image\t\tSave <in> as a mappable v2 image to <out>\n"\
 	) 
 
 int main(int argc, char** argv) {
@@ -58,12 +70,58 @@ int main(int argc, char** argv) {
 		return !Tests::test_Virtual();
 	}
 
+	if (__args.has("--test")) {
+		return !Tests::test_All();
+	}
+
+	if (__args.has("--bench")) {
+		return !Tests::bench_All();
+	}
+
 	const char* path = __args.getNextPath();
 	MewUserAssert(mew::is_exists(path),"path is not exsist");
 	Virtual::VirtualMachine vm;
 	Virtual::Code* code = Virtual::Code_LoadFromFile(path);
+	MewUserAssert(code != nullptr, "unsupported file version");
 	// vm.hdlls = hdlls;
-	int exit_code = Virtual::Execute(vm, *code);
+	if (__args.has("--image")) {
+		/* v2 keeps libs, natives and symbols and is mapped on load */
+		const char* out = __args.getNextPath();
+		MewUserAssert(out != nullptr, "usage: --image <in> <out>");
+		Virtual::Code_SaveImage(*code, out);
+		return 0;
+	}
+	vm.flags.use_debug = __args.has("--debug");
+	if (__args.has("--unchecked")) {
+		vm.flags.unchecked = true;
+		vm.flags.heap_lock_execute = false;
+	}
+	if (__args.has("--write-behind")) {
+		vm.fs.SetWriteBehind(true);
+	}
+	if (__args.has("--cache")) {
+		const char* cache_dir = getenv("NANVM_CACHE");
+		Virtual::VM_SetCodeCache(cache_dir ? cache_dir : ".nanvm_cache");
+	}
+	Virtual::VM_Engine engine = Virtual::VM_Engine_Switch;
+	if (__args.has("--threaded")) {
+		engine = Virtual::VM_Engine_Threaded;
+	}
+	if (__args.has("--decoded")) {
+		engine = Virtual::VM_Engine_Decoded;
+	}
+	if (__args.has("--profile")) {
+		/* fusing needs a second run, guest io would happen twice */
+		MewUserAssert(!__args.has("--decoded"), "--profile cant be combined with --decoded");
+		engine = Virtual::VM_Engine_Profile;
+	}
+	if (__args.has("--jit")) {
+		engine = Virtual::VM_Engine_Jit;
+	}
+	int exit_code = Virtual::Execute(vm, *code, engine);
+	if (engine == Virtual::VM_Engine_Profile) {
+		Virtual::VM_PrintProfile(*code, stderr);
+	}
 
 #ifdef _WIN32
 	HWND consoleWnd = GetConsoleWindow();
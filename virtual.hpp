@@ -4,10 +4,16 @@
 #include <stack>
 #include <stdlib.h>
 #include <cstring>
+#include <cstddef>
 #include <filesystem>
 #include <fstream>
 #include <fcntl.h>
 #include <vector>
+#include <algorithm>
+#include <array>
+#include <utility>
+#include <tuple>
+#include <type_traits>
 #ifdef _WIN32
 #include <windows.h>
 #endif
@@ -33,11 +39,25 @@
 #include <iostream>
 #include <string>
 #include <memory>
+#include <exception>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <unordered_map>
+#if defined(__GLIBC__)
+  #include <malloc.h>
+#endif
 
 #ifdef _WIN32
     #include <windows.h>
 #else
     #include <dlfcn.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
 #endif
 
 class DynamicLibrary {
@@ -169,9 +189,23 @@ namespace Virtual {
     Intruction_GetIPTR,
     Instruction_MOVRDI,
     Instruction_DCALL, // dynamic library function call ~!see notes
+    Instruction_DCALLS, // DCALL bound at load, <slot:8> <unused:8>
+    Instruction_DCALLB, // batched DCALL, <lib:8> <name:8> <batch:8> <results:8>
+    Instruction_DCALLBS, // DCALLB bound at load, <slot:8> <unused:8> <batch:8> <results:8>
+    Instruction_HCALL, // host function call, <id:4> <argc:1>
+    Instruction_PREAD,  // positional read, <descr:4> <dest arg> <offset arg>
+    Instruction_PWRITE, // positional write, <descr:4> <content arg> <offset arg>
+    Instruction_SYNC,   // flush write-behind and fsync, <descr:4>
+    Instruction_Count,  // keep last, part of VIRTUAL_VERSION
   };
 
-  #define VIRTUAL_VERSION (Instruction_PUTS*100)+0x55
+  /*
+    files of another version are rejected. the opcode count makes every
+    appended opcode a new version, the revision covers changed meaning of
+    existing encodings (2: rdi and ST offsets are stack slots, not bytes)
+  */
+  #define VIRTUAL_REVISION 3
+  #define VIRTUAL_VERSION ((Instruction_Count*100)+0x55+VIRTUAL_REVISION)
   #define GrabFromVM(var) memcpy(&var, vm.begin, sizeof(var)); vm.begin += sizeof(var);
 
   struct VM_MANIFEST_FLAGS {
@@ -185,17 +219,78 @@ namespace Virtual {
     const char* func_name;
   };
 
+  struct VM_DebugLine {
+    u64 cursor;  // code offset
+    s32 line;
+    u32 _pad0;
+  };
+
   struct CodeManifestExtended {
     VM_MANIFEST_FLAGS flags;
     mew::stack<FuncExternalLink> extern_links;
+    mew::stack<const char*> libs;      // library paths, loaded by LoadMemory
+    mew::stack<VM_DebugLine> debug;    // source lines, only for error reports
+    mew::stack<const char*> natives;   // native libraries, DCALL lib index
+  };
+
+  struct VM_DecodedCode;
+  struct Code;
+  bool Code_Verify(Code& code, const char** error = nullptr);
+
+  enum VM_Verify: byte {
+    VM_Verify_None = 0,
+    VM_Verify_Failed,
+    VM_Verify_Ok,
   };
+  struct VM_Profile;
+  struct VM_Jit;
+  struct VM_CodeImage;
+  struct VM_SymbolTable;
+  struct VM_NativeTable;
+  bool Code_Bind(Code& code, const char** error = nullptr);
+
+  /* guards lazy per Code state, a copied Code gets its own */
+  struct VM_CodeLock {
+    std::mutex lock;
+    VM_CodeLock() { }
+    VM_CodeLock(const VM_CodeLock&) { }
+    VM_CodeLock& operator=(const VM_CodeLock&) { return *this; }
+  };
+
+  #ifndef VM_ALLOC_ALIGN
+    #define VM_ALLOC_ALIGN 512
+  #endif
+  #ifndef VM_MINHEAP_ALIGN
+    #define VM_MINHEAP_ALIGN 128
+  #endif
+  #ifndef VM_CODE_ALIGN
+    #define VM_CODE_ALIGN 8
+  #endif
+  #define __VM_ALIGN(_val, _align) (((int)((_val) / (_align)) + 1) * (_align))
+
+  /* never reused, unlike the address of a released Code */
+  u64 Code_NextGeneration() {
+    static std::atomic<u64> next{1};
+    return next.fetch_add(1, std::memory_order_relaxed);
+  }
 
   struct Code {
+    u64 generation = Code_NextGeneration(); // VM_Pool reuse key
     u64 capacity;
     Instruction* playground;
     u64 data_size = 0;
     byte* data = nullptr;
+    void* adata = nullptr;  // Code_AData[adata_count], zeroed heap after data
+    u64 adata_count = 0;
     CodeManifestExtended cme;
+    VM_DecodedCode* decoded = nullptr; // built by Code_Decode
+    VM_Profile* profile = nullptr;     // filled by VM_Engine_Profile, published by Code_Profile
+    VM_Jit* jit = nullptr;             // compiled blocks for VM_Engine_Jit
+    VM_Verify verified = VM_Verify_None; // set by Code_Verify
+    VM_CodeImage* image = nullptr;     // playground/data point into it, see Code_MapFromFile
+    VM_SymbolTable* symbols = nullptr; // labels, from CodeBuilder::label or the image
+    VM_NativeTable* natives = nullptr; // DCALL slots, see Code_Bind
+    VM_CodeLock lazy;                  // creation of decoded and jit
   };
 
 #pragma region FILE
@@ -208,13 +303,22 @@ namespace Virtual {
 
   FuncExternalLink Code_ReadDebug(std::ifstream& file) {
     FuncExternalLink link;
-    file >> link.type;
+    u8 type = 0;
+    file >> type;
+    link.type = type;
     mew::readString(file, (char*)link.lib_name);
     mew::readString(file, (char*)link.func_name);
     return link;
   }
 
+  /*
+    v1 has no room for libs, natives or symbols. DCALL indexes cme.natives,
+    so DCALL sites in a v1 file fault when they run; keep such code as an image
+  */
   void Code_SaveToFile(const Code& code, std::ofstream& file) {
+    if (code.cme.libs.size() || code.cme.natives.size() || code.symbols != nullptr) {
+      MewWarn("v1 code drops libs, natives and symbols, save with Code_SaveImage");
+    }
     /* manifest */
     VM_MANIFEST_FLAGS mflags = code.cme.flags;
     mew::writeBytes(file, (uint)VIRTUAL_VERSION);
@@ -242,7 +346,7 @@ namespace Virtual {
     if (!__path.is_absolute()) {
       __path = std::filesystem::absolute(__path.lexically_normal());
     }
-    Code_SaveFromFile(code, __path);
+    Code_SaveToFile(code, __path);
   }
 
   Code* Code_LoadFromFile(std::ifstream& file) {
@@ -262,10 +366,487 @@ namespace Virtual {
     if (code->cme.flags.has_debug) {
       mew::readStack(file, code->cme.extern_links, Code_ReadDebug);
     }
+    const char* error = nullptr;
+    if (!Code_Verify(*code, &error)) {
+      MewWarn("code is not verified (%s), running with checks", error);
+    }
+    MewForUserAssert(Code_Bind(*code, &error), "cant bind native calls (%s)", error);
+    return code;
+  }
+
+  /*
+    label name -> code offset. the index is one flat blob (header, open
+    addressing slots, names) so the image can store it as is and a lookup
+    on a mapped section needs no parsing
+  */
+  constexpr const u64 VM_NOSYMBOL = ~0ULL;
+
+  struct VM_SymbolIndexHeader {
+    u32 slot_count;  // power of two
+    u32 count;
+    u64 names_size;
+  };
+
+  struct VM_SymbolSlot {
+    u64 hash;
+    u64 offset;
+    u32 name;        // offset into names
+    u32 len;         // 0 marks an empty slot
+  };
+
+  struct VM_SymbolTable {
+    const VM_SymbolSlot* slots = nullptr;
+    const char* names = nullptr;
+    u32 mask = 0;
+    u32 count = 0;
+    const byte* blob = nullptr;
+    u64 blob_size = 0;
+    byte* owned = nullptr;  // blob built in memory, not mapped
+
+    ~VM_SymbolTable() { delete[] owned; }
+  };
+
+  u64 VM_SymbolHash(const char* name, u64 len) {
+    u64 hash = 0xcbf29ce484222325ULL;
+    for (u64 i = 0; i < len; ++i) {
+      hash = (hash ^ (byte)name[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+  }
+
+  bool VM_AttachSymbols(VM_SymbolTable& table, const byte* blob, u64 size) {
+    VM_SymbolIndexHeader header;
+    if (size < sizeof(header)) { return false; }
+    memcpy(&header, blob, sizeof(header));
+    u64 slots_size = (u64)header.slot_count*sizeof(VM_SymbolSlot);
+    if (header.slot_count == 0 || (header.slot_count & (header.slot_count-1))
+        || header.names_size > size || sizeof(header)+slots_size+header.names_size != size) { return false; }
+    const VM_SymbolSlot* slots = (const VM_SymbolSlot*)(blob+sizeof(header));
+    /* every name in range and at least one empty slot, VM_FindSymbol stops on it */
+    u32 occupied = 0;
+    for (u32 i = 0; i < header.slot_count; ++i) {
+      const VM_SymbolSlot& slot = slots[i];
+      if (slot.len == 0) { continue; }
+      if ((u64)slot.name + slot.len > header.names_size) { return false; }
+      ++occupied;
+    }
+    if (occupied != header.count || occupied >= header.slot_count) { return false; }
+    table.slots = slots;
+    table.names = (const char*)(blob+sizeof(header)+slots_size);
+    table.mask = header.slot_count-1;
+    table.count = header.count;
+    table.blob = blob;
+    table.blob_size = size;
+    return true;
+  }
+
+  /* entries are (name, offset), later duplicates win */
+  VM_SymbolTable* VM_BuildSymbols(const std::vector<std::pair<std::string, u64>>& entries) {
+    u32 slot_count = 8;
+    while (slot_count < entries.size()*2) { slot_count <<= 1; }
+    std::vector<VM_SymbolSlot> slots(slot_count);
+    std::string names;
+    u32 count = 0;
+    for (auto& entry: entries) {
+      u64 hash = VM_SymbolHash(entry.first.data(), entry.first.size());
+      u32 i = (u32)hash & (slot_count-1);
+      while (slots[i].len != 0) {
+        VM_SymbolSlot& slot = slots[i];
+        if (slot.hash == hash && slot.len == entry.first.size()
+            && memcmp(names.data()+slot.name, entry.first.data(), slot.len) == 0) { break; }
+        i = (i+1) & (slot_count-1);
+      }
+      if (slots[i].len == 0) {
+        slots[i].hash = hash;
+        slots[i].name = (u32)names.size();
+        slots[i].len = (u32)entry.first.size();
+        names += entry.first;
+        ++count;
+      }
+      slots[i].offset = entry.second;
+    }
+    VM_SymbolIndexHeader header = {slot_count, count, names.size()};
+    u64 size = sizeof(header) + slot_count*sizeof(VM_SymbolSlot) + names.size();
+    VM_SymbolTable* table = new VM_SymbolTable();
+    table->owned = new byte[size];
+    memcpy(table->owned, &header, sizeof(header));
+    memcpy(table->owned+sizeof(header), slots.data(), slot_count*sizeof(VM_SymbolSlot));
+    memcpy(table->owned+sizeof(header)+slot_count*sizeof(VM_SymbolSlot), names.data(), names.size());
+    VM_AttachSymbols(*table, table->owned, size);
+    return table;
+  }
+
+  u64 VM_FindSymbol(const VM_SymbolTable& table, const char* name) {
+    if (table.slots == nullptr) { return VM_NOSYMBOL; }
+    u64 len = strlen(name);
+    u64 hash = VM_SymbolHash(name, len);
+    for (u32 i = (u32)hash & table.mask;; i = (i+1) & table.mask) {
+      const VM_SymbolSlot& slot = table.slots[i];
+      if (slot.len == 0) { return VM_NOSYMBOL; }
+      if (slot.hash == hash && slot.len == len && memcmp(table.names+slot.name, name, len) == 0) {
+        return slot.offset;
+      }
+    }
+  }
+
+  /*
+    container v2: header, section table, then every section payload at a
+    page boundary so the file can be mapped and code pages shared. code,
+    data and libs are read at load, debug, extern links and symbols are
+    checksummed and parsed the first time Code_FaultSection asks for them.
+    v1 is the stream format above, told apart by the magic
+  */
+  #define VM_IMAGE_MAGIC 0x4D49424EU // "NBIM"
+  #define VM_IMAGE_FORMAT 2
+  #ifndef VM_IMAGE_PAGE
+    #define VM_IMAGE_PAGE 4096
+  #endif
+
+  enum VM_SectionKind: u32 {
+    VM_Section_Code = 0,
+    VM_Section_Data,
+    VM_Section_Debug,
+    VM_Section_Extern,
+    VM_Section_Libs,
+    VM_Section_Symbols,
+    VM_Section_Natives,
+    VM_Section_Count,
+  };
+
+  struct VM_ImageHeader {
+    u32 magic;
+    u32 format;
+    u32 version;
+    VM_MANIFEST_FLAGS flags;
+    u32 page;
+    u32 section_count;
+  };
+
+  struct VM_ImageSection {
+    u32 kind;
+    u32 _pad0;
+    u64 offset;
+    u64 size;
+    u64 checksum;
+  };
+
+  /* word at a time fnv-1a, only has to catch torn or corrupted files */
+  u64 VM_Checksum(const byte* data, u64 size, u64 hash = 0xcbf29ce484222325ULL) {
+    const u64 prime = 0x100000001b3ULL;
+    u64 i = 0;
+    for (; i+sizeof(u64) <= size; i += sizeof(u64)) {
+      u64 word; memcpy(&word, data+i, sizeof(word));
+      hash = (hash ^ word) * prime;
+    }
+    for (; i < size; ++i) {
+      hash = (hash ^ data[i]) * prime;
+    }
+    return hash;
+  }
+
+  struct VM_CodeImage {
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+    byte* base = nullptr;
+    u64 size = 0;
+    u64 code_offset = 0;
+    VM_ImageSection sections[VM_Section_Count] = {};
+    u32 present = 0;   // 1 << kind
+    u32 faulted = 0;   // 1 << kind, guarded by lock
+    std::mutex lock;
+  };
+
+  struct VM_ImageWriter {
+    std::ofstream& file;
+    u64 page;
+    mew::stack<VM_ImageSection> sections;
+
+    void pad_to(u64 offset) {
+      static const char zeros[VM_IMAGE_PAGE] = {0};
+      u64 at = (u64)file.tellp();
+      while (at < offset) {
+        u64 n = offset-at < VM_IMAGE_PAGE ? offset-at : VM_IMAGE_PAGE;
+        file.write(zeros, n); at += n;
+      }
+    }
+
+    void section(VM_SectionKind kind, const byte* payload, u64 size) {
+      pad_to(__VM_ALIGN((u64)file.tellp(), page));
+      VM_ImageSection s = {};
+      s.kind = kind;
+      s.offset = (u64)file.tellp();
+      s.size = size;
+      s.checksum = VM_Checksum(payload, size);
+      if (size) { file.write((const char*)payload, size); }
+      sections.push(s);
+    }
+  };
+
+  void Code_PutImageString(std::string& out, const char* str) {
+    u32 len = str ? (u32)strlen(str) : 0;
+    out.append((const char*)&len, sizeof(len));
+    if (len) { out.append(str, len); }
+  }
+
+  const char* Code_ReadImageString(byte*& cursor, byte* end) {
+    u32 len;
+    MewUserAssert(cursor+sizeof(len) <= end, "broken image section");
+    memcpy(&len, cursor, sizeof(len)); cursor += sizeof(len);
+    MewUserAssert(cursor+len <= end, "broken image section");
+    char* str = new char[len+1];
+    memcpy(str, cursor, len); str[len] = 0;
+    cursor += len;
+    return str;
+  }
+
+  bool Code_FaultSection(Code& code, VM_SectionKind kind);
+
+  void Code_SaveImage(Code& code, const std::filesystem::path& path) {
+    /* lazy sections of a mapped image are parsed before they are written back */
+    Code_FaultSection(code, VM_Section_Extern);
+    Code_FaultSection(code, VM_Section_Symbols);
+    Code_FaultSection(code, VM_Section_Debug);
+    std::ofstream file(path, std::ios::out | std::ios::binary);
+    MewAssert(file.is_open());
+    VM_ImageHeader header = {};
+    header.magic = VM_IMAGE_MAGIC;
+    header.format = VM_IMAGE_FORMAT;
+    header.version = VIRTUAL_VERSION;
+    header.flags = code.cme.flags;
+    header.page = VM_IMAGE_PAGE;
+    /* table is rewritten once offsets are known */
+    VM_ImageSection table[VM_Section_Count] = {};
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)table, sizeof(table));
+    VM_ImageWriter out{file, VM_IMAGE_PAGE};
+    out.section(VM_Section_Code, (const byte*)code.playground, code.capacity);
+    /* keeps the rest of the last code page zero, it is mapped under the heap */
+    out.pad_to(__VM_ALIGN((u64)file.tellp(), out.page));
+    out.section(VM_Section_Data, code.data, code.data_size);
+    if (code.cme.libs.size()) {
+      std::string payload;
+      u32 count = (u32)code.cme.libs.size();
+      payload.append((const char*)&count, sizeof(count));
+      for (u32 i = 0; i < count; ++i) {
+        Code_PutImageString(payload, code.cme.libs.at(i));
+      }
+      out.section(VM_Section_Libs, (const byte*)payload.data(), payload.size());
+    }
+    if (code.cme.natives.size()) {
+      std::string payload;
+      u32 count = (u32)code.cme.natives.size();
+      payload.append((const char*)&count, sizeof(count));
+      for (u32 i = 0; i < count; ++i) {
+        Code_PutImageString(payload, code.cme.natives.at(i));
+      }
+      out.section(VM_Section_Natives, (const byte*)payload.data(), payload.size());
+    }
+    if (code.cme.extern_links.size()) {
+      std::string payload;
+      u32 count = (u32)code.cme.extern_links.size();
+      payload.append((const char*)&count, sizeof(count));
+      for (u32 i = 0; i < count; ++i) {
+        FuncExternalLink& link = code.cme.extern_links.at(i);
+        byte type = link.type;
+        payload.append((const char*)&type, sizeof(type));
+        Code_PutImageString(payload, link.lib_name);
+        Code_PutImageString(payload, link.func_name);
+      }
+      out.section(VM_Section_Extern, (const byte*)payload.data(), payload.size());
+    }
+    if (code.symbols != nullptr) {
+      out.section(VM_Section_Symbols, code.symbols->blob, code.symbols->blob_size);
+    }
+    if (code.cme.debug.size()) {
+      u64 count = code.cme.debug.size();
+      out.section(VM_Section_Debug, (const byte*)&code.cme.debug.at(0), count*sizeof(VM_DebugLine));
+    }
+    header.section_count = (u32)out.sections.size();
+    for (u32 i = 0; i < header.section_count; ++i) {
+      table[i] = out.sections.at(i);
+    }
+    file.seekp(0);
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)table, sizeof(table));
+    file.close();
+  }
+
+  void Code_Unmap(Code& code) {
+    VM_CodeImage* image = code.image;
+    if (image == nullptr) { return; }
+    /* also called on a half opened image */
+#ifdef _WIN32
+    if (image->base != nullptr) { UnmapViewOfFile(image->base); }
+    if (image->mapping != nullptr) { CloseHandle(image->mapping); }
+    if (image->file != INVALID_HANDLE_VALUE) { CloseHandle(image->file); }
+#else
+    if (image->base != nullptr) { munmap(image->base, image->size); }
+    if (image->fd >= 0) { close(image->fd); }
+#endif
+    delete image;
+    code.image = nullptr;
+    code.playground = nullptr;
+    code.data = nullptr;
+  }
+
+  byte* Code_CheckedSection(VM_CodeImage& image, VM_SectionKind kind, u64* size) {
+    VM_ImageSection& s = image.sections[kind];
+    byte* payload = image.base+s.offset;
+    MewUserAssert(VM_Checksum(payload, s.size) == s.checksum, "image section checksum mismatch");
+    *size = s.size;
+    return payload;
+  }
+
+  void Code_ParseSection(Code& code, VM_SectionKind kind, byte* cursor, u64 size) {
+    byte* end = cursor+size;
+    switch (kind) {
+      case VM_Section_Libs:
+      case VM_Section_Natives: {
+        auto& list = kind == VM_Section_Libs ? code.cme.libs : code.cme.natives;
+        u32 count; MewUserAssert(size >= sizeof(count), "broken image section");
+        memcpy(&count, cursor, sizeof(count)); cursor += sizeof(count);
+        for (u32 i = 0; i < count; ++i) {
+          list.push(Code_ReadImageString(cursor, end));
+        }
+      } break;
+      case VM_Section_Extern: {
+        u32 count; MewUserAssert(size >= sizeof(count), "broken image section");
+        memcpy(&count, cursor, sizeof(count)); cursor += sizeof(count);
+        for (u32 i = 0; i < count; ++i) {
+          FuncExternalLink link;
+          MewUserAssert(cursor < end, "broken image section");
+          link.type = *cursor++;
+          link.lib_name = Code_ReadImageString(cursor, end);
+          link.func_name = Code_ReadImageString(cursor, end);
+          code.cme.extern_links.push(link);
+        }
+      } break;
+      case VM_Section_Symbols: {
+        VM_SymbolTable* table = new VM_SymbolTable();
+        if (!VM_AttachSymbols(*table, cursor, size)) {
+          delete table;
+          MewUserAssert(false, "broken image section");
+        }
+        code.symbols = table;
+      } break;
+      case VM_Section_Debug: {
+        MewUserAssert(size % sizeof(VM_DebugLine) == 0, "broken image section");
+        for (u64 i = 0; i < size; i += sizeof(VM_DebugLine)) {
+          VM_DebugLine line; memcpy(&line, cursor+i, sizeof(line));
+          code.cme.debug.push(line);
+        }
+      } break;
+      default: break;
+    }
+  }
+
+  /*
+    parses a lazy section into code.cme on first use, true if the code has
+    it. code loaded from v1 or built in memory has everything already
+  */
+  bool Code_FaultSection(Code& code, VM_SectionKind kind) {
+    VM_CodeImage* image = code.image;
+    if (image == nullptr) { return true; }
+    if (!(image->present & (1U << kind))) { return false; }
+    std::lock_guard<std::mutex> guard(image->lock);
+    if (image->faulted & (1U << kind)) { return true; }
+    u64 size;
+    byte* payload = Code_CheckedSection(*image, kind, &size);
+    Code_ParseSection(code, kind, payload, size);
+    image->faulted |= 1U << kind;
+    return true;
+  }
+
+  void Code_Release(Code* code);
+
+  /* zero copy load, startup touches the header, code, data and libs only */
+  Code* Code_MapFromFile(const std::filesystem::path& path) {
+    VM_CodeImage* image = new VM_CodeImage();
+    Code* code = new Code();
+    code->image = image;
+    /* any assert on a broken image unmaps and frees through Code_Release */
+    struct Guard {
+      Code* code;
+      ~Guard() { Code_Release(code); }
+    } guard{code};
+#ifdef _WIN32
+    image->file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    MewUserAssert(image->file != INVALID_HANDLE_VALUE, "cant open image");
+    LARGE_INTEGER fsize;
+    GetFileSizeEx(image->file, &fsize);
+    image->size = (u64)fsize.QuadPart;
+    image->mapping = CreateFileMappingW(image->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    MewUserAssert(image->mapping != nullptr, "cant map image");
+    image->base = (byte*)MapViewOfFile(image->mapping, FILE_MAP_READ, 0, 0, 0);
+    MewUserAssert(image->base != nullptr, "cant map image");
+#else
+    image->fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    MewUserAssert(image->fd >= 0, "cant open image");
+    struct stat st;
+    MewUserAssert(fstat(image->fd, &st) == 0, "cant stat image");
+    image->size = (u64)st.st_size;
+    void* base = mmap(nullptr, image->size, PROT_READ, MAP_SHARED, image->fd, 0);
+    MewUserAssert(base != MAP_FAILED, "cant map image");
+    image->base = (byte*)base;
+#endif
+    VM_ImageHeader header;
+    MewUserAssert(image->size >= sizeof(header), "image too small");
+    memcpy(&header, image->base, sizeof(header));
+    if (header.magic != VM_IMAGE_MAGIC || header.format != VM_IMAGE_FORMAT
+        || header.version != VIRTUAL_VERSION) {
+      MewWarn("image version not support (%u.%u != %u.%u)", header.format, header.version,
+        (u32)VM_IMAGE_FORMAT, (u32)VIRTUAL_VERSION);
+      return nullptr;
+    }
+    MewUserAssert(header.section_count <= VM_Section_Count
+      && sizeof(header)+header.section_count*sizeof(VM_ImageSection) <= image->size, "broken image");
+    for (u32 i = 0; i < header.section_count; ++i) {
+      VM_ImageSection s;
+      memcpy(&s, image->base+sizeof(header)+i*sizeof(s), sizeof(s));
+      MewUserAssert(s.kind < VM_Section_Count && s.offset <= image->size
+        && s.size <= image->size-s.offset, "broken image section table");
+      image->sections[s.kind] = s;
+      image->present |= 1U << s.kind;
+    }
+    MewUserAssert(image->present & (1U << VM_Section_Code), "image without code");
+    code->cme.flags = header.flags;
+    u64 size;
+    byte* payload = Code_CheckedSection(*image, VM_Section_Code, &size);
+    image->code_offset = image->sections[VM_Section_Code].offset;
+    code->capacity = size;
+    code->playground = (Instruction*)payload;
+    if (image->present & (1U << VM_Section_Data)) {
+      payload = Code_CheckedSection(*image, VM_Section_Data, &size);
+      code->data_size = size;
+      code->data = size ? payload : nullptr;
+    }
+    Code_FaultSection(*code, VM_Section_Libs);
+    Code_FaultSection(*code, VM_Section_Natives);
+    const char* error = nullptr;
+    if (!Code_Verify(*code, &error)) {
+      MewWarn("code is not verified (%s), running with checks", error);
+    }
+    MewForUserAssert(Code_Bind(*code, &error), "cant bind native calls (%s)", error);
+    guard.code = nullptr;
     return code;
   }
 
+  bool Code_IsImage(const std::filesystem::path& path) {
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    u32 magic = 0;
+    file.read((char*)&magic, sizeof(magic));
+    return file && magic == VM_IMAGE_MAGIC;
+  }
+
   Code* Code_LoadFromFile(const std::filesystem::path& path) {
+    if (Code_IsImage(path)) {
+      return Code_MapFromFile(path);
+    }
     std::ifstream file(path, std::ios::in | std::ios::binary);
     MewAssert(file.is_open());
     file >> std::noskipws;
@@ -282,12 +863,117 @@ namespace Virtual {
     return Code_LoadFromFile(__path);
   }
 
+#pragma region LIBRARIES
+  /*
+    process wide cache of library Code, one load per canonical path shared
+    read only by every vm. entries are refcounted and freed with the last
+    reference, loading happens outside the lock so slow libs dont serialize
+  */
+  class VM_LibraryCache {
+  private:
+    struct Entry {
+      std::once_flag loaded;
+      Code* code = nullptr;
+      u64 refs = 0;
+    };
+    std::mutex m_lock;
+    std::unordered_map<std::string, std::shared_ptr<Entry>> m_entries;
+    std::unordered_map<Code*, std::string> m_paths;
+
+    static std::string Key(const char* path) {
+      std::error_code ec;
+      std::filesystem::path canonical = std::filesystem::weakly_canonical(path, ec);
+      return ec ? std::string(path) : canonical.string();
+    }
+
+    /* drops the reference of a failed load */
+    void Forget(const std::string& key, const std::shared_ptr<Entry>& entry, bool poisoned) {
+      std::lock_guard<std::mutex> guard(m_lock);
+      --entry->refs;
+      auto it = m_entries.find(key);
+      if (it != m_entries.end() && it->second == entry && (poisoned || entry->refs == 0)) {
+        m_entries.erase(it);
+      }
+    }
+
+  public:
+    Code* Acquire(const char* path) {
+      std::string key = Key(path);
+      std::shared_ptr<Entry> entry;
+      {
+        std::lock_guard<std::mutex> guard(m_lock);
+        auto& slot = m_entries[key];
+        if (!slot) { slot = std::make_shared<Entry>(); }
+        entry = slot;
+        ++entry->refs;
+      }
+      try {
+        std::call_once(entry->loaded, [&]{
+          entry->code = Code_LoadFromFile(path);
+        });
+      } catch (...) {
+        /* the once_flag stays unset, waiters retry on the same entry */
+        Forget(key, entry, false);
+        throw;
+      }
+      if (entry->code == nullptr) {
+        /* the once_flag is spent, the next Acquire starts a new entry */
+        Forget(key, entry, true);
+        MewUserAssert(false, "cant load library");
+      }
+      std::lock_guard<std::mutex> guard(m_lock);
+      m_paths[entry->code] = key;
+      return entry->code;
+    }
+
+    void Retain(Code* code) {
+      std::lock_guard<std::mutex> guard(m_lock);
+      auto path = m_paths.find(code);
+      MewAssert(path != m_paths.end());
+      ++m_entries[path->second]->refs;
+    }
+
+    void Release(Code* code) {
+      Code* dead = nullptr;
+      {
+        std::lock_guard<std::mutex> guard(m_lock);
+        auto path = m_paths.find(code);
+        if (path == m_paths.end()) { return; }
+        auto entry = m_entries.find(path->second);
+        if (--entry->second->refs == 0) {
+          dead = entry->second->code;
+          m_entries.erase(entry);
+          m_paths.erase(path);
+        }
+      }
+      if (dead != nullptr) { Code_Release(dead); }
+    }
+
+    u64 size() {
+      std::lock_guard<std::mutex> guard(m_lock);
+      return m_paths.size();
+    }
+  };
+
+  VM_LibraryCache& VM_Libraries() {
+    static VM_LibraryCache cache;
+    return cache;
+  }
+
+  /* a library of the running code, loaded on the first call into it */
+  struct VM_LibRef {
+    const char* path = nullptr;
+    Code* code = nullptr;
+  };
+#pragma endregion LIBRARIES
+
 #pragma region VM
   enum VM_Status: byte {
     VM_Status_Panding = 0,
     VM_Status_Execute = 1 << 1,
     VM_Status_Ret     = 1 << 2,
     VM_Status_Error   = 1 << 3,
+    VM_Status_Wait    = 1 << 4, // suspended on VM_PendingIO
   };
   
   enum VM_TestStatus: byte {
@@ -304,6 +990,23 @@ namespace Virtual {
     HeapLockExecute = 1 << 1,
   };
 
+  /*
+    compile-time interpreter configuration, every combination is
+    instantiated and Run picks one before the first instruction
+  */
+  template<bool _debug, bool _heap_lock, bool _bounds>
+  struct VM_Config {
+    static constexpr bool debug = _debug;         // vm.debug bookkeeping
+    static constexpr bool heap_lock = _heap_lock; // forbid executing the heap
+    static constexpr bool bounds = _bounds;       // jump, heap and stack range asserts
+  };
+  typedef VM_Config<true, true, true>   VM_Checked;
+  typedef VM_Config<false, true, true>  VM_Release;
+  typedef VM_Config<false, false, false> VM_Unchecked;
+
+  #define VM_CHECK(_cond, _msg) \
+    if constexpr (Cfg::bounds) { MewUserAssert(_cond, _msg); }
+
   template<u64 size>
   struct VM_Register {
     byte data[size];
@@ -321,6 +1024,225 @@ namespace Virtual {
 
 
   typedef u64(*vm_dll_pipe_fn)(VirtualMachine* vm);
+  /*
+    batched pipe, opt in by exporting it under the name DCALLB uses.
+    gets `count` records of `stride` bytes, writes one result per record
+    and returns how many it processed
+  */
+  typedef u64(*vm_dll_batch_fn)(VirtualMachine* vm, const byte* records, u64 stride, u64* results, u64 count);
+
+  /* heap-resident head of a DCALLB argument array, records follow it */
+  struct VM_NativeBatch {
+    u32 count;
+    u32 stride;
+  };
+
+  /*
+    per Code native call binding. every DCALL site is resolved once by
+    Code_Bind and LoadMemory rewrites it to DCALLS <slot>, so a call is an
+    index into `slots` and one indirect call
+  */
+  struct VM_NativeTable {
+    std::vector<handle_t> handles;     // one per cme.natives entry
+    std::vector<vm_dll_pipe_fn> slots;
+    std::vector<vm_dll_batch_fn> batch_slots;
+    std::vector<std::pair<u64, u64>> sites; // (pc, slot), slot table by opcode
+  };
+
+#pragma region HOST
+  /*
+    typed view over a copy of the HCALL arguments, args[0] is the first pushed.
+    slots hold whatever the guest pushed, the callee picks the type
+  */
+  struct VM_HostArgs {
+    const u64* args;
+    u64 count;
+
+    inline u64 u(u64 i) const { return args[i]; }
+    inline s64 s(u64 i) const { return (s64)args[i]; }
+    inline float f(u64 i) const { float x; u32 bits = (u32)args[i]; memcpy(&x, &bits, sizeof(x)); return x; }
+    inline double d(u64 i) const { double x; memcpy(&x, &args[i], sizeof(x)); return x; }
+  };
+
+  typedef u64(*VM_HostFn)(VirtualMachine& vm, VM_HostArgs args, void* user);
+
+  struct VM_HostEntry {
+    VM_HostFn fn = nullptr;
+    void* user = nullptr;
+  };
+
+  /*
+    host callbacks by numeric id, for HCALL. a vm looks in its own table
+    first (VirtualMachine::hosts, owned by the embedder) and then in the
+    process one, VM_Hosts(). register before the vms run, lookups dont lock
+  */
+  class VM_HostTable {
+    std::vector<VM_HostEntry> m_entries;
+  public:
+    void Set(u32 id, VM_HostFn fn, void* user = nullptr) {
+      if (id >= m_entries.size()) { m_entries.resize(id+1); }
+      m_entries[id] = {fn, user};
+    }
+
+    u32 Add(VM_HostFn fn, void* user = nullptr) {
+      u32 id = (u32)m_entries.size();
+      Set(id, fn, user);
+      return id;
+    }
+
+    void Remove(u32 id) {
+      if (id < m_entries.size()) { m_entries[id] = {}; }
+    }
+
+    inline const VM_HostEntry* Find(u32 id) const {
+      if (id >= m_entries.size() || m_entries[id].fn == nullptr) { return nullptr; }
+      return &m_entries[id];
+    }
+  };
+
+  VM_HostTable& VM_Hosts() {
+    static VM_HostTable table;
+    return table;
+  }
+
+  void VM_RegisterHost(u32 id, VM_HostFn fn, void* user = nullptr) {
+    VM_Hosts().Set(id, fn, user);
+  }
+#pragma endregion HOST
+
+#pragma region STACK
+  #ifndef VM_STACK_SLOTS
+    #define VM_STACK_SLOTS (64*1024)
+  #endif
+
+  /*
+    operand stack of 8 byte slots. the full capacity is reserved once with
+    an inaccessible guard page on both ends. pushes are checked against the
+    limit (a guest can grow it), pop/peek are single aligned loads and
+    rely on the callers underflow checks
+  */
+  class VM_Stack {
+  private:
+    u64* m_base = nullptr;
+    u64* m_top = nullptr;    // next free slot
+    u64* m_limit = nullptr;
+    byte* m_mapping = nullptr;
+    u64 m_mapped = 0;
+
+    static u64 page_size() {
+#ifdef _WIN32
+      SYSTEM_INFO info; GetSystemInfo(&info);
+      return info.dwPageSize;
+#else
+      return (u64)sysconf(_SC_PAGESIZE);
+#endif
+    }
+
+  public:
+    VM_Stack(u64 slots = VM_STACK_SLOTS) { reserve(slots); }
+    ~VM_Stack() { release(); }
+    VM_Stack(const VM_Stack&) = delete;
+    VM_Stack& operator=(const VM_Stack&) = delete;
+
+    void reserve(u64 slots) {
+      release();
+      u64 page = page_size();
+      u64 body = ((slots*sizeof(u64) + page - 1) / page) * page;
+      m_mapped = body + 2*page;
+#ifdef _WIN32
+      m_mapping = (byte*)VirtualAlloc(nullptr, m_mapped, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+      MewUserAssert(m_mapping != nullptr, "cant reserve vm stack");
+      DWORD old;
+      VirtualProtect(m_mapping, page, PAGE_NOACCESS, &old);
+      VirtualProtect(m_mapping+page+body, page, PAGE_NOACCESS, &old);
+#else
+      void* mapping = mmap(nullptr, m_mapped, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      MewUserAssert(mapping != MAP_FAILED, "cant reserve vm stack");
+      m_mapping = (byte*)mapping;
+      mprotect(m_mapping, page, PROT_NONE);
+      mprotect(m_mapping+page+body, page, PROT_NONE);
+#endif
+      m_base = (u64*)(m_mapping+page);
+      m_top = m_base;
+      m_limit = (u64*)(m_mapping+page+body);
+    }
+
+    void release() {
+      if (m_mapping == nullptr) { return; }
+#ifdef _WIN32
+      VirtualFree(m_mapping, 0, MEM_RELEASE);
+#else
+      munmap(m_mapping, m_mapped);
+#endif
+      m_mapping = nullptr;
+      m_base = m_top = m_limit = nullptr;
+    }
+
+    inline void push(u64 value) {
+      MewUserAssert(m_top < m_limit, "stack overflow");
+      *m_top++ = value;
+    }
+    inline u64 pop() { return *--m_top; }
+    inline void drop(u64 count = 1) { m_top -= count; }
+    /* slot `depth` below the top, 0 is the top */
+    inline u64& peek(u64 depth = 0) { return m_top[-1 - (s64)depth]; }
+    /* slot `idx` from the bottom */
+    inline u64& at(u64 idx) { return m_base[idx]; }
+    inline bool has(u64 depth) const { return depth < size(); }
+    inline u64 size() const { return (u64)(m_top - m_base); }
+    inline u64 capacity() const { return (u64)(m_limit - m_base); }
+    inline bool empty() const { return m_top == m_base; }
+    inline void clear() { m_top = m_base; }
+    inline u64* data() { return m_base; }
+    /* field offsets for jit code */
+    static u32 base_offset() { return (u32)offsetof(VM_Stack, m_base); }
+    static u32 top_offset() { return (u32)offsetof(VM_Stack, m_top); }
+    inline void resize(u64 slots) {
+      MewUserAssert(slots <= capacity(), "stack overflow");
+      m_top = m_base + slots;
+    }
+
+    /* pushes raw bytes into ceil(size/8) slots */
+    void push_array(const byte* src, u64 size) {
+      if (size == 0) { return; }
+      u64 slots = size / sizeof(u64) + (size % sizeof(u64) != 0);
+      MewUserAssert(slots <= (u64)(m_limit - m_top), "stack overflow");
+      m_top[slots-1] = 0;
+      memcpy(m_top, src, size);
+      m_top += slots;
+    }
+  };
+#pragma endregion STACK
+
+  enum VM_IOKind: byte {
+    VM_IO_None = 0,
+    VM_IO_Getch,
+    VM_IO_Read,
+    VM_IO_Write,
+    VM_IO_PRead,
+    VM_IO_PWrite,
+    VM_IO_Sync,
+  };
+
+  /*
+    blocking io a suspended vm waits on. the opcode fills it and sets
+    VM_Status_Wait, the scheduler hands it to VM_IOWorker, the vm resumes
+    at `begin` (already past the opcode) once `done` is set
+  */
+  struct VM_PendingIO {
+    VM_IOKind kind = VM_IO_None;
+    bool submitted = false;
+    bool failed = false;
+    std::atomic<bool> done{false};
+    u32 descr = 0;
+    byte* data = nullptr;
+    u64 size = 0;
+    u64 offset = 0;    // file offset of PRead/PWrite
+    s32 scratch = 0;   // NUM operands live here instead of on the c++ stack
+    int owner = -1;    // scheduler worker to resume on, -1 polls
+    int id = -1;
+  };
 
 #pragma pack(push, 4)
   struct VM_DEBUG {
@@ -331,16 +1253,16 @@ namespace Virtual {
     FILE* std_in = stdin;
     FILE* std_out = stdout;
     Isolate fs;
-    Code* src;
+    Code* src = nullptr;
     VM_DEBUG debug;
-    VM_Register<4> _r[5];                       // 4*5(20)
-    VM_Register<4> _fx[5];                      // 4*5(20)
-    VM_Register<8> _rx[5];                      // 8*5(40)
-    VM_Register<8> _dx[5];                      // 8*5(40)
-    u64 capacity;                            // 8byte
+    VM_Register<4> _r[5] = {};                  // 4*5(20)
+    VM_Register<4> _fx[5] = {};                 // 4*5(20)
+    VM_Register<8> _rx[5] = {};                 // 8*5(40)
+    VM_Register<8> _dx[5] = {};                 // 8*5(40)
+    u64 capacity = 0;                        // 8byte
     FILE *r_stream;                             // 8byte
-    byte *memory, *heap,
-        *begin, *end;                           // 4x8byte(24byte) 
+    byte *memory = nullptr, *heap = nullptr,
+        *begin = nullptr, *end = nullptr;                           // 4x8byte(24byte) 
     struct TestStatus {
       bytepartf(skip)
       bytepartf(equal)
@@ -353,32 +1275,45 @@ namespace Virtual {
       bytepartf(use_debug)
       bytepartf(use_isolate)
       bytepartf(in_neib_ctx)
+      bytepartf(unchecked)
+      bytepartf(async_io)
+      bytepartf(mapped_memory)
+      bytepartf(mapped_view)
     } flags;                                    // 1byte
     byte _pad0[1];
-    mew::stack<u8, mew::MidAllocator<u8>> stack;                 // 24byte
+    VM_Stack stack;                             // 40byte
     u64 rdi = 0;
     mew::stack<byte *, mew::MidAllocator<byte*>> begin_stack;        // 24byte             // 24byte
-    mew::stack<Code*> libs;                 // 24byte
-    mew::stack<handle_t> dll_handles;
-    std::unordered_map<const char*, vm_dll_pipe_fn> dll_pipes;
+    mew::stack<VM_LibRef> libs;             // 24byte
+    std::unordered_map<std::string, vm_dll_pipe_fn> dll_pipes; // by VM_DllPipeKey, unbound DCALL only
     u64 process_cycle = 0;
+    u64 mapped_code = 0;    // leading code bytes mapped from Code::image
+    VM_PendingIO io;
+    VM_HostTable* hosts = nullptr; // per vm HCALL ids, before VM_Hosts()
+
+    ~VirtualMachine() {
+      for (int i = 0; i < libs.size(); ++i) {
+        if (libs[i].code != nullptr) { VM_Libraries().Release(libs[i].code); }
+      }
+    }
 
     byte* getRegister(VM_RegType rt, byte idx, u64* size = nullptr) {
       MewUserAssert(idx < 5, "undefined register idx");
       switch (rt) {
         case VM_RegType::R: 
-          if (!size) {*size = 4;}
+          if (size) {*size = 4;}
           return this->_r[idx].data;     
         case VM_RegType::RX: 
-          if (!size) {*size = 8;}
+          if (size) {*size = 8;}
           return this->_rx[idx].data;
         case VM_RegType::FX: 
-          if (!size) {*size = 4;}
+          if (size) {*size = 4;}
           return this->_fx[idx].data;
         case VM_RegType::DX: 
-          if (!size) {*size = 8;}
+          if (size) {*size = 8;}
           return this->_dx[idx].data;
         case VM_RegType::RDI:
+          if (size) {*size = 8;}
           return (byte*)&this->rdi;
         default: return nullptr;
       }
@@ -386,44 +1321,32 @@ namespace Virtual {
   };                                            // 368byte 
 #pragma pack(pop)
 
-  u64 VM_OpenDll(VirtualMachine& vm, const char* name) {
-    handle_t handle_;
-    #ifdef _WIN32
-      handle_ = LoadLibraryA(libraryPath);
-    #else
-      handle_ = dlopen(libraryPath, RTLD_LAZY);
-    #endif
-    MewForUserAssert(handle_ != nullptr, "cant open library (%s)", name);
-    return vm.dll_handles.push(handle_);
-  }
+  vm_dll_pipe_fn VM_NativeSymbol(handle_t handle, const char* name);
 
-  void VM_CloseDlls(VirtualMachine& vm) {
-    for (int i = 0; i < vm.dll_handles.count(); ++i) {
-      auto handle_ = vm.dll_handles.at(i);
-#ifdef _WIN32
-      FreeLibrary(handle_);
-#else
-      dlclose(handle_);
-#endif
-    }
+  std::string VM_DllPipeKey(u64 dll_idx, const char* name) {
+    return std::to_string(dll_idx) + ":" + name;
   }
 
+  /*
+    dll_idx indexes cme.natives like bound sites, Code_Bind opened the
+    library. it used to index libraries a vm opened itself, that per vm
+    list (VM_OpenDll/dll_handles) is gone: a library DCALL uses has to be
+    declared in cme.natives
+  */
   vm_dll_pipe_fn VM_GetDllPipeFunction(VirtualMachine& vm, u64 dll_idx, const char* name) {
-    auto it = vm.dll_pipes.find(name);
+    std::string key = VM_DllPipeKey(dll_idx, name);
+    auto it = vm.dll_pipes.find(key);
     if (it != vm.dll_pipes.end()) {return it->second;}
-    MewForUserAssert(vm.dll_handles.has(dll_idx), "cant find library by identifier(%i), maybe library wasnt loaded", dll_idx);
-#ifdef _WIN32
-    FARPROC proc = GetProcAddress(handle_, functionName);
-#else
-    void* proc = dlsym(handle_, functionName);
-#endif
+    VM_NativeTable* natives = vm.src != nullptr ? vm.src->natives : nullptr;
+    MewForUserAssert(natives != nullptr && dll_idx < natives->handles.size() && natives->handles[dll_idx],
+      "cant find library by identifier(%i), maybe library wasnt loaded", dll_idx);
+    vm_dll_pipe_fn proc = VM_NativeSymbol(natives->handles[dll_idx], name);
     if (!proc) {
       MewWarn("cant find function(%s) from library\n", name);
       return nullptr;
     }
-    vm_dll_pipe_fn fn = (vm_dll_pipe_fn)(proc);
-    vm.dll_pipes.insert({name, fn});
-    return fn;
+    vm.dll_pipes.insert({key, proc});
+    return proc;
   }
 
   struct Code_AData {
@@ -445,54 +1368,173 @@ namespace Virtual {
     sizeof(VirtualMachine);
   }
 
-  #ifndef VM_ALLOC_ALIGN
-    #define VM_ALLOC_ALIGN 512
-  #endif
-  #ifndef VM_MINHEAP_ALIGN
-    #define VM_MINHEAP_ALIGN 128
-  #endif
-  #ifndef VM_CODE_ALIGN
-    #define VM_CODE_ALIGN 8
-  #endif
-  #define __VM_ALIGN(_val, _align) (((int)((_val) / (_align)) + 1) * (_align))
-
+  void Free(VirtualMachine& vm) {
+    if (vm.memory == nullptr) { return; }
+    if (vm.flags.mapped_memory) {
+#ifdef _WIN32
+      if (vm.flags.mapped_view) {
+        UnmapViewOfFile(vm.memory);
+      } else {
+        VirtualFree(vm.memory, 0, MEM_RELEASE);
+      }
+#else
+      munmap(vm.memory, vm.capacity);
+#endif
+    } else {
+      delete[] vm.memory;
+    }
+    vm.memory = nullptr;
+    vm.flags.mapped_memory = false;
+    vm.flags.mapped_view = false;
+    vm.capacity = 0;
+    vm.mapped_code = 0;
+  }
 
   void Alloc(VirtualMachine& vm) {
-    if (vm.memory != nullptr) {
-      free(vm.memory);
-    }
+    Free(vm);
     vm.memory = new byte[VM_ALLOC_ALIGN];
     memset(vm.memory, Instruction_NONE, VM_ALLOC_ALIGN);
     vm.capacity = VM_ALLOC_ALIGN;
   }
 
-  void Alloc(VirtualMachine& vm, Code& code) {
+  u64 Code_MemorySize(Code& code) {
     u64 adata_count = Code_CountAData(code);
     u64 size = __VM_ALIGN(code.capacity+code.data_size+adata_count, VM_ALLOC_ALIGN);
     if ((size - code.capacity - code.data_size) <= 0) {
       size += VM_MINHEAP_ALIGN;
     }
-    vm.memory = new byte[size];
-    memset(vm.memory, Instruction_NONE, size);
-    vm.capacity = size;
+    return size;
   }
 
-  u32 DeclareProccessor(VirtualMachine& vm, VM_Processor proc) {
-    MewNotImpl();
-    // vm.procs.push_back(proc);
-    // return vm.procs.size()-1;
+  /* heap begins right after the aligned code, see Run */
+  u64 Code_HeapOffset(Code& code) {
+    return __VM_ALIGN(code.capacity, VM_CODE_ALIGN)+1;
   }
 
-  void LoadMemory(VirtualMachine& vm, Code& code) {
-    memcpy(vm.memory, code.playground, code.capacity);
-    // todo load from .nlib file 
-    for (int i = 0; i < code.cme.libs.size(); ++i) {
-      Code* lib = Code_LoadFromFile(code.cme.libs.at(i));
-      vm.libs.push(lib);
-    }
-  }
+  void AllocMapped(VirtualMachine& vm, u64 size);
 
-  void VM_ManualPush(VirtualMachine& vm, u32 x) {
+  /*
+    overlays the whole code pages of an image onto the vm memory as a
+    private file mapping, the tail that shares a page with the heap is
+    copied by LoadMemory
+  */
+  bool AllocFromImage(VirtualMachine& vm, Code& code, u64 size) {
+#ifdef _WIN32
+    return false;
+#else
+    VM_CodeImage* image = code.image;
+    u64 page = (u64)sysconf(_SC_PAGESIZE);
+    if (image == nullptr || image->code_offset % page != 0) { return false; }
+    u64 len = __VM_ALIGN(code.capacity, page);
+    if (len > size - size % page) { len = size - size % page; }
+    if (len == 0) { return false; }
+    AllocMapped(vm, size);
+    void* at = mmap(vm.memory, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+      image->fd, (off_t)image->code_offset);
+    MewUserAssert(at != MAP_FAILED, "cant map image code");
+    vm.mapped_code = len < code.capacity ? len : code.capacity;
+    return true;
+#endif
+  }
+
+  void Alloc(VirtualMachine& vm, Code& code) {
+    Free(vm);
+    u64 size = Code_MemorySize(code);
+    if (AllocFromImage(vm, code, size)) { return; }
+    vm.memory = new byte[size];
+    memset(vm.memory, Instruction_NONE, size);
+    vm.capacity = size;
+  }
+
+  /*
+    anonymous mapping, starts zeroed (Instruction_NONE) and can be given
+    back to that state page by page with VM_ResetMemory
+  */
+  void AllocMapped(VirtualMachine& vm, u64 size) {
+    Free(vm);
+#ifdef _WIN32
+    vm.memory = (byte*)VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    MewUserAssert(vm.memory != nullptr, "cant map vm memory");
+#else
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    MewUserAssert(mapping != MAP_FAILED, "cant map vm memory");
+    vm.memory = (byte*)mapping;
+#endif
+    vm.flags.mapped_memory = true;
+    vm.capacity = size;
+  }
+
+  /* zeroes [0, size), only pages that were touched cost anything */
+  void VM_ResetMemory(VirtualMachine& vm, u64 size) {
+    static_assert(Instruction_NONE == 0, "reset relies on zero pages");
+#ifndef _WIN32
+    if (vm.flags.mapped_memory) {
+      u64 page = (u64)sysconf(_SC_PAGESIZE);
+      u64 whole = size - size % page;
+      if (whole) { madvise(vm.memory, whole, MADV_DONTNEED); }
+      memset(vm.memory+whole, Instruction_NONE, size-whole);
+      return;
+    }
+#endif
+    memset(vm.memory, Instruction_NONE, size);
+  }
+
+  u64 VM_ProcessorThunk(VirtualMachine& vm, VM_HostArgs args, void* user) {
+    ((VM_Processor)user)(vm, vm.begin);
+    return 0;
+  }
+
+  /* legacy processor as a host function, HCALL <id> 0 runs it */
+  u32 DeclareProccessor(VirtualMachine& vm, VM_Processor proc) {
+    VM_HostTable& table = vm.hosts ? *vm.hosts : VM_Hosts();
+    return table.Add(VM_ProcessorThunk, (void*)proc);
+  }
+
+  const VM_HostEntry* VM_FindHost(VirtualMachine& vm, u32 id) {
+    if (vm.hosts) {
+      if (const VM_HostEntry* entry = vm.hosts->Find(id)) { return entry; }
+    }
+    return VM_Hosts().Find(id);
+  }
+
+  void VM_ReleaseLibs(VirtualMachine& vm) {
+    for (int i = 0; i < vm.libs.size(); ++i) {
+      if (vm.libs[i].code != nullptr) { VM_Libraries().Release(vm.libs[i].code); }
+    }
+    vm.libs.clear();
+  }
+
+  /* rewrites bound DCALL sites in vm memory, only their pages get copied */
+  void Code_PatchNatives(VirtualMachine& vm, Code& code) {
+    if (code.natives == nullptr) { return; }
+    for (auto& site: code.natives->sites) {
+      bool batch = ((byte*)code.playground)[site.first] == Instruction_DCALLB;
+      vm.memory[site.first] = batch ? Instruction_DCALLBS : Instruction_DCALLS;
+      memcpy(vm.memory+site.first+1, &site.second, sizeof(u64));
+    }
+  }
+
+  void LoadMemory(VirtualMachine& vm, Code& code) {
+    u64 mapped = vm.mapped_code;
+    memcpy(vm.memory+mapped, (byte*)code.playground+mapped, code.capacity-mapped);
+    Code_PatchNatives(vm, code);
+    /* libraries are only named here, VM_GetLib loads them on first use */
+    VM_ReleaseLibs(vm);
+    for (int i = 0; i < code.cme.libs.size(); ++i) {
+      vm.libs.push((VM_LibRef){code.cme.libs.at(i), nullptr});
+    }
+  }
+
+  Code* VM_GetLib(VirtualMachine& vm, int idx) {
+    MewUserAssert(0 <= idx && idx < vm.libs.size(), "undefined library");
+    VM_LibRef& ref = vm.libs.at(idx);
+    if (ref.code == nullptr) {
+      ref.code = VM_Libraries().Acquire(ref.path);
+    }
+    return ref.code;
+  }
+
+  void VM_ManualPush(VirtualMachine& vm, u32 x) {
     vm.stack.push(x);
   }
 
@@ -507,15 +1549,15 @@ namespace Virtual {
         MewUserAssert(vm.heap+number < vm.end, "out of memory");
         byte* pointer = vm.heap+number;
         u32 x; memcpy(&x, pointer, sizeof(x));
-        vm.stack.push(x, vm.rdi);
+        vm.stack.push(x);
       } break;
       case Instruction_REG: {
         MewUserAssert(vm.heap+number < vm.end, "out of memory");
-        vm.stack.push(number, vm.rdi);
+        vm.stack.push(number);
       } break;
       case Instruction_ST: {
         MewUserAssert(vm.stack.has(number), "out of stack");
-        vm.stack.push(vm.stack.at((int)number), vm.rdi);
+        vm.stack.push(vm.stack.peek(number));
       } break;
       default: MewNot(); break;
     }
@@ -524,11 +1566,11 @@ namespace Virtual {
   byte* VM_GetReg(VirtualMachine& vm, u64* size = nullptr) {
     Virtual::VM_RegType rtype = (Virtual::VM_RegType)(*vm.begin++);
     byte ridx = *vm.begin++;
-    return vm.getRegister(rtype, ridx);
+    return vm.getRegister(rtype, ridx, size);
   }
 
+  template<typename Cfg = VM_Checked>
   void VM_Push(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     Instruction head_byte = (Instruction)*vm.begin++;
     switch (head_byte) {
       case 0:
@@ -540,8 +1582,8 @@ namespace Virtual {
         vm.begin += sizeof(number);
       } break;
       case Instruction_STRUCT: {
-        auto arg = VM_GetArg(vm);
-        vm.stack.push_array(arg.data, arg.size);
+        auto arg = VM_GetArg<Cfg>(vm);
+        vm.stack.push_array(arg.getMem(), arg.size);
       } break;
       case Instruction_BYTE: { // <value:8>
         u8 number = 0;
@@ -552,7 +1594,7 @@ namespace Virtual {
       case Instruction_MEM: { // <offset:32>
         u32 number = 0;
         memcpy(&number, vm.begin, sizeof(number));
-        MewUserAssert(vm.heap+number < vm.end, "out of memory");
+        VM_CHECK(vm.heap+number < vm.end, "out of memory");
         byte* pointer = vm.heap+number;
         u32 x; memcpy(&x, pointer, sizeof(x));
         vm.stack.push(x);
@@ -562,46 +1604,36 @@ namespace Virtual {
         u64 size;
         byte* reg = VM_GetReg(vm, &size);
         MewUserAssert(reg != nullptr, "invalid register");
-        vm.stack.push((u32)*reg);
-        if (size == 8) {
-          vm.stack.push((u32)*(reg+sizeof(u32)));
-        }
+        u64 value = 0;
+        memcpy(&value, reg, size);
+        vm.stack.push(value);
       } break;
-      case Instruction_ST: { // offset:4 + arg
-        int offset = 0; // byte offset
+      case Instruction_ST: { // offset:4 + arg, overwrites slot
+        u32 offset = 0; // slot depth from top
         GrabFromVM(offset);
-        MewUserAssert(vm.stack.size() < offset, "out of stack");
-        auto arg = VM_GetArg(vm);
-        MewUserAssert(0 < vm.stack.size()-offset && vm.stack.size() < offset+arg.size, "out of stack");
-        byte* value = vm.stack.begin()+(vm.stack.size() - offset - 1);
-        memcpy(value, arg.data, arg.size);
+        MewUserAssert(vm.stack.has(offset), "out of stack");
+        auto arg = VM_GetArg<Cfg>(vm);
+        u64 value = 0;
+        memcpy(&value, arg.getMem(), arg.size < sizeof(value) ? arg.size : sizeof(value));
+        vm.stack.peek(offset) = value;
       } break;
       default: MewNot(); break;
     }
   }
   
   void VM_Pop(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     MewAssert(!vm.stack.empty());
-    vm.stack.asc_pop(1);
+    vm.stack.drop();
   }
 
+  /* reads slot at rdi depth into register, drops the top slot */
   void VM_RPop(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    MewAssert(!vm.stack.empty());
-    u64 size;
+    MewAssert(vm.stack.has(vm.rdi));
+    u64 size = 0;
     u8* raw_reg = VM_GetReg(vm, &size);
-    if (size == 4) {
-      u32* value = (u32*)&vm.stack.top(vm.rdi+sizeof(u32));
-      u32* reg = (u32*)raw_reg;
-      *reg = *value;
-      vm.stack.asc_pop(sizeof(u32));
-    } else if (size == 8) {
-      u64* value = (u64*)&vm.stack.top(vm.rdi+sizeof(u64));
-      u64* reg = (u64*)raw_reg;
-      *reg = *value;
-      vm.stack.asc_pop(sizeof(u64));
-    }
+    MewUserAssert(raw_reg != nullptr, "invalid register");
+    memcpy(raw_reg, &vm.stack.peek(vm.rdi), size);
+    vm.stack.drop();
   }
   
   void VM_StackTop(VirtualMachine& vm, byte type, u32* x, byte** mem = nullptr) {
@@ -610,14 +1642,13 @@ namespace Virtual {
       case Instruction_FLT:
       case Instruction_ST:
       case Instruction_NUM: {
-        MewUserAssert(!vm.stack.empty(), "stack is empty");
-        u32 _top = vm.stack.top(vm.rdi);
+        MewUserAssert(vm.stack.has(vm.rdi), "stack is empty");
+        u32 _top = (u32)vm.stack.peek(vm.rdi);
         memmove(x, &_top, sizeof(_top));
       } break;
       case Instruction_MEM: {
-        MewUserAssert(!vm.stack.empty(), "stack is empty");
-        u32 _top = vm.stack.top(vm.rdi);
-        u32 offset = _top;
+        MewUserAssert(vm.stack.has(vm.rdi), "stack is empty");
+        u32 offset = (u32)vm.stack.peek(vm.rdi);
         MewUserAssert(vm.heap+offset < vm.end, "out of memory");
         byte* pointer = vm.heap+offset;
         if (mem != nullptr) {
@@ -634,30 +1665,57 @@ namespace Virtual {
     vm.flags.in_neib_ctx = true;
   }
 
-  void VM_ManualCall(VirtualMachine& vm, int libIDX, const char* fname) {
-    Code* lib = vm.libs.at(libIDX);
-    u64 offset = lib->find_label(fname);
-    MewUserAssert(offset != -1, "undefined function");
+  /* offset of a label in code, VM_NOSYMBOL if there is none */
+  u64 Code_FindLabel(Code& code, const char* name) {
+    Code_FaultSection(code, VM_Section_Symbols);
+    if (code.symbols == nullptr) { return VM_NOSYMBOL; }
+    return VM_FindSymbol(*code.symbols, name);
+  }
+
+  /* resolved once by VM_Resolve, a call through it is a pointer jump */
+  struct VM_FnHandle {
+    Code* lib = nullptr;
+    byte* entry = nullptr;
+  };
+
+  VM_FnHandle VM_Resolve(VirtualMachine& vm, int libIDX, const char* fname) {
+    Code* lib = VM_GetLib(vm, libIDX);
+    u64 offset = Code_FindLabel(*lib, fname);
+    MewUserAssert(offset != VM_NOSYMBOL && offset < lib->capacity, "undefined function");
+    return (VM_FnHandle){lib, (byte*)lib->playground+offset};
+  }
+
+  void VM_ManualCall(VirtualMachine& vm, VM_FnHandle fn) {
+    MewAssert(fn.entry != nullptr);
     vm.begin_stack.push(vm.begin);
-    vm.begin = (byte*)lib->playground+offset;
-    VM_SwitchContext(vm, lib);
+    vm.begin = fn.entry;
+    VM_SwitchContext(vm, fn.lib);
   }
 
+  void VM_ManualCall(VirtualMachine& vm, int libIDX, const char* fname) {
+    VM_ManualCall(vm, VM_Resolve(vm, libIDX, fname));
+  }
+
+  template<typename Cfg = VM_Checked>
   void VM_Call(VirtualMachine& vm) {
     u64 offset;
     GrabFromVM(offset);
     vm.begin_stack.push(vm.begin);
     vm.begin = vm.memory + offset;
-    MewUserAssert(vm.begin <= vm.end, "segmentation fault, cant call out of code");
+    VM_CHECK(vm.begin <= vm.end, "segmentation fault, cant call out of code");
+  }
+
+  void VM_MathBase(VirtualMachine& vm, byte type_x, byte type_y, u32* x, u32* y, byte** mem = nullptr) {
+    vm.rdi += 1;
+    VM_StackTop(vm, type_x, x, mem);
+    vm.rdi -= 1;
+    VM_StackTop(vm, type_y, y);
   }
 
   void VM_MathBase(VirtualMachine& vm, u32* x, u32* y, byte** mem = nullptr) {
     byte type_x = *vm.begin++;
     byte type_y = *vm.begin++;
-    vm.rdi += sizeof(u32);
-    VM_StackTop(vm, type_x, x, mem);
-    vm.rdi -= sizeof(u32);
-    VM_StackTop(vm, type_y, y);
+    VM_MathBase(vm, type_x, type_y, x, y, mem);
   }
 
   int VM_GetOffset(VirtualMachine& vm) {
@@ -672,228 +1730,259 @@ namespace Virtual {
     byte idx;
   } VM_REG_INFO;
 
+  enum VM_MathOp: byte {
+    VM_MathOp_Add, VM_MathOp_Sub, VM_MathOp_Mul, VM_MathOp_Div,
+    VM_MathOp_Xor, VM_MathOp_Or,  VM_MathOp_And,
+    VM_MathOp_Ls,  VM_MathOp_Rs,
+    VM_MathOp_Mov, VM_MathOp_Swap,
+    /* unary */
+    VM_MathOp_Inc, VM_MathOp_Dec, VM_MathOp_Not,
+    VM_MathOp_Count
+  };
+
+  /* value kind of an operand, ST and NUM are I32 */
+  enum VM_ArgKind: byte {
+    VM_ArgKind_None, VM_ArgKind_I32, VM_ArgKind_I64, VM_ArgKind_F32, VM_ArgKind_F64,
+    VM_ArgKind_Count
+  };
+
+  template<VM_ArgKind kind> struct VM_KindType { typedef int type; };
+  template<> struct VM_KindType<VM_ArgKind_I64> { typedef lli type; };
+  template<> struct VM_KindType<VM_ArgKind_F32> { typedef float type; };
+  template<> struct VM_KindType<VM_ArgKind_F64> { typedef double type; };
+
+  VM_ArgKind VM_RegKind(VM_RegType rt) {
+    switch (rt) {
+      case VM_RegType::R:  return VM_ArgKind_I32;
+      case VM_RegType::RX: return VM_ArgKind_I64;
+      case VM_RegType::FX: return VM_ArgKind_F32;
+      case VM_RegType::DX: return VM_ArgKind_F64;
+      default: return VM_ArgKind_None;
+    }
+  }
+
+  typedef void(*VM_MathKernel)(byte* a, byte* b);
+
+  /*
+    kind a source operand is read as. a register is read with the
+    destination's kind, its bytes as they are and not converted, the way
+    do_math always did: R with FX and RX with DX mix bit patterns, an
+    8 byte destination reads a 4 byte register together with the one
+    after it. ST and NUM stay I32 and convert
+  */
+  VM_ArgKind VM_SourceKind(VM_ArgKind dest, byte type, VM_ArgKind src) {
+    return type == Instruction_REG && dest != VM_ArgKind_None ? dest : src;
+  }
+
+  /*
+    one native operation for a fixed (op, dest kind, src kind), the source
+    converts to the destination type like plain c++ assignment does.
+    bitwise ops are skipped when a float takes part
+  */
+  template<VM_MathOp op, VM_ArgKind ka, VM_ArgKind kb>
+  void VM_MathKernelOf(byte* pa, byte* pb) {
+    constexpr bool unary = op >= VM_MathOp_Inc;
+    if constexpr (ka == VM_ArgKind_None || (!unary && kb == VM_ArgKind_None)) {
+      MewUserAssert(false, "undefined arg type");
+    } else {
+      typedef typename VM_KindType<ka>::type A;
+      typedef typename VM_KindType<kb>::type B;
+      constexpr bool bitwise =
+        op == VM_MathOp_Xor || op == VM_MathOp_Or || op == VM_MathOp_And ||
+        op == VM_MathOp_Ls  || op == VM_MathOp_Rs || op == VM_MathOp_Not;
+      constexpr bool has_float = std::is_floating_point_v<A> ||
+        (!unary && std::is_floating_point_v<B>);
+      if constexpr (!(bitwise && has_float)) {
+        A a; memcpy(&a, pa, sizeof(a));
+        B b = 0;
+        if constexpr (!unary) { memcpy(&b, pb, sizeof(b)); }
+        if constexpr (op == VM_MathOp_Add) { a += b; }
+        if constexpr (op == VM_MathOp_Sub) { a -= b; }
+        if constexpr (op == VM_MathOp_Mul) { a *= b; }
+        if constexpr (op == VM_MathOp_Div) { a /= b; }
+        if constexpr (op == VM_MathOp_Mov) { a = (A)b; }
+        if constexpr (op == VM_MathOp_Inc) { ++a; }
+        if constexpr (op == VM_MathOp_Dec) { --a; }
+        if constexpr (!has_float) {
+          if constexpr (op == VM_MathOp_Xor) { a ^= b; }
+          if constexpr (op == VM_MathOp_Or)  { a |= b; }
+          if constexpr (op == VM_MathOp_And) { a &= b; }
+          if constexpr (op == VM_MathOp_Ls)  { a <<= b; }
+          if constexpr (op == VM_MathOp_Rs)  { a >>= b; }
+          if constexpr (op == VM_MathOp_Not) { a = ~a; }
+        }
+        if constexpr (op == VM_MathOp_Swap) {
+          B t = (B)a; a = (A)b; b = t;
+          memcpy(pb, &b, sizeof(b));
+        }
+        memcpy(pa, &a, sizeof(a));
+      }
+    }
+  }
+
+  typedef std::array<VM_MathKernel, VM_ArgKind_Count*VM_ArgKind_Count> VM_MathKernelRow;
+
+  template<VM_MathOp op, size_t... I>
+  constexpr VM_MathKernelRow VM_MakeMathRow(std::index_sequence<I...>) {
+    return {{ &VM_MathKernelOf<op, (VM_ArgKind)(I / VM_ArgKind_Count), (VM_ArgKind)(I % VM_ArgKind_Count)>... }};
+  }
+
+  template<size_t... O>
+  constexpr std::array<VM_MathKernelRow, VM_MathOp_Count> VM_MakeMathTable(std::index_sequence<O...>) {
+    return {{ VM_MakeMathRow<(VM_MathOp)O>(std::make_index_sequence<VM_ArgKind_Count*VM_ArgKind_Count>{})... }};
+  }
+
+  /* [op][dest kind * VM_ArgKind_Count + src kind] */
+  static constexpr std::array<VM_MathKernelRow, VM_MathOp_Count> vm_math_kernels =
+    VM_MakeMathTable(std::make_index_sequence<VM_MathOp_Count>{});
+
+  inline VM_MathKernel VM_GetMathKernel(VM_MathOp op, VM_ArgKind ka, VM_ArgKind kb = VM_ArgKind_I32) {
+    return vm_math_kernels[op][ka*VM_ArgKind_Count + kb];
+  }
+
+  /*
+    small value type, never owns memory. register info and NUM immediates
+    are stored inline, so decoding an operand does not touch the heap
+  */
   class VM_ARG {
   public:
     VM_ARG() {}
-    byte* data;
-    byte* data2;
-    u32 size;
-
-    byte type;
+    byte* data = nullptr;  // ST | REG | MEM target
+    u32 size = 0;
+    lli num = 0;           // NUM value, widened so getLong reads it whole
+    VM_REG_INFO reg = {VM_RegType::None, 0};
+    byte type = 0;
+
+    byte* ptr() {
+      return type == Instruction_NUM ? (byte*)&this->num : this->data;
+    }
     int& getInt() {
-      return (int&)(*this->data);
+      return (int&)(*this->ptr());
     }
     lli& getLong() {
-      return (lli&)(*this->data);
+      return (lli&)(*this->ptr());
     }
     float& getFloat() {
-      return (float&)(*this->data);
+      return (float&)(*this->ptr());
     }
     double& getDouble() {
-      return (double&)(*this->data);
+      return (double&)(*this->ptr());
     }
     byte getByte() {
-      return (byte)(*this->data);
+      return (byte)(*this->ptr());
     }
 
     byte* getMem() {
-      return this->data;
-    }
-
-    static void do_math(VM_ARG& a, mew::asgio fn, bool depr_float = false) { 
-      switch (a.type) {
-        case Instruction_ST: mew::gen_asgio(fn, a.getInt()); break;
-        case Instruction_REG: {
-          VM_REG_INFO* ri = (VM_REG_INFO*)a.data2;
-          switch (ri->type) {
-            case VM_RegType::R: mew::gen_asgio(fn, a.getInt()); break;
-            case VM_RegType::RX: mew::gen_asgio(fn, a.getLong()); break;
-            case VM_RegType::FX: if (!depr_float) mew::gen_asgio(fn, a.getFloat()); break;
-            case VM_RegType::DX: if (!depr_float) mew::gen_asgio(fn, a.getDouble()); break;
-            default: MewUserAssert(false, "undefined reg type");
-          }
-          break;
-        }
-        default: MewUserAssert(false, "undefined arg type");
-      } 
-    }
-
-    static void do_math(VM_ARG& a, VM_ARG& b, mew::adgio fn, bool depr_float = false) {
-      switch (a.type) {
-        case Instruction_ST: {
-          switch (b.type) {
-            case Instruction_ST: mew::gen_adgio(fn, a.getInt(), b.getInt()); break;
-            case Instruction_REG: {
-              VM_REG_INFO* ri = (VM_REG_INFO*)a.data2;
-              switch (ri->type) {
-                case VM_RegType::R: mew::gen_adgio(fn, a.getInt(), b.getInt()); break;
-                case VM_RegType::RX: mew::gen_adgio(fn, a.getInt(), b.getLong()); break;
-                case VM_RegType::FX: if (!depr_float) mew::gen_adgio(fn, a.getInt(), b.getFloat()); break;
-                case VM_RegType::DX: if (!depr_float) mew::gen_adgio(fn, a.getInt(), b.getDouble()); break;
-                default: MewUserAssert(false, "undefined reg type");
-              }
-            } break;
-            case Instruction_NUM: {
-              mew::gen_adgio(fn, a.getInt(), b.getInt());
-            } break;
-          }
-        } break;
-        case Instruction_REG: {
-          VM_REG_INFO* ri = (VM_REG_INFO*)a.data2;
-          switch (ri->type) {
-            case VM_RegType::R: { 
-              switch (b.type) {
-                case Instruction_ST: mew::gen_adgio(fn, a.getInt(), b.getInt()); break;
-                case Instruction_REG: {
-                  VM_REG_INFO* ri = (VM_REG_INFO*)a.data2;
-                  switch (ri->type) {
-                    case VM_RegType::R: mew::gen_adgio(fn, a.getInt(), b.getInt()); break;
-                    case VM_RegType::RX: mew::gen_adgio(fn, a.getInt(), b.getLong()); break;
-                    case VM_RegType::FX: if (!depr_float) mew::gen_adgio(fn, a.getInt(), b.getFloat()); break;
-                    case VM_RegType::DX: if (!depr_float) mew::gen_adgio(fn, a.getInt(), b.getDouble()); break;
-                    default: MewUserAssert(false, "undefined reg type");
-                  }
-                } break;
-                case Instruction_NUM: {
-                  mew::gen_adgio(fn, a.getInt(), b.getInt());
-                } break;
-              }
-            } break;
-            case VM_RegType::RX: { 
-              switch (b.type) {
-                case Instruction_ST: mew::gen_adgio(fn, a.getLong(), b.getInt()); break;
-                case Instruction_REG: {
-                  VM_REG_INFO* ri = (VM_REG_INFO*)a.data2;
-                  switch (ri->type) {
-                    case VM_RegType::R: mew::gen_adgio(fn, a.getLong(), b.getInt()); break;
-                    case VM_RegType::RX: mew::gen_adgio(fn, a.getLong(), b.getLong()); break;
-                    case VM_RegType::FX: if (!depr_float) mew::gen_adgio(fn, a.getLong(), b.getFloat()); break;
-                    case VM_RegType::DX: if (!depr_float) mew::gen_adgio(fn, a.getLong(), b.getDouble()); break;
-                    default: MewUserAssert(false, "undefined reg type");
-                  }
-                } break;
-                case Instruction_NUM: {
-                  mew::gen_adgio(fn, a.getLong(), b.getInt());
-                } break;
-              }
-            } break;
-            case VM_RegType::FX: { 
-              if (depr_float) break;
-              switch (b.type) {
-                case Instruction_ST: mew::gen_adgio(fn, a.getFloat(), b.getInt()); break;
-                case Instruction_REG: {
-                  VM_REG_INFO* ri = (VM_REG_INFO*)a.data2;
-                  switch (ri->type) {
-                    case VM_RegType::R: mew::gen_adgio(fn, a.getFloat(), b.getInt()); break;
-                    case VM_RegType::RX: mew::gen_adgio(fn, a.getFloat(), b.getLong()); break;
-                    case VM_RegType::FX: mew::gen_adgio(fn, a.getFloat(), b.getFloat()); break;
-                    case VM_RegType::DX: mew::gen_adgio(fn, a.getFloat(), b.getDouble()); break;
-                    default: MewUserAssert(false, "undefined reg type");
-                  }
-                } break;
-                case Instruction_NUM: {
-                  mew::gen_adgio(fn, a.getFloat(), b.getInt());
-                } break;
-              }
-            } break;
-            case VM_RegType::DX: { 
-              if (depr_float) break;
-              switch (b.type) {
-                case Instruction_ST: mew::gen_adgio(fn, a.getDouble(), b.getInt()); break;
-                case Instruction_REG: {
-                  VM_REG_INFO* ri = (VM_REG_INFO*)a.data2;
-                  switch (ri->type) {
-                    case VM_RegType::R: mew::gen_adgio(fn, a.getDouble(), b.getInt()); break;
-                    case VM_RegType::RX: mew::gen_adgio(fn, a.getDouble(), b.getLong()); break;
-                    case VM_RegType::FX: mew::gen_adgio(fn, a.getDouble(), b.getFloat()); break;
-                    case VM_RegType::DX: mew::gen_adgio(fn, a.getDouble(), b.getDouble()); break;
-                    default: MewUserAssert(false, "undefined reg type");
-                  }
-                } break;
-                case Instruction_NUM: {
-                  mew::gen_adgio(fn, a.getDouble(), b.getInt());
-                } break;
-              }
-            } break;
-            default: MewUserAssert(false, "undefined reg type");
-          }
-        } break;
-        default: MewUserAssert(false, "undefined arg type");
-      } 
+      return this->ptr();
+    }
+
+    VM_ArgKind kind() const {
+      switch (type) {
+        case Instruction_ST:
+        case Instruction_NUM: return VM_ArgKind_I32;
+        case Instruction_REG: return VM_RegKind(reg.type);
+        default: return VM_ArgKind_None;
+      }
+    }
+
+    static void do_math(VM_ARG& a, VM_MathOp op) {
+      VM_GetMathKernel(op, a.kind())(a.ptr(), nullptr);
+    }
+
+    static void do_math(VM_ARG& a, VM_ARG& b, VM_MathOp op) {
+      VM_ArgKind ka = a.kind();
+      VM_GetMathKernel(op, ka, VM_SourceKind(ka, b.type, b.kind()))(a.ptr(), b.ptr());
     }
 
     VM_ARG& operator++() {
-      do_math(*this, mew::aginc);
+      do_math(*this, VM_MathOp_Inc);
       return *this;
     }
 
     VM_ARG& operator--() {
-      do_math(*this, mew::agdec);
+      do_math(*this, VM_MathOp_Dec);
       return *this;
     }
 
     static void mov(VM_ARG& a, VM_ARG& b) {
-      do_math(a, b, mew::agmov);
+      do_math(a, b, VM_MathOp_Mov);
     }
     static void swap(VM_ARG& a, VM_ARG& b) {
-      do_math(a, b, mew::agswap);
+      do_math(a, b, VM_MathOp_Swap);
     }
   };
 
   VM_ARG& operator+(VM_ARG& a, VM_ARG& b) {
-    VM_ARG::do_math(a, b, mew::agadd);
+    VM_ARG::do_math(a, b, VM_MathOp_Add);
     return a;
   }
   VM_ARG& operator-(VM_ARG& a, VM_ARG& b) {
-    VM_ARG::do_math(a, b, mew::agsub);
+    VM_ARG::do_math(a, b, VM_MathOp_Sub);
     return a;
   }
   VM_ARG& operator/(VM_ARG& a, VM_ARG& b) {
-    VM_ARG::do_math(a, b, mew::agdiv);
+    VM_ARG::do_math(a, b, VM_MathOp_Div);
     return a;
   }
   VM_ARG& operator*(VM_ARG& a, VM_ARG& b) {
-    VM_ARG::do_math(a, b, mew::agmul);
+    VM_ARG::do_math(a, b, VM_MathOp_Mul);
     return a;
   }
   VM_ARG& operator>>(VM_ARG& a, VM_ARG& b) {
-    VM_ARG::do_math(a, b, mew::agrs, true);
+    VM_ARG::do_math(a, b, VM_MathOp_Rs);
     return a;
   }
   VM_ARG& operator<<(VM_ARG& a, VM_ARG& b) {
-    VM_ARG::do_math(a, b, mew::agls, true);
+    VM_ARG::do_math(a, b, VM_MathOp_Ls);
     return a;
   }
   VM_ARG& operator^(VM_ARG& a, VM_ARG& b) {
-    VM_ARG::do_math(a, b, mew::agxor, true);
+    VM_ARG::do_math(a, b, VM_MathOp_Xor);
     return a;
   }
   VM_ARG& operator~(VM_ARG& a) {
-    VM_ARG::do_math(a, mew::agnot, true);
+    VM_ARG::do_math(a, VM_MathOp_Not);
     return a;
   }
   VM_ARG& operator|(VM_ARG& a, VM_ARG& b) {
-    VM_ARG::do_math(a, b, mew::agor, true);
+    VM_ARG::do_math(a, b, VM_MathOp_Or);
     return a;
   }
   VM_ARG& operator&(VM_ARG& a, VM_ARG& b) {
-    VM_ARG::do_math(a, b, mew::agand, true);
+    VM_ARG::do_math(a, b, VM_MathOp_And);
     return a;
   }
 
+  template<typename Cfg = VM_Checked>
+  VM_ARG VM_ArgFromStack(VirtualMachine& vm, u32 offset) {
+    VM_ARG arg;
+    MewUserAssert(vm.stack.has(offset), "out of stack");
+    arg.data = (byte*)&vm.stack.peek(offset);
+    arg.type = Instruction_ST;
+    arg.size = sizeof(u32);
+    return arg;
+  }
+
+  template<typename Cfg = VM_Checked>
+  VM_ARG VM_ArgFromMem(VirtualMachine& vm, u64 offset, u64 size) {
+    VM_CHECK(vm.heap+offset < vm.end, "out of memory");
+    byte* pointer = vm.heap+offset;
+    VM_CHECK(pointer+size < vm.end, "out of memory");
+    VM_ARG arg;
+    arg.data = pointer;
+    arg.type = Instruction_MEM;
+    arg.size = size;
+    return arg;
+  }
+
+  template<typename Cfg = VM_Checked>
   VM_ARG VM_GetArg(VirtualMachine& vm) {
     byte type = *vm.begin++;
     switch (type) {
       case Instruction_ST: {
         u32 offset;
         GrabFromVM(offset);
-        VM_ARG arg;
-        MewUserAssert(vm.stack.size() < offset, "out of stack");
-        byte* num = vm.stack.begin()+(vm.stack.size() - 1 - offset);
-        arg.data = num;
-        arg.type = type;
-        arg.size = sizeof(u32);
-        return arg;
+        return VM_ArgFromStack<Cfg>(vm, offset);
       };
       case Instruction_REG: {
         byte rtype = *vm.begin++;
@@ -901,10 +1990,8 @@ namespace Virtual {
         u64 size;
         VM_ARG arg;
         arg.data = vm.getRegister((VM_RegType)rtype, ridx, &size);
-        VM_REG_INFO* ri = new VM_REG_INFO();
-        ri->idx = ridx;
-        ri->type = (VM_RegType)rtype;
-        arg.data2 = (byte*)ri;
+        arg.reg.type = (VM_RegType)rtype;
+        arg.reg.idx = ridx;
         arg.type = type;
         arg.size = (u32)size;
         return arg;
@@ -913,7 +2000,7 @@ namespace Virtual {
         s32 num;
         GrabFromVM(num);
         VM_ARG arg;
-        arg.data = (byte*)num;
+        arg.num = num;
         arg.type = type;
         arg.size = sizeof(num);
         return arg;
@@ -921,16 +2008,9 @@ namespace Virtual {
       case Instruction_MEM: {
         u64 offset;
         GrabFromVM(offset);
-        MewUserAssert(vm.heap+offset < vm.end, "out of memory");
-        byte* pointer = vm.heap+offset;
         u64 size;
         GrabFromVM(size);
-        MewUserAssert(pointer+size < vm.end, "out of memory");
-        VM_ARG arg;
-        arg.data = pointer;
-        arg.type = type;
-        arg.size = size;
-        return arg;
+        return VM_ArgFromMem<Cfg>(vm, offset, size);
       }
     
       default: MewUserAssert(false, "undefined arg type");
@@ -944,104 +2024,103 @@ namespace Virtual {
     vm.rdi = offset;
   }
 
+  template<typename Cfg = VM_Checked>
   void VM_Add(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    auto a = VM_GetArg(vm);
-    auto b = VM_GetArg(vm);
+    auto a = VM_GetArg<Cfg>(vm);
+    auto b = VM_GetArg<Cfg>(vm);
     a + b;
   }
 
+  template<typename Cfg = VM_Checked>
   void VM_Sub(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    auto a = VM_GetArg(vm);
-    auto b = VM_GetArg(vm);
+    auto a = VM_GetArg<Cfg>(vm);
+    auto b = VM_GetArg<Cfg>(vm);
     a - b;
   }
   
+  template<typename Cfg = VM_Checked>
   void VM_Mul(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    auto a = VM_GetArg(vm);
-    auto b = VM_GetArg(vm);
+    auto a = VM_GetArg<Cfg>(vm);
+    auto b = VM_GetArg<Cfg>(vm);
     a * b;
   }
+  template<typename Cfg = VM_Checked>
   void VM_Div(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    auto a = VM_GetArg(vm);
-    auto b = VM_GetArg(vm);
+    auto a = VM_GetArg<Cfg>(vm);
+    auto b = VM_GetArg<Cfg>(vm);
     a / b;
   }
   
+  template<typename Cfg = VM_Checked>
   void VM_Inc(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    auto a = VM_GetArg(vm);
+    auto a = VM_GetArg<Cfg>(vm);
     ++a;
   }
 
+  template<typename Cfg = VM_Checked>
   void VM_Dec(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    auto a = VM_GetArg(vm);
+    auto a = VM_GetArg<Cfg>(vm);
     --a;
   }
 
+  template<typename Cfg = VM_Checked>
   void VM_Xor(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    auto a = VM_GetArg(vm);
-    auto b = VM_GetArg(vm);
+    auto a = VM_GetArg<Cfg>(vm);
+    auto b = VM_GetArg<Cfg>(vm);
     a ^ b;
   }
 
+  template<typename Cfg = VM_Checked>
   void VM_Or(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    auto a = VM_GetArg(vm);
-    auto b = VM_GetArg(vm);
+    auto a = VM_GetArg<Cfg>(vm);
+    auto b = VM_GetArg<Cfg>(vm);
     a | b;
   }
 
+  template<typename Cfg = VM_Checked>
   void VM_Not(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    auto a = VM_GetArg(vm);
+    auto a = VM_GetArg<Cfg>(vm);
     ~a;
   }
   
+  template<typename Cfg = VM_Checked>
   void VM_And(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    auto a = VM_GetArg(vm);
-    auto b = VM_GetArg(vm);
+    auto a = VM_GetArg<Cfg>(vm);
+    auto b = VM_GetArg<Cfg>(vm);
     a & b;
   }
 
+  template<typename Cfg = VM_Checked>
   void VM_LS(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    auto a = VM_GetArg(vm);
-    auto b = VM_GetArg(vm);
+    auto a = VM_GetArg<Cfg>(vm);
+    auto b = VM_GetArg<Cfg>(vm);
     a << b;
   }
 
+  template<typename Cfg = VM_Checked>
   void VM_RS(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    auto a = VM_GetArg(vm);
-    auto b = VM_GetArg(vm);
+    auto a = VM_GetArg<Cfg>(vm);
+    auto b = VM_GetArg<Cfg>(vm);
     a >> b;
   }
   
+  template<typename Cfg = VM_Checked>
   void VM_ManualJmp(VirtualMachine& vm, u32 offset) {
-    MewUserAssert(MEW_IN_RANGE(vm.memory, vm.end, vm.begin+offset), 
-      "out of memory");
+    VM_CHECK(MEW_IN_RANGE(vm.memory, vm.end, vm.begin+offset), "out of memory");
     vm.begin = vm.memory + offset;
-    MewUserAssert(vm.begin <= vm.end, "segmentation fault, cant call out of code");
+    VM_CHECK(vm.begin <= vm.end, "segmentation fault, cant call out of code");
   }
 
   
+  template<typename Cfg = VM_Checked>
   void VM_Jmp(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     u64 offset;
     GrabFromVM(offset);
     vm.begin = vm.memory + offset;
-    MewUserAssert(vm.begin <= vm.end, "segmentation fault, cant call out of code");
+    VM_CHECK(vm.begin <= vm.end, "segmentation fault, cant call out of code");
   }
 
   void VM_Ret(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     if (vm.begin_stack.empty()) {
       vm.status = VM_Status_Ret; return;
     }
@@ -1050,11 +2129,10 @@ namespace Virtual {
     vm.begin_stack.pop();
   }
 
-  void VM_Test(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
+  void VM_Test(VirtualMachine& vm, byte type_x, byte type_y) {
     u32 x, y;
     vm.test = {0};
-    VM_MathBase(vm, (u32*)&x, (u32*)&y);
+    VM_MathBase(vm, type_x, type_y, (u32*)&x, (u32*)&y);
     int result = memcmp(&x, &y, sizeof(x));
     if (result > 0) {
       vm.test.more = 1;
@@ -1065,115 +2143,120 @@ namespace Virtual {
     }
   }
 
+  void VM_Test(VirtualMachine& vm) {
+    byte type_x = *vm.begin++;
+    byte type_y = *vm.begin++;
+    VM_Test(vm, type_x, type_y);
+  }
+
+  template<typename Cfg = VM_Checked>
   void VM_JE(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     int offset; 
     memcpy(&offset, vm.begin, sizeof(int));
     if (vm.test.equal) {
-      VM_ManualJmp(vm, offset);
+      VM_ManualJmp<Cfg>(vm, offset);
     } else {
       vm.begin += sizeof(int);
     }
   }
+  template<typename Cfg = VM_Checked>
   void VM_JEL(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     int offset; 
     memcpy(&offset, vm.begin, sizeof(int));
     if (vm.test.equal || vm.test.less) {
-      VM_ManualJmp(vm, offset);
+      VM_ManualJmp<Cfg>(vm, offset);
     } else {
       vm.begin += sizeof(int);
     }
   }
+  template<typename Cfg = VM_Checked>
   void VM_JEM(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     int offset; 
     memcpy(&offset, vm.begin, sizeof(int));
     if (vm.test.equal || vm.test.more) {
-      VM_ManualJmp(vm, offset);
+      VM_ManualJmp<Cfg>(vm, offset);
     } else {
       vm.begin += sizeof(int);
     }
   }
+  template<typename Cfg = VM_Checked>
   void VM_JL(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     int offset; 
     memcpy(&offset, vm.begin, sizeof(int));
     if (vm.test.less) {
-      VM_ManualJmp(vm, offset);
+      VM_ManualJmp<Cfg>(vm, offset);
     } else {
       vm.begin += sizeof(int);
     }
   }
+  template<typename Cfg = VM_Checked>
   void VM_JM(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     int offset; 
     memcpy(&offset, vm.begin, sizeof(int));
     if (vm.test.more) {
-      VM_ManualJmp(vm, offset);
+      VM_ManualJmp<Cfg>(vm, offset);
     } else {
       vm.begin += sizeof(int);
     }
   }
+  template<typename Cfg = VM_Checked>
   void VM_JNE(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     int offset; 
     memcpy(&offset, vm.begin, sizeof(int));
     if (!vm.test.equal) {
-      VM_ManualJmp(vm, offset);
+      VM_ManualJmp<Cfg>(vm, offset);
     } else {
       vm.begin += sizeof(int);
     }
   }
 
+  template<typename Cfg = VM_Checked>
   void VM_Mov(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    auto a = VM_GetArg(vm);
-    auto b = VM_GetArg(vm);
+    auto a = VM_GetArg<Cfg>(vm);
+    auto b = VM_GetArg<Cfg>(vm);
     VM_ARG::mov(a, b);
   }
 
+  template<typename Cfg = VM_Checked>
   void VM_Swap(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    auto a = VM_GetArg(vm);
-    auto b = VM_GetArg(vm);
+    auto a = VM_GetArg<Cfg>(vm);
+    auto b = VM_GetArg<Cfg>(vm);
     VM_ARG::swap(a, b);
   }
 
+  template<typename Cfg = VM_Checked>
   void VM_MSet(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     u64 x; /* start */
     u64 y; /* size  */
     u64 z; /* value */
     GrabFromVM(x);
     GrabFromVM(y);
     GrabFromVM(z);
-    MewUserAssert(vm.heap+x < vm.end, "out of memory");
-    MewUserAssert(vm.heap+x+y < vm.end, "out of memory");
+    VM_CHECK(vm.heap+x < vm.end, "out of memory");
+    VM_CHECK(vm.heap+x+y <= vm.end, "out of memory");
     memset(vm.heap+x, z, y);
   }
 
   void VM_Putc(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     wchar_t long_char;
     memcpy(&long_char, vm.begin, sizeof(wchar_t)); vm.begin+=sizeof(wchar_t);
     fputwc(long_char, vm.std_out);
   }
   
+  template<typename Cfg = VM_Checked>
   void VM_Puti(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    auto x = VM_GetArg(vm);
+    auto x = VM_GetArg<Cfg>(vm);
     int xi = x.getInt();
     char str[12] = {0};
     mew::_itoa10(xi, str);
     fputs(str, vm.std_out);
   }
 
+  template<typename Cfg = VM_Checked>
   void VM_Puts(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     u64 offset;
     GrabFromVM(offset);
-    MewUserAssert(vm.heap+offset < vm.end, "out of memory");
+    VM_CHECK(vm.heap+offset < vm.end, "out of memory");
     byte* pointer = vm.heap+offset;
     char* begin = (char*)pointer;
     while (*(begin) != 0) {
@@ -1181,71 +2264,151 @@ namespace Virtual {
     }
   }
 
+  /* with async_io the opcode only records the io and suspends the vm */
+  bool VM_SuspendIO(VirtualMachine& vm, VM_IOKind kind, u32 descr, VM_ARG& arg, u64 offset = 0) {
+    if (!vm.flags.async_io) { return false; }
+    VM_PendingIO& io = vm.io;
+    io.kind = kind;
+    io.descr = descr;
+    io.offset = offset;
+    io.submitted = false;
+    io.failed = false;
+    io.done.store(false, std::memory_order_relaxed);
+    if (arg.type == Instruction_NUM) {
+      io.scratch = arg.num;
+      io.data = (byte*)&io.scratch;
+      io.size = sizeof(io.scratch);
+    } else {
+      io.data = arg.getMem();
+      io.size = arg.size;
+    }
+    vm.status = VM_Status_Wait;
+    return true;
+  }
+
+  /* runs on the io worker, the vm is suspended so nothing else touches it */
+  void VM_PerformIO(VirtualMachine& vm) {
+    VM_PendingIO& io = vm.io;
+    try {
+      switch (io.kind) {
+        case VM_IO_Getch: {
+          int c = mew::wait_char();
+          memcpy(io.data, &c, io.size < sizeof(c) ? io.size : sizeof(c));
+        } break;
+        case VM_IO_Read:  vm.fs.ReadFromFile(io.descr, io.data, io.size); break;
+        case VM_IO_Write: vm.fs.WriteToFile(io.descr, io.data, io.size); break;
+        case VM_IO_PRead:  vm.stack.push(vm.fs.PRead(io.descr, io.data, io.size, io.offset)); break;
+        case VM_IO_PWrite: vm.stack.push(vm.fs.PWrite(io.descr, io.data, io.size, io.offset)); break;
+        case VM_IO_Sync: MewUserAssert(vm.fs.Sync(io.descr), "failed to sync file"); break;
+        default: break;
+      }
+    } catch (std::exception& e) {
+      io.failed = true;
+    }
+    io.kind = VM_IO_None;
+    io.done.store(true, std::memory_order_release);
+  }
+
+  template<typename Cfg = VM_Checked>
   void VM_Getch(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    int& a = VM_GetArg(vm).getInt();
+    auto arg = VM_GetArg<Cfg>(vm);
+    if (VM_SuspendIO(vm, VM_IO_Getch, 0, arg)) { return; }
+    int& a = arg.getInt();
     a = mew::wait_char();
   }
   
   // 
+  template<typename Cfg = VM_Checked>
   void VM_LM(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    auto a = VM_GetArg(vm);
-    auto b = VM_GetArg(vm);
+    auto a = VM_GetArg<Cfg>(vm);
+    auto b = VM_GetArg<Cfg>(vm);
     VM_ARG::mov(a, b);
   }
 
+  template<typename Cfg = VM_Checked>
   void VM_Open(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     u64 offset;
     GrabFromVM(offset);
-    MewUserAssert(vm.heap+offset < vm.end, "out of memory");
+    VM_CHECK(vm.heap+offset < vm.end, "out of memory");
     byte* path = vm.heap+offset;
     u32 descr = vm.fs.Open((const char*)path);
     VM_ManualPush(vm, descr);
   }
 
+  template<typename Cfg = VM_Checked>
   void VM_Close(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    auto descr_arg = VM_GetArg(vm);
+    auto descr_arg = VM_GetArg<Cfg>(vm);
     u32 descr = (u32)descr_arg.getLong();
     vm.fs.Close(descr);
   }
 
+  template<typename Cfg = VM_Checked>
   void VM_Wine(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     u64 offset;
     GrabFromVM(offset);
-    MewUserAssert(vm.heap+offset < vm.end, "out of memory");
+    VM_CHECK(vm.heap+offset < vm.end, "out of memory");
     byte* path = vm.heap+offset;
     vm.fs.CreateFileIfNotExist((const char*)path);
   }
   
+  template<typename Cfg = VM_Checked>
   void VM_Write(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     u32 descr;
     GrabFromVM(descr);
-    auto content = VM_GetArg(vm);
+    auto content = VM_GetArg<Cfg>(vm);
+    if (VM_SuspendIO(vm, VM_IO_Write, descr, content)) { return; }
     u8* raw_content = content.getMem();
     u64 size = content.size;
     vm.fs.WriteToFile(descr, raw_content, size);
   }
 
+  template<typename Cfg = VM_Checked>
   void VM_Read(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     u32 descr;
     GrabFromVM(descr);
-    auto dest = VM_GetArg(vm);
+    auto dest = VM_GetArg<Cfg>(vm);
+    if (VM_SuspendIO(vm, VM_IO_Read, descr, dest)) { return; }
     u8* raw_dest = dest.getMem();
     u64 size = dest.size;
     vm.fs.ReadFromFile(descr, raw_dest, size);
   }
   
+  /* positional io, the descriptor offset stays, pushes bytes transferred */
+  template<typename Cfg = VM_Checked>
+  void VM_PRead(VirtualMachine& vm) {
+    u32 descr;
+    GrabFromVM(descr);
+    auto dest = VM_GetArg<Cfg>(vm);
+    u64 offset = VM_GetArg<Cfg>(vm).getLong();
+    if (VM_SuspendIO(vm, VM_IO_PRead, descr, dest, offset)) { return; }
+    vm.stack.push(vm.fs.PRead(descr, dest.getMem(), dest.size, offset));
+  }
+
+  template<typename Cfg = VM_Checked>
+  void VM_PWrite(VirtualMachine& vm) {
+    u32 descr;
+    GrabFromVM(descr);
+    auto content = VM_GetArg<Cfg>(vm);
+    u64 offset = VM_GetArg<Cfg>(vm).getLong();
+    if (VM_SuspendIO(vm, VM_IO_PWrite, descr, content, offset)) { return; }
+    vm.stack.push(vm.fs.PWrite(descr, content.getMem(), content.size, offset));
+  }
+
+  /* durability point, waits for write-behind of the descriptor and syncs it */
+  template<typename Cfg = VM_Checked>
+  void VM_Sync(VirtualMachine& vm) {
+    u32 descr;
+    GrabFromVM(descr);
+    VM_ARG none;
+    if (VM_SuspendIO(vm, VM_IO_Sync, descr, none)) { return; }
+    MewUserAssert(vm.fs.Sync(descr), "failed to sync file");
+  }
+
+  template<typename Cfg = VM_Checked>
   void VM_GetIternalPointer(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
-    auto _from = VM_GetArg(vm);
-    auto _size = VM_GetArg(vm);
-    auto _where = VM_GetArg(vm);
+    auto _from = VM_GetArg<Cfg>(vm);
+    auto _size = VM_GetArg<Cfg>(vm);
+    auto _where = VM_GetArg<Cfg>(vm);
     u8* from = (u8*)_from.getLong();
     u64 size = _size.getLong();
     u8* where = (u8*)_where.getLong();
@@ -1254,36 +2417,174 @@ namespace Virtual {
   
   // put into rx4 vm pointer;
   void VM_GetVM(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     u64 rx_size;
     auto rx4 = vm.getRegister(VM_RegType::RX, 4, &rx_size);
     byte* vm_ptr = (byte*)&vm;
     memcpy(rx4, vm_ptr, rx_size);
   }
   
+  template<typename Cfg = VM_Checked>
+  void VM_DCALLS(VirtualMachine& vm) {
+    u64 slot;
+    GrabFromVM(slot);
+    vm.begin += sizeof(u64);
+    VM_NativeTable* natives = vm.src->natives;
+    MewUserAssert(natives != nullptr && slot < natives->slots.size(), "unbound native slot");
+    vm.stack.push(natives->slots[slot](&vm));
+  }
+
+  /*
+    pops argc slots, calls the host function, pushes its result. the args
+    are copied off the stack first, the callback may push and pop freely
+  */
+  template<typename Cfg = VM_Checked>
+  void VM_HCALL(VirtualMachine& vm) {
+    u32 id;
+    GrabFromVM(id);
+    byte argc = *vm.begin++;
+    MewUserAssert(vm.stack.size() >= argc, "out of stack");
+    const VM_HostEntry* entry = VM_FindHost(vm, id);
+    MewUserAssert(entry != nullptr, "undefined host function");
+    u64 values[256];
+    memcpy(values, vm.stack.data() + vm.stack.size() - argc, argc*sizeof(u64));
+    vm.stack.drop(argc);
+    u64 result = entry->fn(vm, VM_HostArgs{values, argc}, entry->user);
+    vm.stack.push(result);
+  }
+
+  /*
+    the head lives in guest-writable heap, so count/stride are checked
+    against the heap on every call regardless of Cfg before the native
+    side gets pointers it will write through
+  */
+  template<typename Cfg = VM_Checked>
+  void VM_NativeBatchCall(VirtualMachine& vm, vm_dll_batch_fn proc, u64 batch, u64 results) {
+    u64 heap_size = (u64)(vm.end - vm.heap);
+    MewUserAssert(batch <= heap_size && sizeof(VM_NativeBatch) <= heap_size - batch, "out of memory");
+    VM_NativeBatch head;
+    memcpy(&head, vm.heap+batch, sizeof(head));
+    u64 records_room = heap_size - batch - sizeof(head);
+    MewUserAssert(head.stride == 0 || head.count <= records_room / head.stride, "out of memory");
+    MewUserAssert(results <= heap_size && head.count <= (heap_size - results) / sizeof(u64), "out of memory");
+    const byte* records = vm.heap+batch+sizeof(head);
+    vm.stack.push(proc(&vm, records, head.stride, (u64*)(vm.heap+results), head.count));
+  }
+
+  template<typename Cfg = VM_Checked>
+  void VM_DCALLBS(VirtualMachine& vm) {
+    u64 slot, batch, results;
+    GrabFromVM(slot);
+    vm.begin += sizeof(u64);
+    GrabFromVM(batch);
+    GrabFromVM(results);
+    VM_NativeTable* natives = vm.src->natives;
+    MewUserAssert(natives != nullptr && slot < natives->batch_slots.size(), "unbound native slot");
+    VM_NativeBatchCall<Cfg>(vm, natives->batch_slots[slot], batch, results);
+  }
+
+  template<typename Cfg = VM_Checked>
+  void VM_DCALLB(VirtualMachine& vm) {
+    u64 lib_idx, offset, batch, results;
+    GrabFromVM(lib_idx);
+    GrabFromVM(offset);
+    GrabFromVM(batch);
+    GrabFromVM(results);
+    VM_CHECK(vm.heap+offset < vm.end, "out of memory");
+    auto name = (const char*)vm.heap+offset;
+    auto proc = (vm_dll_batch_fn)VM_GetDllPipeFunction(vm, lib_idx, name);
+    VM_NativeBatchCall<Cfg>(vm, proc, batch, results);
+  }
+
+  template<typename Cfg = VM_Checked>
   void VM_DCALL(VirtualMachine& vm) {
-    vm.debug.last_fn = (char*)__func__;
     u64 lib_idx;
     GrabFromVM(lib_idx);
     u64 offset;
     GrabFromVM(offset);
-    MewUserAssert(vm.heap+offset < vm.end, "out of memory");
+    VM_CHECK(vm.heap+offset < vm.end, "out of memory");
     auto name = (const char*)vm.heap+offset;
     auto proc = VM_GetDllPipeFunction(vm, lib_idx, name);
     auto result = proc(&vm);
     vm.stack.push(result);
   }
 
+  const char* VM_InstructionName(byte head_byte) {
+    switch (head_byte) {
+      case Instruction_NONE:   return "VM_None";
+      case Instruction_PUSH:   return "VM_Push";
+      case Instruction_POP:    return "VM_Pop";
+      case Instruction_RPOP:   return "VM_RPop";
+      case Instruction_ADD:    return "VM_Add";
+      case Instruction_SUB:    return "VM_Sub";
+      case Instruction_MUL:    return "VM_Mul";
+      case Instruction_DIV:    return "VM_Div";
+      case Instruction_INC:    return "VM_Inc";
+      case Instruction_DEC:    return "VM_Dec";
+      case Instruction_XOR:    return "VM_Xor";
+      case Instruction_OR:     return "VM_Or";
+      case Instruction_NOT:    return "VM_Not";
+      case Instruction_AND:    return "VM_And";
+      case Instruction_LS:     return "VM_LS";
+      case Instruction_RS:     return "VM_RS";
+      case Instruction_JMP:    return "VM_Jmp";
+      case Instruction_RET:    return "VM_Ret";
+      case Instruction_EXIT:   return "VM_Exit";
+      case Instruction_TEST:   return "VM_Test";
+      case Instruction_JE:     return "VM_JE";
+      case Instruction_JEL:    return "VM_JEL";
+      case Instruction_JEM:    return "VM_JEM";
+      case Instruction_JNE:    return "VM_JNE";
+      case Instruction_JL:     return "VM_JL";
+      case Instruction_JM:     return "VM_JM";
+      case Instruction_MOV:    return "VM_Mov";
+      case Instruction_SWAP:   return "VM_Swap";
+      case Instruction_MSET:   return "VM_MSet";
+      case Instruction_WRITE:  return "VM_Write";
+      case Instruction_READ:   return "VM_Read";
+      case Instruction_WINE:   return "VM_Wine";
+      case Instruction_OPEN:   return "VM_Open";
+      case Instruction_CLOSE:  return "VM_Close";
+      case Instruction_LM:     return "VM_LM";
+      case Instruction_PUTC:   return "VM_Putc";
+      case Instruction_PUTI:   return "VM_Puti";
+      case Instruction_PUTS:   return "VM_Puts";
+      case Instruction_GETCH:  return "VM_Getch";
+      case Intruction_GetVM:   return "VM_GetVM";
+      case Intruction_GetIPTR: return "VM_GetIternalPointer";
+      case Instruction_MOVRDI: return "VM_MovRDI";
+      case Instruction_CALL:   return "VM_Call";
+      case Instruction_DCALL:  return "VM_DCALL";
+      case Instruction_DCALLS: return "VM_DCALLS";
+      case Instruction_DCALLB: return "VM_DCALLB";
+      case Instruction_DCALLBS: return "VM_DCALLBS";
+      case Instruction_HCALL:  return "VM_HCALL";
+      case Instruction_PREAD:  return "VM_PRead";
+      case Instruction_PWRITE: return "VM_PWrite";
+      case Instruction_SYNC:   return "VM_Sync";
+      default: return "unknown";
+    }
+  }
+
+  /* bookkeeping of debug runs, every engine notes each instruction before running it */
+  template<typename Cfg>
+  inline void VM_DebugNote(VirtualMachine& vm, byte head_byte) {
+    if constexpr (Cfg::debug) {
+      vm.debug.last_head_byte = head_byte;
+      vm.debug.last_fn = (char*)VM_InstructionName(head_byte);
+    }
+  }
+
+  template<typename Cfg = VM_Checked>
   void RunLine(VirtualMachine& vm) {
     byte head_byte = *vm.begin++;
-    vm.debug.last_head_byte = head_byte;
-    if (vm.flags.heap_lock_execute) { 
+    VM_DebugNote<Cfg>(vm, head_byte);
+    if constexpr (Cfg::heap_lock) { 
       MewAssert(vm.begin < vm.heap);
     }
     switch (head_byte) {
       case Instruction_NONE: break;
       case Instruction_PUSH: {
-        VM_Push(vm);
+        VM_Push<Cfg>(vm);
       } break;
       case Instruction_POP: {
         VM_Pop(vm);
@@ -1292,40 +2593,43 @@ namespace Virtual {
         VM_RPop(vm);
       } break;
       case Instruction_ADD: {
-        VM_Add(vm);
+        VM_Add<Cfg>(vm);
       } break;
       case Instruction_SUB: {
-        VM_Sub(vm);
+        VM_Sub<Cfg>(vm);
       } break;
       case Instruction_MUL: {
-        VM_Mul(vm);
+        VM_Mul<Cfg>(vm);
       } break;
       case Instruction_DIV: {
-        VM_Div(vm);
+        VM_Div<Cfg>(vm);
       } break;
       case Instruction_INC: {
-        VM_Inc(vm);
+        VM_Inc<Cfg>(vm);
       } break;
       case Instruction_DEC: {
-        VM_Dec(vm);
+        VM_Dec<Cfg>(vm);
       } break;
       case Instruction_XOR: {
-        VM_Xor(vm);
+        VM_Xor<Cfg>(vm);
       } break;
       case Instruction_OR: {
-        VM_Or(vm);
+        VM_Or<Cfg>(vm);
       } break;
       case Instruction_NOT: {
-        VM_Not(vm);
+        VM_Not<Cfg>(vm);
+      } break;
+      case Instruction_AND: {
+        VM_And<Cfg>(vm);
       } break;
       case Instruction_LS: {
-        VM_LS(vm);
+        VM_LS<Cfg>(vm);
       } break;
       case Instruction_RS: {
-        VM_RS(vm);
+        VM_RS<Cfg>(vm);
       } break;
       case Instruction_JMP: {
-        VM_Jmp(vm);
+        VM_Jmp<Cfg>(vm);
       } break;
       case Instruction_RET: {
         VM_Ret(vm);
@@ -1334,76 +2638,97 @@ namespace Virtual {
         VM_Test(vm);
       } break;
       case Instruction_JE: {
-        VM_JE(vm);
+        VM_JE<Cfg>(vm);
       } break;
       case Instruction_JEL: {
-        VM_JEL(vm);
+        VM_JEL<Cfg>(vm);
       } break;
       case Instruction_JEM: {
-        VM_JEM(vm);
+        VM_JEM<Cfg>(vm);
       } break;
       case Instruction_JL: {
-        VM_JL(vm);
+        VM_JL<Cfg>(vm);
       } break;
       case Instruction_JM: {
-        VM_JM(vm);
+        VM_JM<Cfg>(vm);
       } break;
       case Instruction_JNE: {
-        VM_JNE(vm);
+        VM_JNE<Cfg>(vm);
       } break;
       case Instruction_MOV: {
-        VM_Mov(vm);
+        VM_Mov<Cfg>(vm);
       } break;
       case Instruction_SWAP: {
-        VM_Swap(vm);
+        VM_Swap<Cfg>(vm);
       } break;
       case Instruction_MSET: {
-        VM_MSet(vm);
+        VM_MSet<Cfg>(vm);
       } break;
       case Instruction_PUTC: {
         VM_Putc(vm);
       } break;
       case Instruction_PUTI: {
-        VM_Puti(vm);
+        VM_Puti<Cfg>(vm);
       } break;
       case Instruction_PUTS: {
-        VM_Puts(vm);
+        VM_Puts<Cfg>(vm);
       } break;
       case Instruction_GETCH: {
-        VM_Getch(vm);
+        VM_Getch<Cfg>(vm);
       } break;
       case Instruction_MOVRDI: {
         VM_MovRDI(vm);
       } break;
       case Instruction_CALL: {
-        VM_Call(vm);
+        VM_Call<Cfg>(vm);
       } break;
       case Instruction_WINE: {
-        VM_Wine(vm);
+        VM_Wine<Cfg>(vm);
       } break;
       case Instruction_WRITE: {
-        VM_Write(vm);
+        VM_Write<Cfg>(vm);
       } break;
       case Instruction_READ: {
-        VM_Read(vm);
+        VM_Read<Cfg>(vm);
       } break;
       case Intruction_GetVM: {
         VM_GetVM(vm);
       } break;
       case Intruction_GetIPTR: {
-        VM_GetIternalPointer(vm);
+        VM_GetIternalPointer<Cfg>(vm);
       } break;
       case Instruction_OPEN: {
-        VM_Open(vm);
+        VM_Open<Cfg>(vm);
       } break;
       case Instruction_CLOSE: {
-        VM_Close(vm);
+        VM_Close<Cfg>(vm);
       } break;
       case Instruction_LM: {
-        VM_LM(vm);
+        VM_LM<Cfg>(vm);
       } break;
       case Instruction_DCALL: {
-        VM_DCALL(vm);
+        VM_DCALL<Cfg>(vm);
+      } break;
+      case Instruction_DCALLS: {
+        VM_DCALLS<Cfg>(vm);
+      } break;
+      case Instruction_DCALLB: {
+        VM_DCALLB<Cfg>(vm);
+      } break;
+      case Instruction_DCALLBS: {
+        VM_DCALLBS<Cfg>(vm);
+      } break;
+      case Instruction_HCALL: {
+        VM_HCALL<Cfg>(vm);
+      } break;
+      case Instruction_PREAD: {
+        VM_PRead<Cfg>(vm);
+      } break;
+      case Instruction_PWRITE: {
+        VM_PWrite<Cfg>(vm);
+      } break;
+      case Instruction_SYNC: {
+        VM_Sync<Cfg>(vm);
       } break;
       case Instruction_EXIT: {
         vm.status = VM_Status_Ret;
@@ -1412,413 +2737,4787 @@ namespace Virtual {
     }
   }
 
-  int Run(VirtualMachine& vm, Code& code) {
-    u64 code_size = __VM_ALIGN(code.capacity, VM_CODE_ALIGN);
-    MewAssert(vm.capacity > code_size);
-    byte* begin = vm.memory;
-    byte* end   = begin+vm.capacity;
-    byte* alloc_space = begin+code_size+1;
-    vm.flags.use_debug = code.cme.flags.has_debug;
-    vm.src = &code;
-    vm.heap = alloc_space;
-    vm.begin = begin;
-    vm.end = end;
-    vm.status = VM_Status_Execute;
-    if (code.data != nullptr) {
-      memcpy(vm.heap, code.data, code.data_size*sizeof(*code.data));
-    }
-    if (code.adata != nullptr) {
-      memset(vm.heap+code.data_size, 0, vm.capacity-(code.capacity+code.data_size));
-    }
+#pragma region ENGINE
+  enum VM_Engine: byte {
+    VM_Engine_Switch = 0,  // RunLine per instruction
+    VM_Engine_Threaded,    // direct-threaded loop (computed goto)
+    VM_Engine_Decoded,     // pre-decoded instruction stream (Code_Decode)
+    VM_Engine_Profile,     // RunLine + opcode pair/triple counters
+    VM_Engine_Jit,         // decoded stream + x86-64 compiled hot blocks
+  };
+
+#if defined(__GNUC__) || defined(__clang__)
+  #define VM_HAS_COMPUTED_GOTO 1
+#endif
+
+  template<typename Cfg = VM_Checked>
+  void RunSwitch(VirtualMachine& vm) {
     while (vm.begin < vm.end && vm.status != VM_Status_Ret) {
-      ++vm.process_cycle; RunLine(vm);
-    }
-    vm.status = VM_Status_Panding;
-    if (vm.stack.empty()) {
-      return 0;
+      ++vm.process_cycle; RunLine<Cfg>(vm);
     }
-    return vm.stack.top();
   }
 
-  int Execute(VirtualMachine& vm, Code& code) {
-    Alloc(vm, code);
-    LoadMemory(vm, code);
-    return Run(vm, code);
-  }
-  
-  int Execute(Code& code) {
-    VirtualMachine vm;
-    Alloc(vm, code);
-    LoadMemory(vm, code);
-    return Run(vm, code);
-  }
+  /*
+    same semantics as RunSwitch, but every handler ends with its own
+    indirect jump to the next one. the heap lock and code end checks
+    are folded into one compare against `limit`
+  */
+  template<typename Cfg = VM_Checked>
+  void RunThreaded(VirtualMachine& vm) {
+#ifndef VM_HAS_COMPUTED_GOTO
+    RunSwitch<Cfg>(vm);
+#else
+    void* dispatch[256];
+    for (int i = 0; i < 256; ++i) { dispatch[i] = &&op_unsupported; }
+    dispatch[Instruction_NONE]   = &&op_none;
+    dispatch[Instruction_PUSH]   = &&op_push;
+    dispatch[Instruction_POP]    = &&op_pop;
+    dispatch[Instruction_RPOP]   = &&op_rpop;
+    dispatch[Instruction_ADD]    = &&op_add;
+    dispatch[Instruction_SUB]    = &&op_sub;
+    dispatch[Instruction_MUL]    = &&op_mul;
+    dispatch[Instruction_DIV]    = &&op_div;
+    dispatch[Instruction_INC]    = &&op_inc;
+    dispatch[Instruction_DEC]    = &&op_dec;
+    dispatch[Instruction_XOR]    = &&op_xor;
+    dispatch[Instruction_OR]     = &&op_or;
+    dispatch[Instruction_NOT]    = &&op_not;
+    dispatch[Instruction_AND]    = &&op_and;
+    dispatch[Instruction_LS]     = &&op_ls;
+    dispatch[Instruction_RS]     = &&op_rs;
+    dispatch[Instruction_JMP]    = &&op_jmp;
+    dispatch[Instruction_RET]    = &&op_ret;
+    dispatch[Instruction_EXIT]   = &&op_exit;
+    dispatch[Instruction_TEST]   = &&op_test;
+    dispatch[Instruction_JE]     = &&op_je;
+    dispatch[Instruction_JEL]    = &&op_jel;
+    dispatch[Instruction_JEM]    = &&op_jem;
+    dispatch[Instruction_JNE]    = &&op_jne;
+    dispatch[Instruction_JL]     = &&op_jl;
+    dispatch[Instruction_JM]     = &&op_jm;
+    dispatch[Instruction_MOV]    = &&op_mov;
+    dispatch[Instruction_MOVRDI] = &&op_movrdi;
+    dispatch[Instruction_CALL]   = &&op_call;
+    /* cold opcodes go through RunLine */
+    dispatch[Instruction_SWAP]   = &&op_cold;
+    dispatch[Instruction_MSET]   = &&op_cold;
+    dispatch[Instruction_PUTC]   = &&op_cold;
+    dispatch[Instruction_PUTI]   = &&op_cold;
+    dispatch[Instruction_PUTS]   = &&op_cold;
+    dispatch[Instruction_GETCH]  = &&op_cold;
+    dispatch[Instruction_WINE]   = &&op_cold;
+    dispatch[Instruction_WRITE]  = &&op_cold;
+    dispatch[Instruction_READ]   = &&op_cold;
+    dispatch[Instruction_OPEN]   = &&op_cold;
+    dispatch[Instruction_CLOSE]  = &&op_cold;
+    dispatch[Instruction_LM]     = &&op_cold;
+    dispatch[Instruction_DCALL]  = &&op_cold;
+    dispatch[Instruction_DCALLS] = &&op_cold;
+    dispatch[Instruction_DCALLB] = &&op_cold;
+    dispatch[Instruction_DCALLBS] = &&op_cold;
+    dispatch[Instruction_HCALL]  = &&op_cold;
+    dispatch[Instruction_PREAD]  = &&op_cold;
+    dispatch[Instruction_PWRITE] = &&op_cold;
+    dispatch[Instruction_SYNC]   = &&op_cold;
+    dispatch[Intruction_GetVM]   = &&op_cold;
+    dispatch[Intruction_GetIPTR] = &&op_cold;
+
+    byte* limit = Cfg::heap_lock && vm.heap < vm.end ? vm.heap : vm.end;
+
+    #define VM_DISPATCH() \
+      if (vm.begin >= limit) goto bound; \
+      ++vm.process_cycle; \
+      VM_DebugNote<Cfg>(vm, *vm.begin); \
+      goto *dispatch[*vm.begin++];
+    #define VM_OP(_label, _call) _label: _call; VM_DISPATCH()
+
+    if (vm.status == VM_Status_Ret) { return; }
+    VM_DISPATCH();
+
+    VM_OP(op_none,   (void)0);
+    VM_OP(op_push,   VM_Push<Cfg>(vm));
+    VM_OP(op_pop,    VM_Pop(vm));
+    VM_OP(op_rpop,   VM_RPop(vm));
+    VM_OP(op_add,    VM_Add<Cfg>(vm));
+    VM_OP(op_sub,    VM_Sub<Cfg>(vm));
+    VM_OP(op_mul,    VM_Mul<Cfg>(vm));
+    VM_OP(op_div,    VM_Div<Cfg>(vm));
+    VM_OP(op_inc,    VM_Inc<Cfg>(vm));
+    VM_OP(op_dec,    VM_Dec<Cfg>(vm));
+    VM_OP(op_xor,    VM_Xor<Cfg>(vm));
+    VM_OP(op_or,     VM_Or<Cfg>(vm));
+    VM_OP(op_not,    VM_Not<Cfg>(vm));
+    VM_OP(op_and,    VM_And<Cfg>(vm));
+    VM_OP(op_ls,     VM_LS<Cfg>(vm));
+    VM_OP(op_rs,     VM_RS<Cfg>(vm));
+    VM_OP(op_jmp,    VM_Jmp<Cfg>(vm));
+    VM_OP(op_test,   VM_Test(vm));
+    VM_OP(op_je,     VM_JE<Cfg>(vm));
+    VM_OP(op_jel,    VM_JEL<Cfg>(vm));
+    VM_OP(op_jem,    VM_JEM<Cfg>(vm));
+    VM_OP(op_jne,    VM_JNE<Cfg>(vm));
+    VM_OP(op_jl,     VM_JL<Cfg>(vm));
+    VM_OP(op_jm,     VM_JM<Cfg>(vm));
+    VM_OP(op_mov,    VM_Mov<Cfg>(vm));
+    VM_OP(op_movrdi, VM_MovRDI(vm));
+    VM_OP(op_call,   VM_Call<Cfg>(vm));
+
+  op_ret:
+    VM_Ret(vm);
+    if (vm.status == VM_Status_Ret) { return; }
+    VM_DISPATCH();
+
+  op_cold:
+    --vm.begin; /* RunLine reads head byte itself */
+    RunLine<Cfg>(vm);
+    if (vm.status == VM_Status_Ret) { return; }
+    VM_DISPATCH();
+
+  op_exit:
+    vm.status = VM_Status_Ret;
+    return;
+
+  op_unsupported:
+    MewUserAssert(false, "unsupported instruction");
+    return;
+
+  bound:
+    if (vm.begin < vm.end) {
+      /* inside memory but outside code while heap is locked */
+      ++vm.begin;
+      MewAssert(vm.begin < vm.heap);
+    }
+    return;
 
-  int Execute(const char* path) {
-    Code* code = Code_LoadFromFile(path);
-    return Execute(*code);
+    #undef VM_OP
+    #undef VM_DISPATCH
+#endif
   }
+#pragma endregion ENGINE
+
+#pragma region DECODER
+  /*
+    fixed-width form of Code::playground, built once per Code.
+    operands are resolved at decode time: registers become offsets
+    into VirtualMachine, immediates are unpacked and jump targets
+    become indices in `ops`
+  */
+  struct VM_DecodedOp;
+  typedef u32(*VM_DecodedHandler)(VirtualMachine&, VM_DecodedOp&, u32);
+
+  constexpr const u32 VMD_EXIT = ~0U; // leave decoded loop, vm.begin is valid
+  constexpr const u64 VMD_NOTARGET = ~0ULL;
+
+  struct VM_DecodedArg {
+    byte type = 0;      // Instruction_REG | NUM | ST | MEM
+    VM_REG_INFO ri = {VM_RegType::None, 0};
+    u32 reg = 0;        // register offset inside VirtualMachine
+    u32 size = 0;
+    s32 num = 0;        // NUM value
+    u64 offset = 0;     // ST offset | MEM heap offset
+  };
 
-  class VM_Async {
-  public:
-    struct ExecuteInfo {
-      enum struct Status {
-        Execute, Errored, Done
-      } status;
-      int result;
-    }; 
-  private:
-    mew::stack<VirtualMachine*> m_vms;
-    mew::stack<ExecuteInfo> m_execs;
-  public:
-    VM_Async() { }
+  struct VM_DecodedOp {
+    VM_DecodedHandler fn;
+    VM_DecodedHandler base; // handler before superinstruction fusing
+    byte code;
+    byte type_x, type_y; // TEST operand types
+    u32 pc;              // byte offset in playground
+    u32 next;            // byte offset of the next instruction
+    u32 target;          // index of jump/call target
+    VM_MathKernel kernel; // resolved from (op, a kind, b kind)
+    VM_DecodedArg a, b;
+  };
 
-    void hardStop() {
-      for (int i = 0; i < m_vms.size(); ++i) {
-        delete m_vms[i];
-      }
-      m_vms.clear();
-      m_execs.clear();
-    }
-    
-    int Append(Code& code) {
-      VirtualMachine* vm = new VirtualMachine();
-      Alloc(*vm, code);
-      LoadMemory(*vm, code);
-      u64 code_size = __VM_ALIGN(code.capacity, VM_CODE_ALIGN);
-      MewAssert(vm->capacity > code_size);
-      vm->flags.use_debug = code.cme.flags.has_debug;
-      vm->src = &code;
-      vm->heap = vm->begin+code_size+1;
-      vm->begin = vm->memory;
-      vm->end = vm->begin+vm->capacity;
-      vm->status = VM_Status_Execute;
-      if (code.data != nullptr) {
-        memcpy(vm->heap, code.data, code.data_size*sizeof(*code.data));
-      }
-      m_execs.push((ExecuteInfo){ExecuteInfo::Status::Execute, -1});
-      return m_vms.push(vm);
-    }
+  struct VM_DecodedCode {
+    bool ok = false;
+    u32 count = 0;
+    std::atomic<VM_DecodedOp*> ops{nullptr}; // swapped whole by Code_Superinstructions
+    u32* index_of = nullptr; // playground byte offset -> op index | VMD_EXIT
+    byte* mapping = nullptr; // ops and index_of live here when loaded from the code cache
+    u64 mapping_size = 0;
+    bool fused = false;      // Code_Superinstructions already applied
+    VM_DecodedOp* unfused = nullptr; // ops before fusing, running vms may still use them
+  };
 
-    bool is_ends(int id) {
-      return m_vms[id]->status == VM_Status_Ret;
+  u32 VMD_RegOffset(VM_RegType rt, byte idx, u32* size) {
+    if (idx >= 5) { return VMD_EXIT; }
+    switch (rt) {
+      case VM_RegType::R:   *size = 4; return offsetof(VirtualMachine, _r)  + idx*4;
+      case VM_RegType::FX:  *size = 4; return offsetof(VirtualMachine, _fx) + idx*4;
+      case VM_RegType::RX:  *size = 8; return offsetof(VirtualMachine, _rx) + idx*8;
+      case VM_RegType::DX:  *size = 8; return offsetof(VirtualMachine, _dx) + idx*8;
+      case VM_RegType::RDI: *size = 8; return offsetof(VirtualMachine, rdi);
+      default: return VMD_EXIT;
     }
+  }
 
-    int get_status_code(int id) {
-      return m_execs[id].result;
-    }
-        
-    VirtualMachine* GetById(int id) {
-      return m_vms[id];
-    }
-
-    void ExecuteStep() {
-      for (int i = 0; i < m_vms.size(); ++i) {
-        m_execs[i].result = this->Run(*m_vms[i], *m_vms[i]->src);
-        if (m_vms[i]->status == VM_Status_Panding) {
-          m_execs[i].status = ExecuteInfo::Status::Done;
-        }
-        if (m_vms[i]->status == VM_Status_Error) {
-          m_execs[i].status = ExecuteInfo::Status::Errored;
-        }
+  /* returns operand length in bytes or 0 if it cant be decoded */
+  u64 VMD_DecodeArg(const byte* p, const byte* end, VM_DecodedArg& arg) {
+    if (p >= end) { return 0; }
+    arg.type = *p;
+    switch (arg.type) {
+      case Instruction_ST: {
+        if (p+1+sizeof(u32) > end) { return 0; }
+        u32 offset; memcpy(&offset, p+1, sizeof(offset));
+        arg.offset = offset;
+        arg.size = sizeof(u32);
+        return 1+sizeof(u32);
+      }
+      case Instruction_REG: {
+        if (p+3 > end) { return 0; }
+        arg.ri.type = (VM_RegType)p[1];
+        arg.ri.idx = p[2];
+        arg.reg = VMD_RegOffset(arg.ri.type, arg.ri.idx, &arg.size);
+        return arg.reg == VMD_EXIT ? 0 : 3;
+      }
+      case Instruction_NUM: {
+        if (p+1+sizeof(s32) > end) { return 0; }
+        memcpy(&arg.num, p+1, sizeof(s32));
+        arg.size = sizeof(s32);
+        return 1+sizeof(s32);
+      }
+      case Instruction_MEM: {
+        if (p+1+2*sizeof(u64) > end) { return 0; }
+        u64 size;
+        memcpy(&arg.offset, p+1, sizeof(u64));
+        memcpy(&size, p+1+sizeof(u64), sizeof(u64));
+        arg.size = (u32)size;
+        return 1+2*sizeof(u64);
       }
+      default: return 0;
     }
-    
-    int Run(VirtualMachine& vm, Code& code) {
-      if (!(vm.begin < vm.end && vm.status != VM_Status_Ret)) {
-        vm.status = VM_Status_Panding;
-        return vm.stack.top();
+  }
+
+  VM_ARG VMD_GetArg(VirtualMachine& vm, VM_DecodedArg& d) {
+    switch (d.type) {
+      case Instruction_REG: {
+        VM_ARG arg;
+        arg.data = (byte*)&vm + d.reg;
+        arg.reg = d.ri;
+        arg.type = d.type;
+        arg.size = d.size;
+        return arg;
       }
-      ++vm.process_cycle;
-      try {
-        RunLine(vm);
-      } catch(std::exception& e) {
-        u64 cursor = vm.capacity - (u64)(vm.end-vm.begin);
-        for (int i = 0; i < code.cme.debug.size(); ++i) {
-          if (code.cme.debug[i].cursor >= cursor) {
-            fprintf(vm.std_out, "\n[DEBUG_ERROR] at (%i) in (%s)\n", code.cme.debug[i].line, vm.debug.last_fn);
-            vm.status = VM_Status_Error;
-            break;
-          }
-        }
+      case Instruction_NUM: {
+        VM_ARG arg;
+        arg.num = d.num;
+        arg.type = d.type;
+        arg.size = d.size;
+        return arg;
       }
-      return -1;
+      case Instruction_ST: return VM_ArgFromStack(vm, (u32)d.offset);
+      case Instruction_MEM: return VM_ArgFromMem(vm, d.offset, d.size);
+      default: MewUserAssert(false, "undefined arg type");
     }
+  }
+
+  u32 VMD_IndexOf(VirtualMachine& vm, VM_DecodedCode& dc, byte* pos) {
+    if (pos < vm.memory || pos >= vm.memory+vm.src->capacity) { return VMD_EXIT; }
+    return dc.index_of[pos - vm.memory];
+  }
+
+  /*
+    decoded handlers are shared by every config, so the RunLine
+    instantiation of the running loop is picked per thread
+  */
+  typedef void(*VM_LineFn)(VirtualMachine&);
+  static thread_local VM_LineFn vmd_line = &RunLine<VM_Checked>;
+
+  struct VMD_LineScope {
+    VM_LineFn saved;
+    VMD_LineScope(VM_LineFn fn): saved(vmd_line) { vmd_line = fn; }
+    ~VMD_LineScope() { vmd_line = saved; }
   };
 
-  class CodeBuilder {
-  public:
-    struct untyped_pair {
-      byte* data;
-      byte size;
-    };
-    static const u64 alloc_size = 8;
-  private:
-    u64 capacity, _code_size, _data_size = 0;
-    mew::stack<u64> _adatas;
-    byte* code = nullptr, *data = nullptr;
-    u64 stack_head = 0;
-  public:
-    CodeBuilder(): capacity(alloc_size), _code_size(0), 
-      code((byte*)realloc(NULL, alloc_size)), _data_size(0) { memset(code, 0, alloc_size); }
+  /* any opcode without a decoded handler runs through RunLine */
+  u32 VMD_Fallback(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    vm.begin = vm.memory + op.pc;
+    vmd_line(vm);
+    if (vm.status == VM_Status_Ret) { return VMD_EXIT; }
+    return VMD_IndexOf(vm, *vm.src->decoded, vm.begin);
+  }
 
-    CodeBuilder(Code* code)
-      : capacity(code->capacity), 
-        _code_size(code->capacity), 
-        _data_size(code->data_size), 
-        code(code->playground),
-        data(code->data)
-      { }
-    
-    byte* GetData() const noexcept {
-      return data;
-    }
+  u32 VMD_None(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    return ip+1;
+  }
 
-    inline u64 code_size() const noexcept {
-      return _code_size;
-    }
+  u32 VMD_PushNum(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    vm.stack.push((u32)op.a.num);
+    return ip+1;
+  }
 
-    inline u64 cursor() const noexcept {
-      return _code_size;
-    }
+  u32 VMD_Pop(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    MewAssert(!vm.stack.empty());
+    vm.stack.drop();
+    return ip+1;
+  }
 
-    inline u64 data_size() const noexcept {
-      return _data_size;
-    }
+  u32 VMD_RPop(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    MewAssert(vm.stack.has(vm.rdi));
+    byte* reg = (byte*)&vm + op.a.reg;
+    memcpy(reg, &vm.stack.peek(vm.rdi), op.a.size);
+    vm.stack.drop();
+    return ip+1;
+  }
 
-    template<typename K>
-    u64 push(K& value) {
-      *this
-        << Instruction_PUSH 
-        << Instruction_NUM
-        << Instruction_STRUCT
-        << sizeof(value);
-      insert(value);
-      return cursor();
-    }
+  u32 VMD_Math2(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    auto a = VMD_GetArg(vm, op.a);
+    auto b = VMD_GetArg(vm, op.b);
+    op.kernel(a.ptr(), b.ptr());
+    return ip+1;
+  }
 
-    inline u64 putAtCode(u64 idx, byte* val, u64 _size) {
-      MewUserAssert(idx+_size <= _code_size, "out of code");
-      memcpy(code, val, _size);
-      return cursor();
-    }
+  u32 VMD_Math1(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    auto a = VMD_GetArg(vm, op.a);
+    op.kernel(a.ptr(), nullptr);
+    return ip+1;
+  }
 
-    inline u64 putAtCode(u64 idx, u64 val) {
-      MewUserAssert(idx+sizeof(val) <= _code_size, "out of code");
-      memcpy(code, &val, sizeof(val));
-      return cursor();
-    }
-    
-    inline u64 insertAtCode(u64 idx, byte* val, u64 size) {
-      u8* buffer = new u8[size+_code_size];
-      memcpy(buffer, code, idx);
-      memcpy(buffer+idx, val, size);
-      memcpy(buffer+idx+size, code+idx, _code_size - idx);
-      delete code;
-      code = buffer;
-      _code_size += size;
-      return cursor();
-    }
-    
-    inline u64 putAtData(u64 idx, byte* val, u64 _size) {
-      MewUserAssert(idx+_size <= _data_size, "out of data");
-      memcpy(data, val, _size);
-      return _data_size;
-    }
+  u32 VMD_Test(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    VM_Test(vm, op.type_x, op.type_y);
+    return ip+1;
+  }
 
-    inline u64 putAtData(u64 idx, u64 val) {
-      MewUserAssert(idx+sizeof(val) <= _data_size, "out of data");
-      memcpy(data, &val, sizeof(val));
-      return cursor();
+  u32 VMD_Jmp(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    return op.target;
+  }
+
+  u32 VMD_JE(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    return vm.test.equal ? op.target : ip+1;
+  }
+  u32 VMD_JEL(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    return (vm.test.equal || vm.test.less) ? op.target : ip+1;
+  }
+  u32 VMD_JEM(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    return (vm.test.equal || vm.test.more) ? op.target : ip+1;
+  }
+  u32 VMD_JL(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    return vm.test.less ? op.target : ip+1;
+  }
+  u32 VMD_JM(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    return vm.test.more ? op.target : ip+1;
+  }
+  u32 VMD_JNE(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    return !vm.test.equal ? op.target : ip+1;
+  }
+
+  u32 VMD_Call(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    vm.begin_stack.push(vm.memory + op.next);
+    return op.target;
+  }
+
+  u32 VMD_Ret(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    if (vm.begin_stack.empty()) {
+      vm.status = VM_Status_Ret; return VMD_EXIT;
     }
+    vm.begin = vm.begin_stack.top();
+    vm.begin_stack.pop();
+    return VMD_IndexOf(vm, *vm.src->decoded, vm.begin);
+  }
 
-    inline u64 putRegister(VM_REG_INFO reg) {
-      *this
-        << Instruction_REG
-        << (byte)reg.type
-        << (byte)reg.idx;
-      return cursor();
+  u32 VMD_Exit(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    vm.status = VM_Status_Ret;
+    return VMD_EXIT;
+  }
+
+  u32 VMD_MovRDI(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    vm.rdi = op.a.num/4;
+    return ip+1;
+  }
+
+  VM_ArgKind VMD_ArgKind(VM_DecodedArg& arg) {
+    switch (arg.type) {
+      case Instruction_ST:
+      case Instruction_NUM: return VM_ArgKind_I32;
+      case Instruction_REG: return VM_RegKind(arg.ri.type);
+      default: return VM_ArgKind_None;
     }
+  }
 
-    inline u64 putNumber(s32 num) {
-      *this
-        << Instruction_NUM
-        << num;
-      return cursor();
+  void VMD_SetMath(VM_DecodedOp& op, VM_MathOp math) {
+    if (math >= VM_MathOp_Inc) {
+      op.fn = VMD_Math1;
+      op.kernel = VM_GetMathKernel(math, VMD_ArgKind(op.a));
+    } else {
+      op.fn = VMD_Math2;
+      VM_ArgKind ka = VMD_ArgKind(op.a);
+      op.kernel = VM_GetMathKernel(math, ka, VM_SourceKind(ka, op.b.type, VMD_ArgKind(op.b)));
     }
+  }
 
-    inline u64 putMem(u64 offset, u64 size) {
-      *this
-        << Instruction_MEM
-        << offset
-        << size;
-      return cursor();
+  /* decodes one instruction at `p`, returns its length or 0 on failure */
+  u64 VMD_DecodeOne(const byte* code, const byte* p, const byte* end, VM_DecodedOp& op, u64& target) {
+    op = VM_DecodedOp();
+    op.fn = VMD_Fallback;
+    op.code = *p;
+    op.pc = (u32)(p - code);
+    const byte* q = p+1;
+    #define VMD_NEED(_size) if (q+(_size) > end) { return 0; }
+    #define VMD_ARG(_arg) { u64 __l = VMD_DecodeArg(q, end, _arg); if (!__l) { return 0; } q += __l; }
+    switch (op.code) {
+      case Instruction_NONE: op.fn = VMD_None; break;
+      case Instruction_PUSH: {
+        VMD_NEED(1);
+        byte type = *q++;
+        switch (type) {
+          case 0:
+          case Instruction_FLT:
+          case Instruction_NUM: 
+            VMD_NEED(sizeof(u32)); memcpy(&op.a.num, q, sizeof(u32)); q += sizeof(u32);
+            op.fn = VMD_PushNum; break;
+          case Instruction_BYTE: VMD_NEED(1); q += 1; break;
+          case Instruction_MEM:  VMD_NEED(sizeof(u32)); q += sizeof(u32); break;
+          case Instruction_REG:  VMD_NEED(2); q += 2; break;
+          case Instruction_STRUCT: VMD_ARG(op.a); break;
+          case Instruction_ST:   VMD_NEED(sizeof(int)); q += sizeof(int); VMD_ARG(op.a); break;
+          default: return 0;
+        }
+      } break;
+      case Instruction_POP: op.fn = VMD_Pop; break;
+      case Instruction_RPOP: {
+        VMD_NEED(2);
+        op.a.type = Instruction_REG;
+        op.a.ri.type = (VM_RegType)q[0];
+        op.a.ri.idx = q[1];
+        op.a.reg = VMD_RegOffset(op.a.ri.type, op.a.ri.idx, &op.a.size);
+        if (op.a.reg == VMD_EXIT) { return 0; }
+        q += 2;
+        op.fn = VMD_RPop;
+      } break;
+      case Instruction_ADD: VMD_ARG(op.a); VMD_ARG(op.b); VMD_SetMath(op, VM_MathOp_Add); break;
+      case Instruction_SUB: VMD_ARG(op.a); VMD_ARG(op.b); VMD_SetMath(op, VM_MathOp_Sub); break;
+      case Instruction_MUL: VMD_ARG(op.a); VMD_ARG(op.b); VMD_SetMath(op, VM_MathOp_Mul); break;
+      case Instruction_DIV: VMD_ARG(op.a); VMD_ARG(op.b); VMD_SetMath(op, VM_MathOp_Div); break;
+      case Instruction_XOR: VMD_ARG(op.a); VMD_ARG(op.b); VMD_SetMath(op, VM_MathOp_Xor); break;
+      case Instruction_OR:  VMD_ARG(op.a); VMD_ARG(op.b); VMD_SetMath(op, VM_MathOp_Or); break;
+      case Instruction_AND: VMD_ARG(op.a); VMD_ARG(op.b); VMD_SetMath(op, VM_MathOp_And); break;
+      case Instruction_LS:  VMD_ARG(op.a); VMD_ARG(op.b); VMD_SetMath(op, VM_MathOp_Ls); break;
+      case Instruction_RS:  VMD_ARG(op.a); VMD_ARG(op.b); VMD_SetMath(op, VM_MathOp_Rs); break;
+      case Instruction_MOV: VMD_ARG(op.a); VMD_ARG(op.b); VMD_SetMath(op, VM_MathOp_Mov); break;
+      case Instruction_INC: VMD_ARG(op.a); VMD_SetMath(op, VM_MathOp_Inc); break;
+      case Instruction_DEC: VMD_ARG(op.a); VMD_SetMath(op, VM_MathOp_Dec); break;
+      case Instruction_NOT: VMD_ARG(op.a); VMD_SetMath(op, VM_MathOp_Not); break;
+      case Instruction_SWAP:
+      case Instruction_LM: VMD_ARG(op.a); VMD_ARG(op.b); break;
+      case Instruction_JMP:
+      case Instruction_CALL: {
+        VMD_NEED(sizeof(u64));
+        memcpy(&target, q, sizeof(u64)); q += sizeof(u64);
+        op.fn = op.code == Instruction_JMP ? VMD_Jmp : VMD_Call;
+      } break;
+      case Instruction_JE:
+      case Instruction_JEL:
+      case Instruction_JEM:
+      case Instruction_JNE:
+      case Instruction_JL:
+      case Instruction_JM: {
+        VMD_NEED(sizeof(int));
+        int offset; memcpy(&offset, q, sizeof(int)); q += sizeof(int);
+        target = (u32)offset;
+        switch (op.code) {
+          case Instruction_JE:  op.fn = VMD_JE; break;
+          case Instruction_JEL: op.fn = VMD_JEL; break;
+          case Instruction_JEM: op.fn = VMD_JEM; break;
+          case Instruction_JNE: op.fn = VMD_JNE; break;
+          case Instruction_JL:  op.fn = VMD_JL; break;
+          case Instruction_JM:  op.fn = VMD_JM; break;
+        }
+      } break;
+      case Instruction_RET:  op.fn = VMD_Ret; break;
+      case Instruction_EXIT: op.fn = VMD_Exit; break;
+      case Instruction_TEST: {
+        VMD_NEED(2);
+        op.type_x = q[0]; op.type_y = q[1]; q += 2;
+        op.fn = VMD_Test;
+      } break;
+      case Instruction_MOVRDI: {
+        VMD_NEED(sizeof(int));
+        memcpy(&op.a.num, q, sizeof(int)); q += sizeof(int);
+        op.fn = VMD_MovRDI;
+      } break;
+      case Instruction_MSET:  VMD_NEED(3*sizeof(u64)); q += 3*sizeof(u64); break;
+      case Instruction_PUTC:  VMD_NEED(sizeof(wchar_t)); q += sizeof(wchar_t); break;
+      case Instruction_PUTS:
+      case Instruction_WINE:
+      case Instruction_OPEN:  VMD_NEED(sizeof(u64)); q += sizeof(u64); break;
+      case Instruction_PUTI:
+      case Instruction_GETCH:
+      case Instruction_CLOSE: VMD_ARG(op.a); break;
+      case Instruction_SYNC:  VMD_NEED(sizeof(u32)); q += sizeof(u32); break;
+      case Instruction_WRITE:
+      case Instruction_READ:  VMD_NEED(sizeof(u32)); q += sizeof(u32); VMD_ARG(op.a); break;
+      case Instruction_PREAD:
+      case Instruction_PWRITE: VMD_NEED(sizeof(u32)); q += sizeof(u32); VMD_ARG(op.a); VMD_ARG(op.b); break;
+      case Intruction_GetVM:  break;
+      case Intruction_GetIPTR: VMD_ARG(op.a); VMD_ARG(op.b); { VM_DecodedArg c; VMD_ARG(c); } break;
+      case Instruction_DCALL: VMD_NEED(2*sizeof(u64)); q += 2*sizeof(u64); break;
+      case Instruction_DCALLB: VMD_NEED(4*sizeof(u64)); q += 4*sizeof(u64); break;
+      /* DCALLS/DCALLBS only exist in vm memory after Code_PatchNatives, never in a playground */
+      case Instruction_DCALLS:
+      case Instruction_DCALLBS: return 0;
+      case Instruction_HCALL: VMD_NEED(sizeof(u32)+1); q += sizeof(u32)+1; break;
+      default: return 0;
     }
+    #undef VMD_ARG
+    #undef VMD_NEED
+    op.next = (u32)(q - code);
+    op.base = op.fn;
+    return (u64)(q - p);
+  }
 
-    inline u64 putByte(u8 num) {
-      *this
-        << Instruction_BYTE
-        << num;
-      return cursor();
+  void Code_FreeDecoded(Code& code) {
+    if (code.decoded == nullptr) { return; }
+    if (code.decoded->mapping != nullptr) {
+#ifdef _WIN32
+      delete[] code.decoded->mapping;
+#else
+      munmap(code.decoded->mapping, code.decoded->mapping_size);
+#endif
+      if (code.decoded->unfused != nullptr) { delete[] code.decoded->ops; }
+    } else {
+      delete[] code.decoded->ops;
+      delete[] code.decoded->unfused;
+      delete[] code.decoded->index_of;
     }
+    delete code.decoded;
+    code.decoded = nullptr;
+  }
 
-    inline u64 putRdiOffset(u64 offset) {
-      *this
-        << Instruction_ST
-        << offset;
-      return cursor();
+  /* caller holds code.lazy */
+  VM_DecodedCode& Code_DecodeLocked(Code& code) {
+    if (code.decoded != nullptr) { return *code.decoded; }
+    VM_DecodedCode* dc = new VM_DecodedCode();
+    code.decoded = dc;
+    const byte* begin = (const byte*)code.playground;
+    const byte* end = begin + code.capacity;
+    dc->index_of = new u32[code.capacity+1];
+    for (u64 i = 0; i <= code.capacity; ++i) { dc->index_of[i] = VMD_EXIT; }
+    std::vector<VM_DecodedOp> ops;
+    std::vector<u64> targets;
+    const byte* p = begin;
+    while (p < end) {
+      VM_DecodedOp op;
+      u64 target = VMD_NOTARGET;
+      u64 length = VMD_DecodeOne(begin, p, end, op, target);
+      if (length == 0) { return *dc; }
+      dc->index_of[p - begin] = (u32)ops.size();
+      ops.push_back(op);
+      targets.push_back(target);
+      p += length;
     }
-    
-    void Upsize(u64 _size = alloc_size) {
-      byte* __temp_p = (byte*)realloc(code, capacity+_size);
-      code = __temp_p;
-      capacity += _size;
+    /* sized by instruction count, not by code bytes */
+    dc->count = (u32)ops.size();
+    dc->ops = new VM_DecodedOp[dc->count+1];
+    std::copy(ops.begin(), ops.end(), dc->ops.load(std::memory_order_relaxed));
+    /* end of code maps past the last op */
+    dc->index_of[code.capacity] = dc->count;
+    for (u32 i = 0; i < dc->count; ++i) {
+      VM_DecodedOp& op = dc->ops[i];
+      if (targets[i] == VMD_NOTARGET) { continue; }
+      if (targets[i] > code.capacity || dc->index_of[targets[i]] == VMD_EXIT) { return *dc; }
+      op.target = dc->index_of[targets[i]];
     }
-    
-    void UpsizeIfNeeds(u64 needs_size) {
-      if (_code_size+needs_size > capacity) {
-        Upsize(needs_size);
+    dc->ok = true;
+    return *dc;
+  }
+
+  /*
+    builds code.decoded once, vms sharing the code wait for the first; if
+    any instruction or static jump target cant be decoded the result is
+    marked as not ok and Run falls back to RunSwitch
+  */
+  VM_DecodedCode& Code_Decode(Code& code) {
+    std::lock_guard<std::mutex> guard(code.lazy.lock);
+    return Code_DecodeLocked(code);
+  }
+
+  template<typename Cfg = VM_Checked>
+  void RunDecoded(VirtualMachine& vm, VM_DecodedCode& dc) {
+    if (!dc.ok) { RunSwitch<Cfg>(vm); return; }
+    VMD_LineScope line(&RunLine<Cfg>);
+    u32 ip = VMD_IndexOf(vm, dc, vm.begin);
+    VM_DecodedOp* ops = dc.ops.load(std::memory_order_acquire);
+    while (ip < dc.count) {
+      ++vm.process_cycle;
+      VM_DecodedOp& op = ops[ip];
+      vm.begin = vm.memory + op.pc; // error reports and RunUntil see the op
+      if constexpr (Cfg::debug) {
+        /* unfused, so every instruction is noted */
+        VM_DebugNote<Cfg>(vm, op.code);
+        ip = op.base(vm, op, ip);
+      } else {
+        ip = op.fn(vm, op, ip);
       }
     }
-        
-    void AddData(byte* row, u64 size) {
-      u64 __new_size = _data_size+size;
-      data = (byte*)realloc(data, __new_size);
-      memcpy(data+_data_size, row, size);
-      _data_size = __new_size;
+    if (ip != VMD_EXIT) {
+      vm.begin = vm.memory + vm.src->capacity;
     }
+    /* finishes anything outside of decoded code */
+    RunSwitch<Cfg>(vm);
+  }
+#pragma endregion DECODER
+
+#pragma region BINDING
+  /*
+    native libraries linked into the host instead of shipped as a shared
+    object. a cme.natives path registered here binds against this table,
+    its handle is the entry itself and is never closed. entries are never
+    erased, so a handle stays valid while other loaders register more
+  */
+  struct VM_InProcessLibrary {
+    std::unordered_map<std::string, vm_dll_pipe_fn> symbols;
+  };
 
-    CodeBuilder& operator+=(const char* text) {
-      AddData((byte*)text, strlen(text));
-      return *this;
+  struct VM_InProcessTable {
+    std::mutex lock;
+    std::unordered_map<std::string, VM_InProcessLibrary> libraries;
+  };
+
+  VM_InProcessTable& VM_InProcessLibraries() {
+    static VM_InProcessTable table;
+    return table;
+  }
+
+  /* a batched pipe is registered cast to vm_dll_pipe_fn, as dlsym returns it */
+  void VM_RegisterNative(const char* path, const char* name, vm_dll_pipe_fn fn) {
+    VM_InProcessTable& table = VM_InProcessLibraries();
+    std::lock_guard<std::mutex> guard(table.lock);
+    table.libraries[path].symbols[name] = fn;
+  }
+
+  /* caller holds VM_InProcessLibraries().lock */
+  VM_InProcessLibrary* VM_FindInProcess(handle_t handle) {
+    for (auto& entry: VM_InProcessLibraries().libraries) {
+      if ((handle_t)&entry.second == handle) { return &entry.second; }
     }
+    return nullptr;
+  }
 
-    friend CodeBuilder& operator<<(CodeBuilder& cb, byte i) {
-      cb.UpsizeIfNeeds(sizeof(i));
-      cb.code[cb._code_size++] = i;
-      return cb;
-    } 
+  handle_t VM_NativeOpen(const char* path) {
+    {
+      VM_InProcessTable& table = VM_InProcessLibraries();
+      std::lock_guard<std::mutex> guard(table.lock);
+      auto it = table.libraries.find(path);
+      if (it != table.libraries.end()) { return (handle_t)&it->second; }
+    }
+  #ifdef _WIN32
+    return LoadLibraryA(path);
+  #else
+    return dlopen(path, RTLD_LAZY);
+  #endif
+  }
 
-    friend CodeBuilder& operator<<(CodeBuilder& cb, u32 i) {
-      cb.UpsizeIfNeeds(sizeof(i));
-      memcpy(cb.code+cb._code_size, &i, sizeof(i));
-      cb._code_size += sizeof(i);
-      return cb;
+  vm_dll_pipe_fn VM_NativeSymbol(handle_t handle, const char* name) {
+    {
+      std::lock_guard<std::mutex> guard(VM_InProcessLibraries().lock);
+      if (VM_InProcessLibrary* lib = VM_FindInProcess(handle)) {
+        auto it = lib->symbols.find(name);
+        return it != lib->symbols.end() ? it->second : nullptr;
+      }
     }
+  #ifdef _WIN32
+    return (vm_dll_pipe_fn)GetProcAddress(handle, name);
+  #else
+    return (vm_dll_pipe_fn)dlsym(handle, name);
+  #endif
+  }
 
-    CodeBuilder& putU64(u64 i) {
-      UpsizeIfNeeds(sizeof(i));
-      memcpy(code+_code_size, &i, sizeof(i));
-      _code_size += sizeof(i);
-      return *this;
+  void VM_NativeClose(handle_t handle) {
+    {
+      std::lock_guard<std::mutex> guard(VM_InProcessLibraries().lock);
+      if (VM_FindInProcess(handle)) { return; }
     }
+  #ifdef _WIN32
+    FreeLibrary(handle);
+  #else
+    dlclose(handle);
+  #endif
+  }
 
-    friend CodeBuilder& operator<<(CodeBuilder& cb, Instruction i) {
-      cb.UpsizeIfNeeds(sizeof(i));
-      cb.code[cb._code_size++] = i;
-      return cb;
+  void Code_FreeNatives(Code& code) {
+    if (code.natives == nullptr) { return; }
+    for (handle_t handle: code.natives->handles) {
+      if (handle) { VM_NativeClose(handle); }
     }
-    friend CodeBuilder& operator<<(CodeBuilder& cb, int i) {
-      cb.UpsizeIfNeeds(sizeof(i));
-      memcpy(cb.code+cb._code_size, &i, sizeof(i));
-      cb._code_size += sizeof(i);
-      return cb;
+    delete code.natives;
+    code.natives = nullptr;
+  }
+
+  /*
+    link step for DCALL: walks the code once, opens every library of
+    cme.natives and resolves each (library, name) pair into a slot, so the
+    name lookup happens per load and not per call. sites with a name built
+    at runtime (outside the static data) stay plain DCALL, their library is
+    still opened here so both kinds index cme.natives.
+    DCALLB resolves the same way into batch_slots. code that doesnt decode
+    or calls a library it didnt declare is refused here, not at the call
+  */
+  bool Code_Bind(Code& code, const char** error) {
+    if (code.natives != nullptr) { return true; }
+    const byte* begin = (const byte*)code.playground;
+    const byte* end = begin + code.capacity;
+    VM_NativeTable* natives = new VM_NativeTable();
+    natives->handles.resize(code.cme.natives.size(), (handle_t)0);
+    std::unordered_map<std::string, u64> known;
+    const char* message = nullptr;
+    for (const byte* p = begin; p < end && message == nullptr;) {
+      VM_DecodedOp op;
+      u64 target = VMD_NOTARGET;
+      u64 length = VMD_DecodeOne(begin, p, end, op, target);
+      if (length == 0) { message = "undecodable instruction"; break; }
+      bool batch = op.code == Instruction_DCALLB;
+      if (op.code == Instruction_DCALL || batch) {
+        u64 lib_idx, offset;
+        memcpy(&lib_idx, p+1, sizeof(lib_idx));
+        memcpy(&offset, p+1+sizeof(lib_idx), sizeof(offset));
+        const char* name = (const char*)code.data + offset;
+        /* runtime named sites look their symbol up in the same handle */
+        handle_t* handle = lib_idx < code.cme.natives.size() ? &natives->handles[lib_idx] : nullptr;
+        if (handle && !*handle) { *handle = VM_NativeOpen(code.cme.natives.at(lib_idx)); }
+        if (handle == nullptr) {
+          message = "undefined native library";
+        } else if (!*handle) {
+          message = "cant open native library";
+        } else if (offset < code.data_size && memchr(name, 0, code.data_size-offset)) {
+          std::string key = std::to_string(lib_idx) + (batch ? "b:" : ":") + name;
+          auto it = known.find(key);
+          if (it != known.end()) {
+            natives->sites.push_back({(u64)(p - begin), it->second});
+          } else if (vm_dll_pipe_fn proc = VM_NativeSymbol(*handle, name)) {
+            u64 slot;
+            if (batch) {
+              slot = natives->batch_slots.size();
+              natives->batch_slots.push_back((vm_dll_batch_fn)proc);
+            } else {
+              slot = natives->slots.size();
+              natives->slots.push_back(proc);
+            }
+            known.emplace(key, slot);
+            natives->sites.push_back({(u64)(p - begin), slot});
+          } else {
+            message = "unresolved native symbol";
+          }
+        }
+      }
+      p += length;
     }
-    friend CodeBuilder& operator<<(CodeBuilder& cb, size_t i) {
-      cb.UpsizeIfNeeds(sizeof(i));
-      memcpy(cb.code+cb._code_size, &i, sizeof(i));
-      cb._code_size += sizeof(i);
-      return cb;
+    if (code.cme.natives.size() == 0 && message == nullptr) {
+      delete natives; // nothing declared and no call sites
+      return true;
     }
-    
-    template<typename K>
-    CodeBuilder& insert(K& value) {
-      UpsizeIfNeeds(sizeof(value));
-      memcpy(code+_code_size, &value, sizeof(value));
-      _code_size += sizeof(value);
-      return *this;
+    code.natives = natives;
+    if (message) {
+      Code_FreeNatives(code);
+      if (error) { *error = message; }
+      return false;
     }
+    return true;
+  }
+#pragma endregion BINDING
 
-    friend CodeBuilder& operator<<(CodeBuilder& cb, untyped_pair i) {
-      cb.UpsizeIfNeeds(i.size);
-      memcpy(cb.code+cb._code_size, &i.data, i.size);
-      cb._code_size += i.size;
-      return cb;
+#pragma region VERIFIER
+  bool VMV_Fail(const char** error, const char* message) {
+    if (error) { *error = message; }
+    return false;
+  }
+
+  bool VMV_HeapRange(u64 heap_size, u64 offset, u64 size = 0) {
+    return offset < heap_size && size <= heap_size - offset;
+  }
+
+  bool VMV_HeapArg(VM_DecodedArg& arg, u64 heap_size) {
+    return arg.type != Instruction_MEM || VMV_HeapRange(heap_size, arg.offset, arg.size);
+  }
+
+  /*
+    walks the whole playground once: every opcode must decode, every static
+    jump/call target must land on an instruction, constant heap offsets must
+    fit the heap Alloc will create and the code cant fall through into the heap.
+    verified code runs without per-instruction range checks and heap lock
+  */
+  bool Code_Verify(Code& code, const char** error) {
+    if (code.verified != VM_Verify_None) {
+      return code.verified == VM_Verify_Ok || VMV_Fail(error, "verification failed before");
+    }
+    code.verified = VM_Verify_Failed;
+    const byte* begin = (const byte*)code.playground;
+    const byte* end = begin + code.capacity;
+    u64 heap_size = Code_MemorySize(code) - Code_HeapOffset(code);
+    if (code.capacity == 0) { return VMV_Fail(error, "empty code"); }
+    bool* boundary = new bool[code.capacity+1];
+    u64* targets = new u64[code.capacity+1];
+    memset(boundary, 0, code.capacity+1);
+    u64 targets_count = 0;
+    bool ok = true;
+    const char* message = nullptr;
+    #define VMV_REQUIRE(_cond, _msg) if (!(_cond)) { ok = false; message = _msg; break; }
+    for (const byte* p = begin; p < end;) {
+      VM_DecodedOp op;
+      u64 target = VMD_NOTARGET;
+      VMV_REQUIRE(*p != Instruction_DCALLS && *p != Instruction_DCALLBS, "bound native call in code");
+      u64 length = VMD_DecodeOne(begin, p, end, op, target);
+      VMV_REQUIRE(length != 0, "undecodable instruction");
+      boundary[p - begin] = true;
+      if (target != VMD_NOTARGET) { targets[targets_count++] = target; }
+      VMV_REQUIRE(VMV_HeapArg(op.a, heap_size) && VMV_HeapArg(op.b, heap_size),
+        "constant heap operand out of heap");
+      /* anything but EXIT, RET and JMP may go on at op.next, a CALL returns there */
+      bool continues = op.code != Instruction_EXIT && op.code != Instruction_RET && op.code != Instruction_JMP;
+      VMV_REQUIRE(!continues || op.next < code.capacity, "code can fall through into heap");
+      const byte* q = p+1;
+      switch (op.code) {
+        case Instruction_PUSH: {
+          if (*q == Instruction_MEM) {
+            u32 number; memcpy(&number, q+1, sizeof(number));
+            VMV_REQUIRE(VMV_HeapRange(heap_size, number, sizeof(u32)), "push offset out of heap");
+          }
+        } break;
+        case Instruction_MSET: {
+          u64 x, y;
+          memcpy(&x, q, sizeof(x)); memcpy(&y, q+sizeof(x), sizeof(y));
+          VMV_REQUIRE(VMV_HeapRange(heap_size, x, y), "mset range out of heap");
+        } break;
+        case Intruction_GetIPTR: {
+          /* the decoded op only keeps two operands, the third is read here */
+          VM_DecodedArg skip, where;
+          q += VMD_DecodeArg(q, end, skip);
+          q += VMD_DecodeArg(q, end, skip);
+          VMD_DecodeArg(q, end, where);
+          VMV_REQUIRE(VMV_HeapArg(where, heap_size), "constant heap operand out of heap");
+        } break;
+        case Instruction_PUTS:
+        case Instruction_OPEN:
+        case Instruction_WINE: {
+          u64 offset; memcpy(&offset, q, sizeof(offset));
+          VMV_REQUIRE(VMV_HeapRange(heap_size, offset), "heap offset out of heap");
+        } break;
+        case Instruction_DCALL: {
+          u64 offset; memcpy(&offset, q+sizeof(u64), sizeof(offset));
+          VMV_REQUIRE(VMV_HeapRange(heap_size, offset), "dcall name out of heap");
+        } break;
+        case Instruction_DCALLB: {
+          u64 offset, batch, results;
+          memcpy(&offset, q+sizeof(u64), sizeof(offset));
+          memcpy(&batch, q+2*sizeof(u64), sizeof(batch));
+          memcpy(&results, q+3*sizeof(u64), sizeof(results));
+          VMV_REQUIRE(VMV_HeapRange(heap_size, offset), "dcall name out of heap");
+          VMV_REQUIRE(VMV_HeapRange(heap_size, batch, sizeof(VM_NativeBatch)), "dcall batch out of heap");
+          VMV_REQUIRE(VMV_HeapRange(heap_size, results), "dcall results out of heap");
+        } break;
+      }
+      if (!ok) { break; }
+      p += length;
+    }
+    for (u64 i = 0; ok && i < targets_count; ++i) {
+      VMV_REQUIRE(targets[i] < code.capacity && boundary[targets[i]], "jump target is not an instruction");
     }
+    #undef VMV_REQUIRE
+    delete[] boundary;
+    delete[] targets;
+    if (!ok) { return VMV_Fail(error, message); }
+    code.verified = VM_Verify_Ok;
+    return true;
+  }
+#pragma endregion VERIFIER
 
-    friend CodeBuilder& operator>>(CodeBuilder& cb, untyped_pair i) {
-      cb.UpsizeIfNeeds(i.size);
-      memmove(cb.code+i.size, cb.code, cb._code_size);
-      memcpy(cb.code, &i.data, i.size);
-      cb._code_size += i.size;
-      return cb;
+#pragma region SUPERINSTRUCTIONS
+  #ifndef VM_PROFILE_OPS
+    #define VM_PROFILE_OPS 64
+  #endif
+
+  /*
+    dynamic opcode pair/triple frequencies, filled by VM_Engine_Profile.
+    every vm profiling the code adds to them, so they are relaxed atomics
+  */
+  struct VM_Profile {
+    std::atomic<u64> pairs[VM_PROFILE_OPS][VM_PROFILE_OPS] = {};
+    std::atomic<u32>* triples = nullptr; // VM_PROFILE_OPS^3
+
+    VM_Profile() {
+      triples = new std::atomic<u32>[VM_PROFILE_OPS*VM_PROFILE_OPS*VM_PROFILE_OPS]();
     }
+    ~VM_Profile() { delete[] triples; }
 
-    void push_adata(u64 size) {
-      _adatas.push(size);
+    std::atomic<u32>& triple(byte a, byte b, byte c) {
+      return triples[((u64)a*VM_PROFILE_OPS + b)*VM_PROFILE_OPS + c];
     }
 
-    Code* operator*() {
-      Code* c = new Code();
-      c->capacity   = _code_size;
-      c->playground = (Instruction*)(code);
-      c->data_size  = _data_size;
-      c->data       = data;
-      return c;
+    u64 count(const byte* seq, byte len) {
+      if (len == 2) { return pairs[seq[0]][seq[1]]; }
+      return triple(seq[0], seq[1], seq[2]);
     }
-    Code operator*(int) {
-      Code c;
-      c.capacity    = _code_size;
-      c.playground  = (Instruction*)code;
-      c.data_size   = _data_size;
-      c.data        = data;
-      return c;
+  };
+
+  /* vms running the code read it without code.lazy, Code stays copyable */
+  VM_Profile* Code_ProfileOf(Code& code) {
+    return std::atomic_ref<VM_Profile*>(code.profile).load(std::memory_order_acquire);
+  }
+
+  /* created once under code.lazy, vms starting a profile run together share it */
+  VM_Profile& Code_Profile(Code& code) {
+    VM_Profile* profile = Code_ProfileOf(code);
+    if (profile != nullptr) { return *profile; }
+    std::lock_guard<std::mutex> guard(code.lazy.lock);
+    if (code.profile == nullptr) {
+      std::atomic_ref<VM_Profile*>(code.profile).store(new VM_Profile(), std::memory_order_release);
     }
+    return *code.profile;
+  }
 
-    byte* at(int idx) {
-      u32 real_idx = (_code_size + idx) % _code_size;
-      MewAssert(real_idx < _code_size);
-      return (code+real_idx);
+  template<typename Cfg = VM_Checked>
+  void RunProfiled(VirtualMachine& vm, VM_Profile& profile) {
+    byte prev1 = VM_PROFILE_OPS, prev2 = VM_PROFILE_OPS;
+    while (vm.begin < vm.end && vm.status != VM_Status_Ret) {
+      byte head_byte = *vm.begin;
+      if (head_byte >= VM_PROFILE_OPS) {
+        prev1 = prev2 = VM_PROFILE_OPS;
+      } else {
+        if (prev1 < VM_PROFILE_OPS) {
+          profile.pairs[prev1][head_byte].fetch_add(1, std::memory_order_relaxed);
+          if (prev2 < VM_PROFILE_OPS) { profile.triple(prev2, prev1, head_byte).fetch_add(1, std::memory_order_relaxed); }
+        }
+        prev2 = prev1; prev1 = head_byte;
+      }
+      ++vm.process_cycle; RunLine<Cfg>(vm);
     }
+  }
 
-    byte* operator[](int idx) {
-      return at(idx);
+  /*
+    superinstructions are static compositions of decoded handlers.
+    the fused handler sits on the first op of a sequence, the following
+    ops keep their own handlers so jumps into the middle stay valid
+  */
+  /* runs a later part of a fused op, counted and located like its own dispatch in RunDecoded */
+  template<VM_DecodedHandler H>
+  inline u32 VMS_Part(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    ++vm.process_cycle;
+    vm.begin = vm.memory + op.pc;
+    return H(vm, op, ip);
+  }
+
+  template<VM_DecodedHandler A, VM_DecodedHandler B>
+  u32 VMS_Pair(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    u32 next = A(vm, op, ip);
+    if (next != ip+1) { return next; }
+    return VMS_Part<B>(vm, (&op)[1], ip+1);
+  }
+
+  template<VM_DecodedHandler A, VM_DecodedHandler B, VM_DecodedHandler C>
+  u32 VMS_Triple(VirtualMachine& vm, VM_DecodedOp& op, u32 ip) {
+    u32 next = A(vm, op, ip);
+    if (next != ip+1) { return next; }
+    next = VMS_Part<B>(vm, (&op)[1], ip+1);
+    if (next != ip+2) { return next; }
+    return VMS_Part<C>(vm, (&op)[2], ip+2);
+  }
+
+  struct VM_Superinstruction {
+    byte len;
+    byte codes[3];
+    VM_DecodedHandler parts[3];
+    VM_DecodedHandler fused;
+  };
+
+  #define VMS_PAIR(_c1, _h1, _c2, _h2) \
+    {2, {_c1, _c2, 0}, {_h1, _h2, nullptr}, VMS_Pair<_h1, _h2>}
+  #define VMS_TRIPLE(_c1, _h1, _c2, _h2, _c3, _h3) \
+    {3, {_c1, _c2, _c3}, {_h1, _h2, _h3}, VMS_Triple<_h1, _h2, _h3>}
+  #define VMS_JCC(_gen, ...) \
+    _gen(__VA_ARGS__ Instruction_JE,  VMD_JE),  \
+    _gen(__VA_ARGS__ Instruction_JEL, VMD_JEL), \
+    _gen(__VA_ARGS__ Instruction_JEM, VMD_JEM), \
+    _gen(__VA_ARGS__ Instruction_JNE, VMD_JNE), \
+    _gen(__VA_ARGS__ Instruction_JL,  VMD_JL),  \
+    _gen(__VA_ARGS__ Instruction_JM,  VMD_JM)
+
+  static VM_Superinstruction vm_superinstructions[] = {
+    VMS_JCC(VMS_PAIR, Instruction_TEST, VMD_Test,),
+    VMS_JCC(VMS_TRIPLE, Instruction_INC, VMD_Math1, Instruction_TEST, VMD_Test,),
+    VMS_JCC(VMS_TRIPLE, Instruction_DEC, VMD_Math1, Instruction_TEST, VMD_Test,),
+    VMS_PAIR(Instruction_PUSH, VMD_PushNum, Instruction_RPOP, VMD_RPop),
+    VMS_PAIR(Instruction_INC, VMD_Math1, Instruction_JMP, VMD_Jmp),
+    VMS_PAIR(Instruction_DEC, VMD_Math1, Instruction_JMP, VMD_Jmp),
+    VMS_PAIR(Instruction_ADD, VMD_Math2, Instruction_JMP, VMD_Jmp),
+    VMS_PAIR(Instruction_SUB, VMD_Math2, Instruction_JMP, VMD_Jmp),
+    VMS_PAIR(Instruction_MOV, VMD_Math2, Instruction_MOV, VMD_Math2),
+    VMS_PAIR(Instruction_ADD, VMD_Math2, Instruction_TEST, VMD_Test),
+    VMS_PAIR(Instruction_SUB, VMD_Math2, Instruction_TEST, VMD_Test),
+  };
+  constexpr const u32 vm_superinstructions_count =
+    sizeof(vm_superinstructions)/sizeof(*vm_superinstructions);
+
+  #undef VMS_JCC
+  #undef VMS_TRIPLE
+  #undef VMS_PAIR
+
+  bool VMS_Match(VM_DecodedCode& dc, VM_DecodedOp* ops, u32 i, VM_Superinstruction& si) {
+    if (i+si.len > dc.count) { return false; }
+    for (byte k = 0; k < si.len; ++k) {
+      VM_DecodedOp& op = ops[i+k];
+      if (op.code != si.codes[k] || op.base != si.parts[k]) { return false; }
     }
+    return true;
+  }
 
-    void force_data(u32 _size) {
-      byte* _ndata = new byte[_data_size+_size];
-      memcpy(_ndata, data, _data_size);
-      _data_size += _size;
-      data = _ndata;
+  /*
+    enables up to `max_kinds` of the hottest known sequences that were seen
+    at least `min_hits` times and fuses them in code.decoded,
+    returns number of rewritten ops. fuses a copy of the ops and swaps
+    it in, vms already in RunDecoded finish on the old array
+  */
+  u32 Code_Superinstructions(Code& code, u64 min_hits = 1024, u32 max_kinds = 8) {
+    std::lock_guard<std::mutex> guard(code.lazy.lock);
+    VM_DecodedCode& dc = Code_DecodeLocked(code);
+    if (!dc.ok || dc.fused || code.profile == nullptr) { return 0; }
+    VM_Profile& profile = *code.profile;
+    u32 order[vm_superinstructions_count];
+    u64 score[vm_superinstructions_count];
+    for (u32 i = 0; i < vm_superinstructions_count; ++i) {
+      order[i] = i;
+      score[i] = profile.count(vm_superinstructions[i].codes, vm_superinstructions[i].len);
     }
-    
+    std::sort(order, order+vm_superinstructions_count, [&](u32 a, u32 b) {
+      return score[a] > score[b];
+    });
+    bool enabled[vm_superinstructions_count] = {false};
+    for (u32 i = 0; i < vm_superinstructions_count && i < max_kinds; ++i) {
+      if (score[order[i]] < min_hits) { break; }
+      enabled[order[i]] = true;
+    }
+    VM_DecodedOp* unfused = dc.ops.load(std::memory_order_relaxed);
+    VM_DecodedOp* ops = new VM_DecodedOp[dc.count+1];
+    std::copy(unfused, unfused+dc.count, ops);
+    u32 rewritten = 0;
+    for (u32 i = 0; i < dc.count; ++i) {
+      VM_Superinstruction* best = nullptr;
+      for (u32 k = 0; k < vm_superinstructions_count; ++k) {
+        if (!enabled[k]) { continue; }
+        VM_Superinstruction& si = vm_superinstructions[k];
+        if (best != nullptr && best->len >= si.len) { continue; }
+        if (VMS_Match(dc, ops, i, si)) { best = &si; }
+      }
+      if (best != nullptr) {
+        ops[i].fn = best->fused;
+        ++rewritten;
+      }
+    }
+    dc.fused = true;
+    if (rewritten == 0) { delete[] ops; return 0; }
+    dc.unfused = unfused;
+    dc.ops.store(ops, std::memory_order_release);
+    return rewritten;
+  }
+
+  void VM_PrintProfile(Code& code, FILE* out, u32 top = 10) {
+    if (code.profile == nullptr) { return; }
+    VM_Profile& profile = *code.profile;
+    fprintf(out, "[PROFILE] hottest opcode pairs:\n");
+    /* (count, a, b), ties keep opcode order */
+    std::vector<std::tuple<u64, int, int>> pairs;
+    for (int a = 0; a < VM_PROFILE_OPS; ++a) {
+      for (int b = 0; b < VM_PROFILE_OPS; ++b) {
+        u64 c = profile.pairs[a][b];
+        if (c != 0) { pairs.emplace_back(c, a, b); }
+      }
+    }
+    u64 shown = std::min<u64>(top, pairs.size());
+    std::partial_sort(pairs.begin(), pairs.begin()+shown, pairs.end(), [](auto& l, auto& r) {
+      if (std::get<0>(l) != std::get<0>(r)) { return std::get<0>(l) > std::get<0>(r); }
+      return std::make_pair(std::get<1>(l), std::get<2>(l)) < std::make_pair(std::get<1>(r), std::get<2>(r));
+    });
+    for (u64 i = 0; i < shown; ++i) {
+      auto& [c, a, b] = pairs[i];
+      fprintf(out, "  %3i %3i : %llu\n", a, b, (unsigned long long)c);
+    }
+    fprintf(out, "[PROFILE] known sequences:\n");
+    for (u32 i = 0; i < vm_superinstructions_count; ++i) {
+      VM_Superinstruction& si = vm_superinstructions[i];
+      u64 c = profile.count(si.codes, si.len);
+      if (c == 0) { continue; }
+      fprintf(out, "  %3i %3i", si.codes[0], si.codes[1]);
+      if (si.len == 3) { fprintf(out, " %3i", si.codes[2]); } else { fprintf(out, "    "); }
+      fprintf(out, " : %llu\n", (unsigned long long)c);
+    }
+  }
+#pragma endregion SUPERINSTRUCTIONS
+
+#pragma region CODE_CACHE
+  /*
+    persisted Code_Decode result (superinstructions included), keyed by a
+    hash of the code and data bytes. handlers and math kernels are stored
+    as indices into the tables below, so the cache is only valid for the
+    vm version and layout written in its header. a hit maps the file
+    private, patches the indices back into pointers in place and checks
+    every op against the code it claims to decode
+  */
+  #define VM_CACHE_MAGIC 0x4344424EU // "NBDC"
+  #define VM_CACHE_FORMAT 2
+
+  static VM_DecodedHandler vmd_handlers[] = {
+    VMD_Fallback, VMD_None, VMD_PushNum, VMD_Pop, VMD_RPop,
+    VMD_Math2, VMD_Math1, VMD_Test, VMD_Jmp,
+    VMD_JE, VMD_JEL, VMD_JEM, VMD_JNE, VMD_JL, VMD_JM,
+    VMD_Call, VMD_Ret, VMD_Exit, VMD_MovRDI,
+  };
+  constexpr const u32 vmd_handlers_count = sizeof(vmd_handlers)/sizeof(*vmd_handlers);
+  constexpr const u32 VMC_NOHANDLER = ~0U;
+  constexpr const u32 vmc_kernels_count = (u32)VM_MathOp_Count*VM_ArgKind_Count*VM_ArgKind_Count;
+
+  struct VM_CacheHeader {
+    u32 magic;
+    u32 format;
+    u64 version;      // GetVersion of the writer
+    u64 key;          // Code_CacheKey
+    u32 op_size;      // sizeof(VM_DecodedOp)
+    u32 handlers;     // vmd_handlers_count + vm_superinstructions_count
+    u32 vm_size;      // sizeof(VirtualMachine), decoded register args are offsets into it
+    u32 reg_offset;   // offsetof(VirtualMachine, _r)
+    u64 layout;       // VMC_LayoutHash
+    u64 capacity;
+    u32 count;
+    u32 _pad0;
+    u64 ops_offset;
+    u64 index_offset;
   };
 
-  constexpr u64 GetVersion() {
-    return VIRTUAL_VERSION;
+  constexpr u64 GetVersion();
+  static std::filesystem::path vm_code_cache_dir;
+
+  /* enables the cache for Decoded/Jit runs, empty path disables it */
+  void VM_SetCodeCache(const std::filesystem::path& dir) {
+    vm_code_cache_dir = dir;
+    if (!dir.empty()) {
+      std::error_code ec;
+      std::filesystem::create_directories(dir, ec);
+    }
   }
 
-  #undef VIRTUAL_VERSION
-#include "mewpop"
-}
-namespace Tests {
-  bool test_Virtual() {
-    try {
-      using namespace Virtual;
-      CodeBuilder builder;
-      builder << Instruction_PUTS;
-      builder << (u32)0U;
-      builder << Instruction_EXIT;
-      builder += "hellow word";
-      Code* code = *builder;
-      Code_SaveFromFile(*code, "./hellow_word.nb");
-      // printf("[%u|%u]\n", code->capacity, code->data_size);
-      Execute("./hellow_word.nb");
-    } catch (std::exception e) {
-      MewPrintError(e);
+  u64 Code_CacheKey(Code& code) {
+    u64 hash = VM_Checksum((const byte*)code.playground, code.capacity);
+    if (code.data) { hash = VM_Checksum(code.data, code.data_size, hash); }
+    return hash;
+  }
+
+  std::filesystem::path Code_CachePath(u64 key) {
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx-%llx.nbc",
+      (unsigned long long)key, (unsigned long long)GetVersion());
+    return vm_code_cache_dir / name;
+  }
+
+  u32 VMC_HandlerIndex(VM_DecodedHandler fn) {
+    for (u32 i = 0; i < vmd_handlers_count; ++i) {
+      if (vmd_handlers[i] == fn) { return i; }
+    }
+    for (u32 i = 0; i < vm_superinstructions_count; ++i) {
+      if (vm_superinstructions[i].fused == fn) { return vmd_handlers_count+i; }
+    }
+    return VMC_NOHANDLER;
+  }
+
+  VM_DecodedHandler VMC_Handler(u32 idx) {
+    if (idx < vmd_handlers_count) { return vmd_handlers[idx]; }
+    idx -= vmd_handlers_count;
+    return idx < vm_superinstructions_count ? vm_superinstructions[idx].fused : nullptr;
+  }
+
+  /*
+    fingerprint of everything a cached op silently depends on: register
+    offsets inside VirtualMachine and the shape of the handler tables.
+    handlers are hashed by their distance to the first one, that is stable
+    across runs of one binary (aslr moves them together) and changes with it
+  */
+  u64 VMC_LayoutHash() {
+    u64 layout[] = {
+      sizeof(VirtualMachine), sizeof(VM_DecodedOp),
+      offsetof(VirtualMachine, _r), offsetof(VirtualMachine, _fx),
+      offsetof(VirtualMachine, _rx), offsetof(VirtualMachine, _dx),
+      offsetof(VirtualMachine, rdi), vmd_handlers_count, vm_superinstructions_count,
+    };
+    u64 hash = VM_Checksum((const byte*)layout, sizeof(layout));
+    for (u32 i = 0; i < vmd_handlers_count; ++i) {
+      u64 distance = (u64)((uintptr_t)vmd_handlers[i] - (uintptr_t)vmd_handlers[0]);
+      hash = VM_Checksum((const byte*)&distance, sizeof(distance), hash);
+    }
+    for (u32 i = 0; i < vm_superinstructions_count; ++i) {
+      VM_Superinstruction& si = vm_superinstructions[i];
+      u64 shape[4] = {si.len, si.codes[0], si.codes[1], si.codes[2]};
+      for (byte k = 0; k < si.len; ++k) { shape[k+1] |= (u64)VMC_HandlerIndex(si.parts[k]) << 8; }
+      hash = VM_Checksum((const byte*)shape, sizeof(shape), hash);
+    }
+    return hash;
+  }
+
+  /* field by field, padding in the file is never compared */
+  bool VMC_SameArg(const VM_DecodedArg& x, const VM_DecodedArg& y) {
+    return x.type == y.type && x.ri.type == y.ri.type && x.ri.idx == y.ri.idx
+      && x.reg == y.reg && x.size == y.size && x.num == y.num && x.offset == y.offset;
+  }
+
+  /* 0 is nullptr, otherwise 1 + flat index into vm_math_kernels */
+  u64 VMC_KernelIndex(VM_MathKernel kernel) {
+    if (kernel == nullptr) { return 0; }
+    const VM_MathKernel* table = vm_math_kernels[0].data();
+    for (u32 i = 0; i < vmc_kernels_count; ++i) {
+      if (table[i] == kernel) { return i+1; }
+    }
+    return ~0ULL;
+  }
+
+  /* writes code.decoded next to the other entries, false if it cant be persisted */
+  bool Code_StoreCached(Code& code) {
+    if (vm_code_cache_dir.empty() || code.decoded == nullptr || !code.decoded->ok) { return false; }
+    VM_DecodedCode& dc = *code.decoded;
+    VM_CacheHeader header = {};
+    header.magic = VM_CACHE_MAGIC;
+    header.format = VM_CACHE_FORMAT;
+    header.version = GetVersion();
+    header.key = Code_CacheKey(code);
+    header.op_size = sizeof(VM_DecodedOp);
+    header.handlers = vmd_handlers_count + vm_superinstructions_count;
+    header.vm_size = sizeof(VirtualMachine);
+    header.reg_offset = offsetof(VirtualMachine, _r);
+    header.layout = VMC_LayoutHash();
+    header.capacity = code.capacity;
+    header.count = dc.count;
+    header.ops_offset = __VM_ALIGN(sizeof(header), alignof(VM_DecodedOp));
+    header.index_offset = header.ops_offset + (u64)dc.count*sizeof(VM_DecodedOp);
+    VM_DecodedOp* current = dc.ops.load(std::memory_order_acquire);
+    std::vector<VM_DecodedOp> ops(current, current+dc.count);
+    for (VM_DecodedOp& op: ops) {
+      u32 fn = VMC_HandlerIndex(op.fn), base = VMC_HandlerIndex(op.base);
+      u64 kernel = VMC_KernelIndex(op.kernel);
+      if (fn == VMC_NOHANDLER || base == VMC_NOHANDLER || kernel == ~0ULL) { return false; }
+      op.fn = (VM_DecodedHandler)(uintptr_t)fn;
+      op.base = (VM_DecodedHandler)(uintptr_t)base;
+      op.kernel = (VM_MathKernel)(uintptr_t)kernel;
+    }
+    std::filesystem::path path = Code_CachePath(header.key);
+    /* pid + thread + counter, two writers never share a temp file */
+    static std::atomic<u64> temp_counter{0};
+#ifdef _WIN32
+    u64 pid = (u64)GetCurrentProcessId();
+#else
+    u64 pid = (u64)getpid();
+#endif
+    std::filesystem::path temp = path;
+    temp += ".tmp" + std::to_string(pid) + "-"
+      + std::to_string((u64)std::hash<std::thread::id>{}(std::this_thread::get_id())) + "-"
+      + std::to_string(temp_counter.fetch_add(1));
+    {
+      std::ofstream file(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+      if (!file.is_open()) { return false; }
+      file.write((const char*)&header, sizeof(header));
+      static const char zeros[alignof(VM_DecodedOp)] = {0};
+      file.write(zeros, header.ops_offset - sizeof(header));
+      file.write((const char*)ops.data(), (u64)dc.count*sizeof(VM_DecodedOp));
+      file.write((const char*)dc.index_of, (code.capacity+1)*sizeof(u32));
+      if (!file) { return false; }
+    }
+    /* rename keeps readers from ever seeing a half written entry */
+    std::error_code ec;
+    std::filesystem::rename(temp, path, ec);
+    if (ec) { std::filesystem::remove(temp, ec); return false; }
+    return true;
+  }
+
+  /* fills code.decoded from the cache, false on miss or stale entry */
+  bool Code_LoadCached(Code& code) {
+    if (vm_code_cache_dir.empty() || code.decoded != nullptr) { return false; }
+    u64 key = Code_CacheKey(code);
+    std::filesystem::path path = Code_CachePath(key);
+    VM_CacheHeader header;
+    byte* base = nullptr;
+    u64 size = 0;
+#ifdef _WIN32
+    std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file.is_open()) { return false; }
+    size = (u64)file.tellg();
+    if (size < sizeof(header)) { return false; }
+    base = new byte[size];
+    file.seekg(0);
+    file.read((char*)base, size);
+#else
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { return false; }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (u64)st.st_size < sizeof(header)) { close(fd); return false; }
+    size = (u64)st.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) { return false; }
+    base = (byte*)mapping;
+#endif
+    auto release = [&]() {
+#ifdef _WIN32
+      delete[] base;
+#else
+      munmap(base, size);
+#endif
       return false;
+    };
+    memcpy(&header, base, sizeof(header));
+    if (header.magic != VM_CACHE_MAGIC || header.format != VM_CACHE_FORMAT
+        || header.version != GetVersion() || header.key != key
+        || header.op_size != sizeof(VM_DecodedOp)
+        || header.handlers != vmd_handlers_count + vm_superinstructions_count
+        || header.vm_size != sizeof(VirtualMachine)
+        || header.reg_offset != offsetof(VirtualMachine, _r)
+        || header.layout != VMC_LayoutHash()
+        || header.capacity != code.capacity
+        || header.count > code.capacity
+        || header.ops_offset > size || header.ops_offset % alignof(VM_DecodedOp) != 0
+        || header.index_offset != header.ops_offset + (u64)header.count*sizeof(VM_DecodedOp)
+        || header.index_offset + (code.capacity+1)*sizeof(u32) > size) {
+      return release();
+    }
+    VM_DecodedOp* ops = (VM_DecodedOp*)(base+header.ops_offset);
+    u32* index_of = (u32*)(base+header.index_offset);
+    /*
+      the key is only a hash, so the file is trusted for nothing that can be
+      checked: every op must equal a fresh decode of playground[pc..next)
+      and the ops must tile the code. that is a decode pass without the
+      allocations, what the hit still saves is those and the fusing
+    */
+    for (u64 i = 0; i < code.capacity; ++i) {
+      u32 idx = index_of[i];
+      if (idx != VMD_EXIT && (idx >= header.count || ops[idx].pc != i)) { return release(); }
+    }
+    if (index_of[code.capacity] != header.count) { return release(); }
+    const byte* begin = (const byte*)code.playground;
+    const byte* end = begin + code.capacity;
+    u32 pc = 0;
+    for (u32 i = 0; i < header.count; ++i) {
+      VM_DecodedOp& op = ops[i];
+      u64 kernel = (u64)(uintptr_t)op.kernel;
+      op.fn = VMC_Handler((u32)(uintptr_t)op.fn);
+      op.base = VMC_Handler((u32)(uintptr_t)op.base);
+      if (op.fn == nullptr || op.base == nullptr || kernel > vmc_kernels_count) { return release(); }
+      op.kernel = kernel ? vm_math_kernels[0].data()[kernel-1] : nullptr;
+      if (op.pc != pc || pc >= code.capacity) { return release(); }
+      VM_DecodedOp fresh;
+      u64 target = VMD_NOTARGET;
+      u64 length = VMD_DecodeOne(begin, begin+pc, end, fresh, target);
+      if (target != VMD_NOTARGET) {
+        if (target > code.capacity || index_of[target] == VMD_EXIT) { return release(); }
+        fresh.target = index_of[target];
+      }
+      if (length == 0 || op.next != pc+length || op.base != fresh.fn || op.code != fresh.code
+          || op.type_x != fresh.type_x || op.type_y != fresh.type_y || op.target != fresh.target
+          || op.kernel != fresh.kernel || !VMC_SameArg(op.a, fresh.a) || !VMC_SameArg(op.b, fresh.b)) {
+        return release();
+      }
+      pc = op.next;
+    }
+    if (pc != code.capacity) { return release(); }
+    /* a handler other than its own is only a superinstruction over its ops */
+    VM_DecodedCode probe;
+    probe.count = header.count;
+    for (u32 i = 0; i < header.count; ++i) {
+      VM_DecodedOp& op = ops[i];
+      if (op.fn == op.base) { continue; }
+      u32 si = VMC_HandlerIndex(op.fn) - vmd_handlers_count;
+      if (si >= vm_superinstructions_count || !VMS_Match(probe, ops, i, vm_superinstructions[si])) {
+        return release();
+      }
+    }
+    VM_DecodedCode* dc = new VM_DecodedCode();
+    dc->ok = true;
+    dc->count = header.count;
+    dc->ops = ops;
+    dc->index_of = index_of;
+    dc->mapping = base;
+    dc->mapping_size = size;
+    code.decoded = dc;
+    return true;
+  }
+
+  /* Code_Decode through the on-disk cache when VM_SetCodeCache is set */
+  VM_DecodedCode& Code_DecodeCached(Code& code) {
+    std::lock_guard<std::mutex> guard(code.lazy.lock);
+    if (code.decoded != nullptr || vm_code_cache_dir.empty()) { return Code_DecodeLocked(code); }
+    if (Code_LoadCached(code)) { return *code.decoded; }
+    VM_DecodedCode& dc = Code_DecodeLocked(code);
+    Code_StoreCached(code);
+    return dc;
+  }
+#pragma endregion CODE_CACHE
+
+#pragma region JIT
+  /*
+    baseline template jit over the decoded stream. a block starts at a
+    leader op and ends at the first branch/call/ret. register arithmetic
+    on same-kind _r/_rx/_fx/_dx operands, MOVRDI, TEST on stack values and
+    Jcc are emitted natively, CALL/RET call straight into begin_stack
+    helpers, every other op is a call into its decoded handler (RunLine
+    for I/O and DCALL). blocks are compiled once their leader was entered
+    VM_JIT_THRESHOLD times, a loop back-edge leaves the block once the
+    cycle limit of the run is reached
+  */
+  #ifndef VM_JIT_THRESHOLD
+    #define VM_JIT_THRESHOLD 1000
+  #endif
+  #ifndef VM_JIT_MAX_BLOCK
+    #define VM_JIT_MAX_BLOCK 256
+  #endif
+  #ifndef VM_JIT_ARENA
+    #define VM_JIT_ARENA (256*1024)
+  #endif
+
+#if defined(__x86_64__) && !defined(_WIN32)
+  #define VM_JIT_SUPPORTED 1
+#endif
+
+  typedef u32(*VM_JitFn)(VirtualMachine*, VM_DecodedOp*, u64 limit);
+  constexpr const u32 VMJ_THROW = ~1U; // handler threw, see vmj_error
+
+  /* read by every vm running the code, written under VM_Jit::lock */
+  struct VM_JitBlock {
+    std::atomic<u32> hits{0};
+    std::atomic<bool> tried{false};
+    std::atomic<VM_JitFn> fn{nullptr};
+  };
+
+  struct VM_JitArena {
+    byte* base = nullptr;
+    u64 used = 0;
+  };
+
+  struct VM_Jit {
+    u32 threshold = VM_JIT_THRESHOLD;
+    bool* leader = nullptr;
+    VM_JitBlock* blocks = nullptr;
+    mew::stack<VM_JitArena> arenas;
+    std::mutex lock; // compilation and arenas
+  };
+
+  static thread_local std::exception_ptr vmj_error;
+
+  /* jit code has no unwind info, handlers called from it must not throw */
+  u32 VMJ_Guard(VirtualMachine* vm, VM_DecodedOp* op, u32 ip) {
+    try {
+      vm->begin = vm->memory + op->pc;
+      return op->base(*vm, *op, ip);
+    } catch (...) {
+      vmj_error = std::current_exception();
+      return VMJ_THROW;
+    }
+  }
+
+  u32 VMJ_Call(VirtualMachine* vm, VM_DecodedOp* op, u32 ip) {
+    try {
+      vm->begin_stack.push(vm->memory + op->next);
+      return op->target;
+    } catch (...) {
+      vmj_error = std::current_exception();
+      return VMJ_THROW;
+    }
+  }
+
+  u32 VMJ_Ret(VirtualMachine* vm, VM_DecodedOp* op, u32 ip) {
+    if (vm->begin_stack.empty()) {
+      vm->status = VM_Status_Ret; return VMD_EXIT;
+    }
+    vm->begin = vm->begin_stack.top();
+    vm->begin_stack.pop();
+    return VMD_IndexOf(*vm, *vm->src->decoded, vm->begin);
+  }
+
+  byte VMJ_TestMask(bool equal, bool less, bool more) {
+    VirtualMachine::TestStatus t;
+    memset(&t, 0, sizeof(t));
+    t.equal = equal; t.less = less; t.more = more;
+    byte mask; memcpy(&mask, &t, sizeof(mask));
+    return mask;
+  }
+
+  class VM_JitEmitter {
+  public:
+    std::vector<byte> buf;
+    mew::stack<u64> exits; // rel32 positions patched to the epilogue
+
+    u64 size() const { return buf.size(); }
+    void b(byte x) { buf.push_back(x); }
+    void d(u32 x) { for (int i = 0; i < 4; ++i) { b((byte)(x >> (i*8))); } }
+    void q(u64 x) { for (int i = 0; i < 8; ++i) { b((byte)(x >> (i*8))); } }
+    void rexw(bool w) { if (w) { b(0x48); } }
+    /* modrm for [rbx+disp32] */
+    void mrbx(byte reg, u32 disp) { b(0x80 | ((reg & 7) << 3) | 3); d(disp); }
+
+    void prologue() {
+      b(0x53);                   // push rbx
+      b(0x41); b(0x54);          // push r12
+      b(0x41); b(0x55);          // push r13
+      b(0x48); b(0x89); b(0xFB); // mov rbx, rdi
+      b(0x49); b(0x89); b(0xF4); // mov r12, rsi
+      b(0x49); b(0x89); b(0xD5); // mov r13, rdx (cycle limit)
+    }
+    void epilogue() {
+      for (int i = 0; i < exits.count(); ++i) { patch(exits[i], size()); }
+      b(0x41); b(0x5D);          // pop r13
+      b(0x41); b(0x5C);          // pop r12
+      b(0x5B);                   // pop rbx
+      b(0xC3);                   // ret
+    }
+    void patch(u64 at, u64 to) {
+      u32 rel = (u32)(s64)(to - (at + 4));
+      memcpy(buf.data()+at, &rel, sizeof(rel));
+    }
+
+    void mov_eax(u32 x) { b(0xB8); d(x); }
+    void mov_ecx(u32 x) { b(0xB9); d(x); }
+    void cmp_eax(u32 x) { b(0x3D); d(x); }
+    void jmp_exit() { b(0xE9); exits.push(size()); d(0); }
+    void jne_exit() { b(0x0F); b(0x85); exits.push(size()); d(0); }
+    void jcc_to(byte cc, u64 to) { b(0x0F); b(0x80 | cc); u64 at = size(); d(0); patch(at, to); }
+    /* forward jumps, resolved by here() */
+    u64 jcc_fwd(byte cc) { b(0x0F); b(0x80 | cc); u64 at = size(); d(0); return at; }
+    u64 jmp_fwd() { b(0xE9); u64 at = size(); d(0); return at; }
+    void here(u64 at) { patch(at, size()); }
+    void ret_value(u32 x) { mov_eax(x); jmp_exit(); }
+
+    void add_cycles(u32 n, u32 off) { b(0x48); b(0x81); mrbx(0, off); d(n); }
+    void cmp_mem_r13(u32 off) { b(0x4C); b(0x39); mrbx(5, off); }
+
+    /* fn(vm, &ops[ip], ip), result in eax */
+    void call_fn(u32(*fn)(VirtualMachine*, VM_DecodedOp*, u32), u32 ip) {
+      b(0x48); b(0x89); b(0xDF);                          // mov rdi, rbx
+      b(0x49); b(0x8D); b(0xB4); b(0x24);                 // lea rsi, [r12+disp32]
+      d((u32)(ip*sizeof(VM_DecodedOp)));
+      b(0xBA); d(ip);                                     // mov edx, ip
+      b(0x48); b(0xB8); q((u64)(uintptr_t)fn);            // mov rax, fn
+      b(0xFF); b(0xD0);                                   // call rax
+    }
+
+    void call_handler(u32 ip) {
+      call_fn(&VMJ_Guard, ip);
+      cmp_eax(ip+1); jne_exit();
+    }
+
+    /* integer ops, w selects 64 bit */
+    void load_eax(bool w, u32 off) { rexw(w); b(0x8B); mrbx(0, off); }
+    void store_eax(bool w, u32 off) { rexw(w); b(0x89); mrbx(0, off); }
+    void alu_mem_eax(bool w, byte opc, u32 off) { rexw(w); b(opc); mrbx(0, off); }
+    void alu_mem_imm(bool w, byte ext, u32 off, u32 imm) { rexw(w); b(0x81); mrbx(ext, off); d(imm); }
+    void mov_mem_imm(bool w, u32 off, u32 imm) { rexw(w); b(0xC7); mrbx(0, off); d(imm); }
+    void imul_eax_mem(bool w, u32 off) { rexw(w); b(0x0F); b(0xAF); mrbx(0, off); }
+    void imul_eax_mem_imm(bool w, u32 off, u32 imm) { rexw(w); b(0x69); mrbx(0, off); d(imm); }
+    void incdec_mem(bool w, bool dec, u32 off) { rexw(w); b(0xFF); mrbx(dec ? 1 : 0, off); }
+
+    /* sse scalar ops on xmm0, dbl selects sd over ss */
+    void sse(bool dbl, byte opc, u32 off) { b(dbl ? 0xF2 : 0xF3); b(0x0F); b(opc); mrbx(0, off); }
+    void test_mem_imm8(u32 off, byte mask) { b(0xF6); mrbx(0, off); b(mask); }
+    void cmov_eax_ecx(bool nz) { b(0x0F); b(nz ? 0x45 : 0x44); b(0xC1); }
+    void cmovcc_eax_ecx(byte cc) { b(0x0F); b(0x40 | cc); b(0xC1); }
+  };
+
+  enum VMJ_Kind: byte {
+    VMJ_Kind_None, VMJ_Kind_I32, VMJ_Kind_I64, VMJ_Kind_F32, VMJ_Kind_F64
+  };
+
+  VMJ_Kind VMJ_RegKind(VM_DecodedArg& arg) {
+    if (arg.type != Instruction_REG) { return VMJ_Kind_None; }
+    switch (arg.ri.type) {
+      case VM_RegType::R:  return VMJ_Kind_I32;
+      case VM_RegType::RX: return VMJ_Kind_I64;
+      case VM_RegType::FX: return VMJ_Kind_F32;
+      case VM_RegType::DX: return VMJ_Kind_F64;
+      default: return VMJ_Kind_None;
     }
+  }
+
+  bool VMJ_EmitMath(VM_JitEmitter& e, VM_DecodedOp& op) {
+    VMJ_Kind ka = VMJ_RegKind(op.a);
+    if (ka == VMJ_Kind_None) { return false; }
+    u32 da = op.a.reg;
+    if (op.base == VMD_Math1) {
+      if (ka != VMJ_Kind_I32 && ka != VMJ_Kind_I64) { return false; }
+      if (op.code != Instruction_INC && op.code != Instruction_DEC) { return false; }
+      e.incdec_mem(ka == VMJ_Kind_I64, op.code == Instruction_DEC, da);
+      return true;
+    }
+    if (op.base != VMD_Math2) { return false; }
+    bool is_num = op.b.type == Instruction_NUM;
+    if (!is_num && VMJ_RegKind(op.b) != ka) { return false; }
+    u32 db = op.b.reg, imm = (u32)op.b.num;
+    if (ka == VMJ_Kind_F32 || ka == VMJ_Kind_F64) {
+      if (is_num) { return false; }
+      bool dbl = ka == VMJ_Kind_F64;
+      byte opc;
+      switch (op.code) {
+        case Instruction_ADD: opc = 0x58; break;
+        case Instruction_MUL: opc = 0x59; break;
+        case Instruction_SUB: opc = 0x5C; break;
+        case Instruction_DIV: opc = 0x5E; break;
+        case Instruction_MOV: e.sse(dbl, 0x10, db); e.sse(dbl, 0x11, da); return true;
+        default: return false;
+      }
+      e.sse(dbl, 0x10, da); e.sse(dbl, opc, db); e.sse(dbl, 0x11, da);
+      return true;
+    }
+    bool w = ka == VMJ_Kind_I64;
+    byte opc, ext;
+    switch (op.code) {
+      case Instruction_ADD: opc = 0x01; ext = 0; break;
+      case Instruction_OR:  opc = 0x09; ext = 1; break;
+      case Instruction_AND: opc = 0x21; ext = 4; break;
+      case Instruction_SUB: opc = 0x29; ext = 5; break;
+      case Instruction_XOR: opc = 0x31; ext = 6; break;
+      case Instruction_MOV: {
+        if (is_num) { e.mov_mem_imm(w, da, imm); }
+        else { e.load_eax(w, db); e.store_eax(w, da); }
+      } return true;
+      case Instruction_MUL: {
+        if (is_num) { e.imul_eax_mem_imm(w, da, imm); }
+        else { e.load_eax(w, da); e.imul_eax_mem(w, db); }
+        e.store_eax(w, da);
+      } return true;
+      default: return false;
+    }
+    if (is_num) { e.alu_mem_imm(w, ext, da, imm); }
+    else { e.load_eax(w, db); e.alu_mem_eax(w, opc, da); }
     return true;
   }
+
+  bool VMJ_StackOperand(byte type) {
+    return type == 0 || type == Instruction_FLT || type == Instruction_ST || type == Instruction_NUM;
+  }
+
+  /*
+    TEST of two stack slots: x = peek(rdi+1), y = peek(rdi) compared the
+    way VM_Test does (memcmp of the low 4 bytes, so byte swapped), an
+    underflow takes the handler and its exception
+  */
+  void VMJ_EmitTest(VM_JitEmitter& e, VM_DecodedOp& op, u32 ip) {
+    if (!VMJ_StackOperand(op.type_x) || !VMJ_StackOperand(op.type_y)) {
+      e.call_handler(ip); return;
+    }
+    u32 stack = offsetof(VirtualMachine, stack);
+    e.b(0x48); e.b(0x8B); e.mrbx(1, stack+VM_Stack::top_offset());   // mov rcx, m_top
+    e.b(0x48); e.b(0x89); e.b(0xCA);                                 // mov rdx, rcx
+    e.b(0x48); e.b(0x2B); e.mrbx(2, stack+VM_Stack::base_offset());  // sub rdx, m_base
+    e.b(0x48); e.b(0xC1); e.b(0xEA); e.b(3);                         // shr rdx, 3
+    e.b(0x48); e.b(0x8B); e.mrbx(0, offsetof(VirtualMachine, rdi));  // mov rax, rdi
+    e.b(0x48); e.b(0x8D); e.b(0x70); e.b(1);                         // lea rsi, [rax+1]
+    e.b(0x48); e.b(0x39); e.b(0xD6);                                 // cmp rsi, rdx
+    u64 slow_x = e.jcc_fwd(0x3);                                     // jae
+    e.b(0x48); e.b(0x39); e.b(0xD0);                                 // cmp rax, rdx
+    u64 slow_y = e.jcc_fwd(0x3);                                     // jae
+    e.b(0x48); e.b(0xF7); e.b(0xD8);                                 // neg rax
+    e.b(0x8B); e.b(0x54); e.b(0xC1); e.b(0xF8);                      // mov edx, [rcx+rax*8-8]
+    e.b(0x8B); e.b(0x74); e.b(0xC1); e.b(0xF0);                      // mov esi, [rcx+rax*8-16]
+    e.b(0x0F); e.b(0xCE); e.b(0x0F); e.b(0xCA);                      // bswap esi, bswap edx
+    e.b(0x39); e.b(0xD6);                                            // cmp esi, edx
+    e.mov_eax(VMJ_TestMask(1, 0, 0));
+    e.mov_ecx(VMJ_TestMask(0, 1, 0)); e.cmovcc_eax_ecx(0x2);         // cmovb
+    e.mov_ecx(VMJ_TestMask(0, 0, 1)); e.cmovcc_eax_ecx(0x7);         // cmova
+    e.b(0x88); e.mrbx(0, offsetof(VirtualMachine, test));            // mov test, al
+    u64 done = e.jmp_fwd();
+    e.here(slow_x); e.here(slow_y);
+    e.call_handler(ip);
+    e.here(done);
+  }
+
+  bool VMJ_IsBranch(VM_DecodedOp& op) {
+    return op.base == VMD_JE  || op.base == VMD_JEL || op.base == VMD_JEM ||
+           op.base == VMD_JNE || op.base == VMD_JL  || op.base == VMD_JM;
+  }
+
+  bool VMJ_IsTerminator(VM_DecodedOp& op) {
+    return VMJ_IsBranch(op) || op.base == VMD_Jmp || op.base == VMD_Call ||
+           op.base == VMD_Ret || op.base == VMD_Exit || op.base == VMD_Fallback;
+  }
+
+  /*
+    whole pages per block, a page turns executable once and is never
+    written again, so installing does not touch code other vms run
+  */
+  byte* VMJ_Alloc(VM_Jit& jit, u64 size) {
+#ifdef VM_JIT_SUPPORTED
+    if (jit.arenas.empty() || jit.arenas.top().used + size > VM_JIT_ARENA) {
+      if (size > VM_JIT_ARENA) { return nullptr; }
+      void* base = mmap(nullptr, VM_JIT_ARENA, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (base == MAP_FAILED) { return nullptr; }
+      VM_JitArena arena;
+      arena.base = (byte*)base;
+      jit.arenas.push(arena);
+    }
+    VM_JitArena& arena = jit.arenas.top();
+    byte* place = arena.base + arena.used;
+    arena.used += size;
+    return place;
+#else
+    return nullptr;
+#endif
+  }
+
+  /* writes code into fresh arena pages, keeping them W^X */
+  VM_JitFn VMJ_Install(VM_Jit& jit, VM_JitEmitter& e) {
+#ifdef VM_JIT_SUPPORTED
+    u64 page = (u64)sysconf(_SC_PAGESIZE);
+    u64 size = (e.size() + page - 1) & ~(page - 1);
+    byte* place = VMJ_Alloc(jit, size);
+    if (place == nullptr) { return nullptr; }
+    memcpy(place, e.buf.data(), e.size());
+    if (mprotect(place, size, PROT_READ | PROT_EXEC) != 0) { return nullptr; }
+    return (VM_JitFn)(void*)place;
+#else
+    return nullptr;
+#endif
+  }
+
+  /* caller holds jit.lock */
+  bool VMJ_Compile(VM_Jit& jit, VM_DecodedCode& dc, u32 start) {
+    u32 end = start;
+    while (end < dc.count && end - start < VM_JIT_MAX_BLOCK) {
+      if (VMJ_IsTerminator(dc.ops[end++])) { break; }
+    }
+    VM_JitEmitter e;
+    e.prologue();
+    u64 loop = e.size();
+    u32 cycle_off = offsetof(VirtualMachine, process_cycle);
+    u32 test_off = offsetof(VirtualMachine, test);
+    /* cycles of the ops so far land before anything that can leave the block */
+    u32 pending = 0;
+    auto flush = [&]() {
+      if (pending) { e.add_cycles(pending, cycle_off); pending = 0; }
+    };
+    auto back_edge = [&]() {
+      e.cmp_mem_r13(cycle_off);
+      e.jcc_to(0x2, loop); // jb, still under the limit
+      e.ret_value(start);
+    };
+    bool closed = false;
+    for (u32 ip = start; ip < end; ++ip) {
+      VM_DecodedOp& op = dc.ops[ip];
+      ++pending;
+      if (op.base == VMD_None) { continue; }
+      if (op.base == VMD_MovRDI) {
+        e.mov_mem_imm(true, offsetof(VirtualMachine, rdi), (u32)(op.a.num/4));
+        continue;
+      }
+      if ((op.base == VMD_Math1 || op.base == VMD_Math2) && VMJ_EmitMath(e, op)) { continue; }
+      flush();
+      if (op.base == VMD_Test) {
+        VMJ_EmitTest(e, op, ip);
+        continue;
+      }
+      if (op.base == VMD_Jmp) {
+        if (op.target == start) { back_edge(); }
+        else { e.ret_value(op.target); }
+        closed = true; break;
+      }
+      if (VMJ_IsBranch(op)) {
+        byte mask; bool nz = true;
+        if      (op.base == VMD_JE)  { mask = VMJ_TestMask(1, 0, 0); }
+        else if (op.base == VMD_JEL) { mask = VMJ_TestMask(1, 1, 0); }
+        else if (op.base == VMD_JEM) { mask = VMJ_TestMask(1, 0, 1); }
+        else if (op.base == VMD_JNE) { mask = VMJ_TestMask(1, 0, 0); nz = false; }
+        else if (op.base == VMD_JL)  { mask = VMJ_TestMask(0, 1, 0); }
+        else                         { mask = VMJ_TestMask(0, 0, 1); }
+        e.test_mem_imm8(test_off, mask);
+        if (op.target == start) {
+          u64 not_taken = e.jcc_fwd(nz ? 0x4 : 0x5);
+          back_edge();
+          e.here(not_taken);
+          e.ret_value(ip+1);
+        } else {
+          e.mov_eax(ip+1); e.mov_ecx(op.target);
+          e.cmov_eax_ecx(nz); e.jmp_exit();
+        }
+        closed = true; break;
+      }
+      if (op.base == VMD_Call || op.base == VMD_Ret) {
+        e.call_fn(op.base == VMD_Call ? &VMJ_Call : &VMJ_Ret, ip);
+        e.jmp_exit();
+        closed = true; break;
+      }
+      e.call_handler(ip);
+      if (VMJ_IsTerminator(op)) {
+        e.jmp_exit(); /* eax holds handler result */
+        closed = true; break;
+      }
+    }
+    if (!closed) { flush(); e.ret_value(end); }
+    e.epilogue();
+    VM_JitFn fn = VMJ_Install(jit, e);
+    jit.blocks[start].fn.store(fn, std::memory_order_release);
+    jit.blocks[start].tried.store(true, std::memory_order_release);
+    return fn != nullptr;
+  }
+
+  /* first vm past the threshold compiles, the others wait or see `tried` */
+  VM_JitFn VMJ_CompileOnce(VM_Jit& jit, VM_DecodedCode& dc, u32 start) {
+    std::lock_guard<std::mutex> guard(jit.lock);
+    VM_JitBlock& block = jit.blocks[start];
+    if (!block.tried.load(std::memory_order_relaxed)) { VMJ_Compile(jit, dc, start); }
+    return block.fn.load(std::memory_order_relaxed);
+  }
+
+  VM_Jit& Code_Jit(Code& code) {
+    VM_DecodedCode& dc = Code_Decode(code);
+    std::lock_guard<std::mutex> guard(code.lazy.lock);
+    if (code.jit != nullptr) { return *code.jit; }
+    VM_Jit* jit = new VM_Jit();
+    code.jit = jit;
+    jit->leader = new bool[dc.count+1];
+    jit->blocks = new VM_JitBlock[dc.count+1];
+    memset(jit->leader, 0, dc.count+1);
+    if (dc.count != 0) { jit->leader[0] = true; }
+    for (u32 i = 0; i < dc.count; ++i) {
+      VM_DecodedOp& op = dc.ops[i];
+      if (VMJ_IsTerminator(op)) { jit->leader[i+1] = true; }
+      if (VMJ_IsBranch(op) || op.base == VMD_Jmp || op.base == VMD_Call) {
+        jit->leader[op.target] = true;
+      }
+    }
+    return *jit;
+  }
+
+  void Code_FreeJit(Code& code) {
+    if (code.jit == nullptr) { return; }
+#ifdef VM_JIT_SUPPORTED
+    for (int i = 0; i < code.jit->arenas.count(); ++i) {
+      munmap(code.jit->arenas[i].base, VM_JIT_ARENA);
+    }
+#endif
+    delete[] code.jit->leader;
+    delete[] code.jit->blocks;
+    delete code.jit;
+    code.jit = nullptr;
+  }
+
+  /*
+    runs until the code ends or `budget` more cycles passed, compiled
+    loops check the limit on their back-edge. false leaves vm.begin on
+    the next op so the run can be resumed
+  */
+  template<typename Cfg = VM_Checked>
+  bool RunJit(VirtualMachine& vm, Code& code, u64 budget = ~0ULL) {
+    VM_DecodedCode& dc = Code_Decode(code);
+#ifndef VM_JIT_SUPPORTED
+    RunDecoded<Cfg>(vm, dc); return true;
+#else
+    /* compiled blocks dont note instructions, debug runs stay decoded */
+    if constexpr (Cfg::debug) { RunDecoded<Cfg>(vm, dc); return true; }
+    if (!dc.ok) { RunSwitch<Cfg>(vm); return true; }
+    VMD_LineScope line(&RunLine<Cfg>);
+    VM_Jit& jit = Code_Jit(code);
+    u64 limit = budget > ~0ULL - vm.process_cycle ? ~0ULL : vm.process_cycle + budget;
+    u32 ip = VMD_IndexOf(vm, dc, vm.begin);
+    VM_DecodedOp* ops = dc.ops.load(std::memory_order_acquire);
+    while (ip < dc.count) {
+      if (vm.process_cycle >= limit) {
+        vm.begin = vm.memory + ops[ip].pc;
+        return false;
+      }
+      if (jit.leader[ip]) {
+        VM_JitBlock& block = jit.blocks[ip];
+        VM_JitFn fn = block.fn.load(std::memory_order_acquire);
+        if (fn == nullptr && !block.tried.load(std::memory_order_acquire)
+            && block.hits.fetch_add(1, std::memory_order_relaxed)+1 >= jit.threshold) {
+          fn = VMJ_CompileOnce(jit, dc, ip);
+        }
+        if (fn != nullptr) {
+          ip = fn(&vm, ops, limit);
+          if (ip == VMJ_THROW) {
+            std::exception_ptr error = vmj_error;
+            vmj_error = nullptr;
+            std::rethrow_exception(error);
+          }
+          continue;
+        }
+      }
+      ++vm.process_cycle;
+      VM_DecodedOp& op = ops[ip];
+      vm.begin = vm.memory + op.pc;
+      ip = op.fn(vm, op, ip);
+    }
+    if (ip != VMD_EXIT) {
+      vm.begin = vm.memory + code.capacity;
+    }
+    RunSwitch<Cfg>(vm);
+    return true;
+#endif
+  }
+#pragma endregion JIT
+
+
+  template<typename Cfg>
+  void RunEngine(VirtualMachine& vm, Code& code, VM_Engine engine) {
+    switch (engine) {
+      case VM_Engine_Threaded: RunThreaded<Cfg>(vm); break;
+      case VM_Engine_Decoded: {
+        VM_DecodedCode& dc = Code_DecodeCached(code);
+        /* an earlier profile run of this code picks the sequences to fuse, once */
+        if (Code_ProfileOf(code) != nullptr) { Code_Superinstructions(code); }
+        RunDecoded<Cfg>(vm, dc);
+      } break;
+      case VM_Engine_Profile: RunProfiled<Cfg>(vm, Code_Profile(code)); break;
+      case VM_Engine_Jit: Code_DecodeCached(code); RunJit<Cfg>(vm, code); break;
+      default: RunSwitch<Cfg>(vm); break;
+    }
+  }
+
+  /* picks the interpreter instantiation once per run */
+  void RunEngine(VirtualMachine& vm, Code& code, VM_Engine engine) {
+    bool verified = Code_Verify(code);
+    bool debug = vm.flags.use_debug;
+    bool heap_lock = vm.flags.heap_lock_execute && !verified;
+    bool bounds = !vm.flags.unchecked && !verified;
+    switch ((debug << 2) | (heap_lock << 1) | (int)bounds) {
+      #define VM_CONFIG_CASE(_d, _h, _b) \
+        case (_d << 2) | (_h << 1) | _b: RunEngine<VM_Config<_d, _h, _b>>(vm, code, engine); break;
+      VM_CONFIG_CASE(0, 0, 0) VM_CONFIG_CASE(0, 0, 1)
+      VM_CONFIG_CASE(0, 1, 0) VM_CONFIG_CASE(0, 1, 1)
+      VM_CONFIG_CASE(1, 0, 0) VM_CONFIG_CASE(1, 0, 1)
+      VM_CONFIG_CASE(1, 1, 0) VM_CONFIG_CASE(1, 1, 1)
+      #undef VM_CONFIG_CASE
+    }
+  }
+
+  /* points vm at loaded code and copies data into the heap */
+  void Prepare(VirtualMachine& vm, Code& code) {
+    u64 code_size = __VM_ALIGN(code.capacity, VM_CODE_ALIGN);
+    MewAssert(vm.capacity > code_size);
+    byte* begin = vm.memory;
+    byte* end   = begin+vm.capacity;
+    byte* alloc_space = begin+code_size+1;
+    vm.flags.use_debug = vm.flags.use_debug || code.cme.flags.has_debug;
+    vm.src = &code;
+    vm.heap = alloc_space;
+    vm.begin = begin;
+    vm.end = end;
+    vm.status = VM_Status_Execute;
+    if (code.data != nullptr) {
+      memcpy(vm.heap, code.data, code.data_size*sizeof(*code.data));
+    }
+    if (code.adata != nullptr) {
+      memset(vm.heap+code.data_size, 0, vm.capacity-(code.capacity+code.data_size));
+    }
+  }
+
+  /* continues a prepared vm from vm.begin, e.g. a forked child */
+  int Resume(VirtualMachine& vm, VM_Engine engine = VM_Engine_Switch) {
+    RunEngine(vm, *vm.src, engine);
+    vm.status = VM_Status_Panding;
+    if (vm.stack.empty()) {
+      return 0;
+    }
+    return (int)vm.stack.peek();
+  }
+
+  int Run(VirtualMachine& vm, Code& code, VM_Engine engine = VM_Engine_Switch) {
+    Prepare(vm, code);
+    return Resume(vm, engine);
+  }
+
+  /* steps a prepared vm until it reaches code offset `cursor`, false if it ended first */
+  bool RunUntil(VirtualMachine& vm, u64 cursor) {
+    byte* point = vm.memory+cursor;
+    while (vm.begin < vm.end && vm.status != VM_Status_Ret) {
+      if (vm.begin == point) { return true; }
+      ++vm.process_cycle;
+      RunLine(vm);
+    }
+    return false;
+  }
+
+  /* frees a Code and everything built from it */
+  void Code_Release(Code* code) {
+    if (code == nullptr) { return; }
+    Code_FreeJit(*code);
+    Code_FreeDecoded(*code);
+    delete code->profile;
+    code->profile = nullptr;
+    delete code->symbols;
+    code->symbols = nullptr;
+    Code_FreeNatives(*code);
+    Code_Unmap(*code);
+    delete code;
+  }
+
+  int Execute(VirtualMachine& vm, Code& code, VM_Engine engine = VM_Engine_Switch) {
+    Alloc(vm, code);
+    LoadMemory(vm, code);
+    return Run(vm, code, engine);
+  }
+  
+  int Execute(Code& code, VM_Engine engine = VM_Engine_Switch) {
+    VirtualMachine vm;
+    Alloc(vm, code);
+    LoadMemory(vm, code);
+    int result = Run(vm, code, engine);
+    Free(vm);
+    return result;
+  }
+
+  int Execute(const char* path, VM_Engine engine = VM_Engine_Switch) {
+    Code* code = Code_LoadFromFile(path);
+    MewUserAssert(code != nullptr, "unsupported file version");
+    return Execute(*code, engine);
+  }
+
+  void VM_ResetState(VirtualMachine& vm) {
+    memset(vm._r, 0, sizeof(vm._r));
+    memset(vm._rx, 0, sizeof(vm._rx));
+    memset(vm._fx, 0, sizeof(vm._fx));
+    memset(vm._dx, 0, sizeof(vm._dx));
+    vm.stack.clear();
+    vm.begin_stack.clear();
+    vm.rdi = 0;
+    vm.test = {};
+    vm.debug = {};
+    vm.status = VM_Status_Panding;
+    vm.process_cycle = 0;
+    vm.fs.CloseAll();
+  }
+
+  /* puts a finished vm of `code` back into the state Alloc+LoadMemory leave it in */
+  void VM_Reset(VirtualMachine& vm, Code& code) {
+    VM_ResetState(vm);
+    VM_ResetMemory(vm, vm.capacity); // mapped code pages fall back to the file
+    u64 mapped = vm.mapped_code;
+    memcpy(vm.memory+mapped, (byte*)code.playground+mapped, code.capacity-mapped);
+    Code_PatchNatives(vm, code);
+  }
+
+  #ifndef VM_POOL_MAX
+    #define VM_POOL_MAX 64
+  #endif
+
+  /*
+    keeps finished vms around so a run costs a reset instead of a fresh
+    allocation, stack mapping and full memset
+  */
+  class VM_Pool {
+  private:
+    struct Idle {
+      VirtualMachine* vm;
+      u64 generation; // of the code it last ran
+    };
+    std::vector<Idle> m_free;
+    std::mutex m_lock;
+
+    /* run time flags back to their defaults, allocation flags stay */
+    static void ResetFlags(VirtualMachine& vm, Code& code) {
+      VirtualMachine::Flags flags;
+      flags.use_isolate = vm.flags.use_isolate;
+      flags.mapped_memory = vm.flags.mapped_memory;
+      flags.mapped_view = vm.flags.mapped_view;
+      flags.use_debug = code.cme.flags.has_debug;
+      vm.flags = flags;
+    }
+  public:
+    VM_Pool() { }
+    ~VM_Pool() {
+      for (auto& idle: m_free) {
+        Free(*idle.vm);
+        delete idle.vm;
+      }
+    }
+    VM_Pool(const VM_Pool&) = delete;
+    VM_Pool& operator=(const VM_Pool&) = delete;
+
+    /* vm with memory for code, loaded and ready for Run */
+    VirtualMachine* Acquire(Code& code) {
+      u64 size = Code_MemorySize(code);
+      VirtualMachine* vm = nullptr;
+      bool same = false;
+      {
+        std::lock_guard<std::mutex> guard(m_lock);
+        for (u64 i = m_free.size(); i-- > 0;) {
+          same = m_free[i].generation == code.generation;
+          if (same || i == 0) {
+            vm = m_free[i].vm;
+            m_free[i] = m_free.back();
+            m_free.pop_back();
+            break;
+          }
+        }
+      }
+      if (same) {
+        ResetFlags(*vm, code);
+        VM_Reset(*vm, code);
+        vm->src = &code;
+        return vm;
+      }
+      /* other code, keep the vm but not its memory */
+      if (vm == nullptr) {
+        vm = new VirtualMachine();
+      } else {
+        VM_ResetState(*vm);
+        VM_ReleaseLibs(*vm);
+      }
+      Free(*vm);
+      ResetFlags(*vm, code);
+      if (!AllocFromImage(*vm, code, size)) {
+        AllocMapped(*vm, size);
+      }
+      LoadMemory(*vm, code);
+      vm->src = &code;
+      return vm;
+    }
+
+    /* before the code of the vm is released */
+    void Release(VirtualMachine* vm) {
+      u64 generation = vm->src != nullptr ? vm->src->generation : 0;
+      std::lock_guard<std::mutex> guard(m_lock);
+      if (m_free.size() >= VM_POOL_MAX) {
+        Free(*vm);
+        delete vm;
+        return;
+      }
+      m_free.push_back({vm, generation});
+    }
+
+    int Execute(Code& code, VM_Engine engine = VM_Engine_Switch) {
+      VirtualMachine* vm = Acquire(code);
+      int result;
+      try {
+        result = Run(*vm, code, engine);
+      } catch (...) {
+        Release(vm);
+        throw;
+      }
+      Release(vm);
+      return result;
+    }
+  };
+
+  /*
+    frozen copy of a vm: memory lives in an anonymous shared object, every
+    fork maps it private, so children share all pages until they write.
+    pointers into vm memory (begin, heap, end, begin_stack) are kept as
+    offsets and rebased per child. open vm.fs descriptors and the
+    vm.dll_pipes cache are not carried over, a child keeps its own and
+    has to open files again; code natives and libs are shared
+  */
+  class VM_Snapshot {
+  private:
+#ifdef _WIN32
+    HANDLE m_mapping = nullptr;
+#else
+    int m_fd = -1;
+#endif
+    u64 m_size = 0;
+    Code* m_src = nullptr;
+    VM_Register<4> m_r[5];
+    VM_Register<8> m_rx[5];
+    VM_Register<4> m_fx[5];
+    VM_Register<8> m_dx[5];
+    VirtualMachine::TestStatus m_test;
+    VirtualMachine::Flags m_flags;
+    VM_Status m_status;
+    VM_DEBUG m_debug;
+    VM_HostTable* m_hosts = nullptr;
+    u64 m_rdi, m_process_cycle;
+    u64 m_heap, m_begin, m_end;
+    std::vector<u64> m_stack;
+    std::vector<u64> m_begin_stack;
+    std::vector<VM_LibRef> m_libs;
+    FILE *m_std_in, *m_std_out;
+
+  public:
+    explicit VM_Snapshot(VirtualMachine& vm) { Capture(vm); }
+    ~VM_Snapshot() { Release(); }
+    VM_Snapshot(const VM_Snapshot&) = delete;
+    VM_Snapshot& operator=(const VM_Snapshot&) = delete;
+
+    void Capture(VirtualMachine& vm) {
+      Release();
+      m_size = vm.capacity;
+#ifdef _WIN32
+      m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+        (DWORD)(m_size >> 32), (DWORD)m_size, nullptr);
+      MewUserAssert(m_mapping != nullptr, "cant create snapshot");
+      void* view = MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, m_size);
+      MewUserAssert(view != nullptr, "cant create snapshot");
+      memcpy(view, vm.memory, m_size);
+      UnmapViewOfFile(view);
+#else
+  #ifdef __linux__
+      m_fd = memfd_create("vm_snapshot", MFD_CLOEXEC);
+  #else
+      char path[] = "/tmp/vm_snapshot_XXXXXX";
+      m_fd = mkstemp(path);
+      if (m_fd >= 0) { unlink(path); }
+  #endif
+      MewUserAssert(m_fd >= 0, "cant create snapshot");
+      MewUserAssert(ftruncate(m_fd, (off_t)m_size) == 0, "cant create snapshot");
+      void* view = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+      MewUserAssert(view != MAP_FAILED, "cant create snapshot");
+      memcpy(view, vm.memory, m_size);
+      munmap(view, m_size);
+#endif
+      m_src = vm.src;
+      memcpy(m_r, vm._r, sizeof(m_r));
+      memcpy(m_rx, vm._rx, sizeof(m_rx));
+      memcpy(m_fx, vm._fx, sizeof(m_fx));
+      memcpy(m_dx, vm._dx, sizeof(m_dx));
+      m_test = vm.test;
+      m_flags = vm.flags;
+      m_status = vm.status;
+      m_debug = vm.debug;
+      m_hosts = vm.hosts;
+      m_rdi = vm.rdi;
+      m_process_cycle = vm.process_cycle;
+      m_heap  = (u64)(vm.heap - vm.memory);
+      m_begin = (u64)(vm.begin - vm.memory);
+      m_end   = (u64)(vm.end - vm.memory);
+      m_stack.assign(vm.stack.data(), vm.stack.data()+vm.stack.size());
+      m_begin_stack.clear();
+      for (int i = 0; i < vm.begin_stack.size(); ++i) {
+        m_begin_stack.push_back((u64)(vm.begin_stack[i] - vm.memory));
+      }
+      ReleaseLibs();
+      for (int i = 0; i < vm.libs.size(); ++i) {
+        VM_LibRef ref = vm.libs[i];
+        if (ref.code != nullptr) { VM_Libraries().Retain(ref.code); }
+        m_libs.push_back(ref);
+      }
+      m_std_in = vm.std_in;
+      m_std_out = vm.std_out;
+    }
+
+    /* child resumes where the snapshot was taken, see Resume */
+    void Fork(VirtualMachine& child) {
+      MewUserAssert(m_size != 0, "empty snapshot");
+      Free(child);
+#ifdef _WIN32
+      child.memory = (byte*)MapViewOfFile(m_mapping, FILE_MAP_COPY, 0, 0, m_size);
+      MewUserAssert(child.memory != nullptr, "cant fork snapshot");
+#else
+      void* view = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, m_fd, 0);
+      MewUserAssert(view != MAP_FAILED, "cant fork snapshot");
+      child.memory = (byte*)view;
+#endif
+      child.capacity = m_size;
+      child.src = m_src;
+      memcpy(child._r, m_r, sizeof(m_r));
+      memcpy(child._rx, m_rx, sizeof(m_rx));
+      memcpy(child._fx, m_fx, sizeof(m_fx));
+      memcpy(child._dx, m_dx, sizeof(m_dx));
+      child.test = m_test;
+      child.flags = m_flags;
+      child.flags.mapped_memory = true;
+      child.flags.mapped_view = true;
+      child.status = m_status;
+      child.debug = m_debug;
+      child.hosts = m_hosts;
+      child.rdi = m_rdi;
+      child.process_cycle = m_process_cycle;
+      child.heap  = child.memory+m_heap;
+      child.begin = child.memory+m_begin;
+      child.end   = child.memory+m_end;
+      child.stack.clear();
+      for (u64 value: m_stack) {
+        child.stack.push(value);
+      }
+      child.begin_stack.clear();
+      for (u64 offset: m_begin_stack) {
+        child.begin_stack.push(child.memory+offset);
+      }
+      VM_ReleaseLibs(child);
+      for (VM_LibRef ref: m_libs) {
+        if (ref.code != nullptr) { VM_Libraries().Retain(ref.code); }
+        child.libs.push(ref);
+      }
+      child.std_in = m_std_in;
+      child.std_out = m_std_out;
+    }
+
+    VirtualMachine* Fork() {
+      VirtualMachine* child = new VirtualMachine();
+      Fork(*child);
+      return child;
+    }
+
+    void ReleaseLibs() {
+      for (VM_LibRef& ref: m_libs) {
+        if (ref.code != nullptr) { VM_Libraries().Release(ref.code); }
+      }
+      m_libs.clear();
+    }
+
+    void Release() {
+      ReleaseLibs();
+#ifdef _WIN32
+      if (m_mapping != nullptr) { CloseHandle(m_mapping); m_mapping = nullptr; }
+#else
+      if (m_fd >= 0) { close(m_fd); m_fd = -1; }
+#endif
+      m_size = 0;
+    }
+  };
+
+  #ifndef VM_ASYNC_IO_THREADS
+    #define VM_ASYNC_IO_THREADS 4
+  #endif
+
+  /*
+    up to `threads` threads running suspended vms' blocking io, started on
+    first use. a vm has at most one request in flight so its own io stays
+    in order, different vms dont wait on each other
+  */
+  class VM_IOWorker {
+  public:
+    typedef void(*on_done_fn)(void* ctx, VirtualMachine* vm);
+  private:
+    std::vector<std::thread> m_threads;
+    u32 m_max_threads;
+    u32 m_idle = 0;
+    u32 m_active = 0;
+    std::mutex m_lock;
+    std::condition_variable m_cv;
+    std::condition_variable m_quiet_cv;
+    std::deque<VirtualMachine*> m_queue;
+    bool m_stop = false;
+    on_done_fn m_on_done;
+    void* m_ctx;
+  public:
+    VM_IOWorker(on_done_fn on_done, void* ctx, u32 threads = 1)
+      : m_max_threads(threads ? threads : 1), m_on_done(on_done), m_ctx(ctx) { }
+    ~VM_IOWorker() {
+      {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stop = true;
+      }
+      m_cv.notify_all();
+      for (auto& thread: m_threads) { thread.join(); }
+    }
+    VM_IOWorker(const VM_IOWorker&) = delete;
+    VM_IOWorker& operator=(const VM_IOWorker&) = delete;
+
+    void Submit(VirtualMachine& vm) {
+      {
+        std::lock_guard<std::mutex> guard(m_lock);
+        vm.io.submitted = true;
+        m_queue.push_back(&vm);
+        if (m_idle < m_queue.size() && m_threads.size() < m_max_threads) {
+          m_threads.emplace_back(&VM_IOWorker::Loop, this);
+        }
+      }
+      m_cv.notify_one();
+    }
+
+    /*
+      drops requests that didnt start and waits for the running ones, after
+      it no thread touches a vm submitted before. their vms stay suspended
+    */
+    void Cancel() {
+      std::unique_lock<std::mutex> guard(m_lock);
+      m_queue.clear();
+      m_quiet_cv.wait(guard, [&]{ return m_active == 0; });
+    }
+
+  private:
+    void Loop() {
+      for (;;) {
+        VirtualMachine* vm;
+        {
+          std::unique_lock<std::mutex> guard(m_lock);
+          ++m_idle;
+          m_cv.wait(guard, [&]{ return m_stop || !m_queue.empty(); });
+          --m_idle;
+          if (m_queue.empty()) { return; }
+          vm = m_queue.front();
+          m_queue.pop_front();
+          ++m_active;
+        }
+        VM_PerformIO(*vm);
+        if (m_on_done) { m_on_done(m_ctx, vm); }
+        {
+          std::lock_guard<std::mutex> guard(m_lock);
+          --m_active;
+        }
+        m_quiet_cv.notify_all();
+      }
+    }
+  };
+
+  #ifndef VM_ASYNC_QUANTUM
+    #define VM_ASYNC_QUANTUM 1024
+  #endif
+  /* how often the time quantum looks at the clock, power of two */
+  #ifndef VM_ASYNC_CLOCK_STRIDE
+    #define VM_ASYNC_CLOCK_STRIDE 64
+  #endif
+
+  class VM_Async {
+  public:
+    struct ExecuteInfo {
+      enum struct Status {
+        Execute, Errored, Done
+      } status;
+      int result;
+      u64 instructions; // executed over all steps
+    }; 
+    /* per vm budget of one ExecuteStep, zero disables a limit */
+    struct Quantum {
+      u64 instructions = VM_ASYNC_QUANTUM;
+      u64 micros = 0;
+    };
+  private:
+    /* run queue of vm ids, owner pops the front, thieves take the back */
+    struct Worker {
+      std::mutex lock;
+      std::deque<int> queue;
+      std::thread thread;
+    };
+    mew::stack<VirtualMachine*> m_vms;
+    mew::stack<ExecuteInfo> m_execs;
+    Quantum m_quantum;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<u8> m_finished;       // guarded by m_wait_lock while running
+    std::atomic<u64> m_pending{0};
+    std::atomic<bool> m_stop{false};
+    std::mutex m_wait_lock;
+    std::condition_variable m_wait_cv;
+    std::mutex m_io_lock;             // resume vs Stop tearing down workers
+    /* console input has its own lane, a guest waiting on GETCH cant stall file io */
+    VM_IOWorker m_io{&VM_Async::OnIODone, this, VM_ASYNC_IO_THREADS};
+    VM_IOWorker m_console{&VM_Async::OnIODone, this, 1};
+  public:
+    VM_Async() { }
+    VM_Async(Quantum quantum): m_quantum(quantum) { }
+    ~VM_Async() { Stop(); }
+    VM_Async(const VM_Async&) = delete;
+    VM_Async& operator=(const VM_Async&) = delete;
+
+    void setQuantum(u64 instructions, u64 micros = 0) {
+      MewUserAssert(instructions != 0 || micros != 0, "quantum without limit");
+      m_quantum.instructions = instructions;
+      m_quantum.micros = micros;
+    }
+
+    Quantum getQuantum() const {
+      return m_quantum;
+    }
+
+    void hardStop() {
+      Stop();
+      /* io threads may still be writing into a suspended vm */
+      m_io.Cancel();
+      m_console.Cancel();
+      for (int i = 0; i < m_vms.size(); ++i) {
+        delete m_vms[i];
+      }
+      m_vms.clear();
+      m_execs.clear();
+    }
+    
+    int Append(Code& code) {
+      MewUserAssert(!is_running(), "cant append to running scheduler");
+      VirtualMachine* vm = new VirtualMachine();
+      Alloc(*vm, code);
+      LoadMemory(*vm, code);
+      Prepare(*vm, code);
+      vm->flags.async_io = true;
+      m_execs.push((ExecuteInfo){ExecuteInfo::Status::Execute, -1, 0});
+      return m_vms.push(vm);
+    }
+
+    /* done or errored, a finished vm is Panding by then, not Ret */
+    bool is_ends(int id) {
+      std::lock_guard<std::mutex> guard(m_wait_lock);
+      if (is_running()) { return m_finished[id] != 0; }
+      return m_execs[id].status != ExecuteInfo::Status::Execute;
+    }
+
+    /* m_execs entries are written by workers under m_wait_lock */
+    int get_status_code(int id) {
+      std::lock_guard<std::mutex> guard(m_wait_lock);
+      return m_execs[id].result;
+    }
+
+    u64 get_instructions(int id) {
+      std::lock_guard<std::mutex> guard(m_wait_lock);
+      return m_execs[id].instructions;
+    }
+        
+    VirtualMachine* GetById(int id) {
+      return m_vms[id];
+    }
+
+    /* one quantum of every unfinished vm, finished ones keep their result */
+    void ExecuteStep() {
+      MewUserAssert(!is_running(), "scheduler owns the vms");
+      for (int i = 0; i < m_vms.size(); ++i) {
+        if (m_execs[i].status != ExecuteInfo::Status::Execute) { continue; }
+        StepOne(i);
+      }
+    }
+
+    bool is_running() const {
+      return !m_workers.empty();
+    }
+
+    /*
+      shards unfinished vms round robin over `workers` threads (0 = one per
+      core). a vm stays on its worker between quanta unless an idle worker
+      steals it
+    */
+    void Start(u32 workers = 0) {
+      MewUserAssert(!is_running(), "scheduler already running");
+      if (workers == 0) {
+        workers = std::thread::hardware_concurrency();
+        if (workers == 0) { workers = 1; }
+      }
+      m_stop.store(false);
+      m_finished.assign(m_vms.size(), 0);
+      u64 pending = 0;
+      for (u32 w = 0; w < workers; ++w) {
+        m_workers.push_back(std::make_unique<Worker>());
+      }
+      for (int i = 0; i < m_vms.size(); ++i) {
+        if (m_execs[i].status != ExecuteInfo::Status::Execute) {
+          m_finished[i] = 1;
+          continue;
+        }
+        m_workers[pending++ % workers]->queue.push_back(i);
+      }
+      m_pending.store(pending);
+      for (u32 w = 0; w < workers; ++w) {
+        m_workers[w]->thread = std::thread(&VM_Async::WorkerLoop, this, w);
+      }
+    }
+
+    /* blocks until vm `id` is done or errored, returns its status code */
+    int Wait(int id) {
+      if (is_running()) {
+        std::unique_lock<std::mutex> guard(m_wait_lock);
+        m_wait_cv.wait(guard, [&]{ return m_finished[id] != 0; });
+      }
+      return get_status_code(id);
+    }
+
+    /* blocks until every vm is done or errored, then stops the workers */
+    void Join() {
+      if (!is_running()) { return; }
+      {
+        std::unique_lock<std::mutex> guard(m_wait_lock);
+        m_wait_cv.wait(guard, [&]{ return m_pending.load() == 0; });
+      }
+      Stop();
+    }
+
+    /* stops the workers after their current quantum, vms keep their state */
+    void Stop() {
+      if (!is_running()) { return; }
+      m_stop.store(true);
+      for (auto& worker: m_workers) {
+        worker->thread.join();
+      }
+      std::lock_guard<std::mutex> guard(m_io_lock);
+      m_workers.clear();
+      for (int i = 0; i < m_vms.size(); ++i) {
+        m_vms[i]->io.owner = -1; // still suspended ones are polled from now on
+      }
+    }
+    
+    /* runs one quantum of vm, a single exception boundary for the whole slice */
+    int Run(VirtualMachine& vm, Code& code, u64* executed = nullptr) {
+      if (vm.status == VM_Status_Error) {
+        return -1;
+      }
+      if (vm.status == VM_Status_Wait) {
+        if (!vm.io.done.load(std::memory_order_acquire)) { return -1; }
+        vm.io.submitted = false;
+        if (vm.io.failed) {
+          vm.status = VM_Status_Error;
+          return -1;
+        }
+        vm.status = VM_Status_Execute;
+      }
+      if (!(vm.begin < vm.end && vm.status != VM_Status_Ret)) {
+        vm.status = VM_Status_Panding;
+        return vm.stack.empty() ? 0 : (int)vm.stack.peek();
+      }
+      u64 count = 0;
+      try {
+        RunQuantum(vm, count);
+      } catch(std::exception& e) {
+        /* the throwing instruction is half consumed, the vm cant be resumed */
+        vm.status = VM_Status_Error;
+        u64 cursor = vm.capacity - (u64)(vm.end-vm.begin);
+        Code_FaultSection(code, VM_Section_Debug);
+        for (int i = 0; i < code.cme.debug.size(); ++i) {
+          if (code.cme.debug[i].cursor >= cursor) {
+            const char* fn = vm.debug.last_fn ? vm.debug.last_fn : "?";
+            fprintf(vm.std_out, "\n[DEBUG_ERROR] at (%i) in (%s)\n", code.cme.debug[i].line, fn);
+            break;
+          }
+        }
+      }
+      if (executed) {*executed = count;}
+      return -1;
+    }
+
+  private:
+    /* one quantum of vm `i`, true once it is done or errored */
+    /* `suspended` is decided before the io is submitted, after that the vm may already be resumed elsewhere */
+    bool StepOne(int i, int owner = -1, bool* suspended = nullptr) {
+      u64 executed = 0;
+      VirtualMachine& vm = *m_vms[i];
+      int result = this->Run(vm, *vm.src, &executed);
+      bool finished;
+      {
+        std::lock_guard<std::mutex> guard(m_wait_lock);
+        ExecuteInfo& info = m_execs[i];
+        info.result = result;
+        info.instructions += executed;
+        if (vm.status == VM_Status_Panding) {
+          info.status = ExecuteInfo::Status::Done;
+        }
+        if (vm.status == VM_Status_Error) {
+          info.status = ExecuteInfo::Status::Errored;
+        }
+        finished = info.status != ExecuteInfo::Status::Execute;
+      }
+      if (vm.status == VM_Status_Wait && !vm.io.submitted) {
+        vm.io.owner = owner;
+        vm.io.id = i;
+        if (suspended) {*suspended = true;}
+        (vm.io.kind == VM_IO_Getch ? m_console : m_io).Submit(vm);
+        return false;
+      }
+      return finished;
+    }
+
+    bool PopLocal(u32 self, int& id) {
+      Worker& worker = *m_workers[self];
+      std::lock_guard<std::mutex> guard(worker.lock);
+      if (worker.queue.empty()) { return false; }
+      id = worker.queue.front();
+      worker.queue.pop_front();
+      return true;
+    }
+
+    bool Steal(u32 self, int& id) {
+      const u32 count = (u32)m_workers.size();
+      for (u32 k = 1; k < count; ++k) {
+        Worker& victim = *m_workers[(self+k) % count];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (victim.queue.empty()) { continue; }
+        id = victim.queue.back();
+        victim.queue.pop_back();
+        return true;
+      }
+      return false;
+    }
+
+    void WorkerLoop(u32 self) {
+      u32 idle = 0;
+      while (!m_stop.load(std::memory_order_acquire)) {
+        int id;
+        if (!PopLocal(self, id) && !Steal(self, id)) {
+          if (m_pending.load(std::memory_order_acquire) == 0) { break; }
+          if (++idle < 64) {
+            std::this_thread::yield();
+          } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+          }
+          continue;
+        }
+        idle = 0;
+        bool suspended = false;
+        if (!StepOne(id, (int)self, &suspended)) {
+          if (suspended) {
+            continue; // OnIODone puts it back on this worker
+          }
+          Worker& worker = *m_workers[self];
+          std::lock_guard<std::mutex> guard(worker.lock);
+          worker.queue.push_back(id);
+          continue;
+        }
+        {
+          std::lock_guard<std::mutex> guard(m_wait_lock);
+          m_finished[id] = 1;
+          m_pending.fetch_sub(1, std::memory_order_release);
+        }
+        m_wait_cv.notify_all();
+      }
+    }
+
+    static void OnIODone(void* ctx, VirtualMachine* vm) {
+      VM_Async& self = *(VM_Async*)ctx;
+      std::lock_guard<std::mutex> guard(self.m_io_lock);
+      int owner = vm->io.owner;
+      if (owner < 0 || owner >= (int)self.m_workers.size()) { return; }
+      Worker& worker = *self.m_workers[owner];
+      std::lock_guard<std::mutex> queue_guard(worker.lock);
+      worker.queue.push_back(vm->io.id);
+    }
+
+    /* count is by reference so a throwing slice still reports its progress */
+    void RunQuantum(VirtualMachine& vm, u64& count) {
+      const u64 limit = m_quantum.instructions ? m_quantum.instructions : ~0ULL;
+      if (m_quantum.micros == 0) {
+        while (count < limit && vm.begin < vm.end && vm.status == VM_Status_Execute) {
+          ++vm.process_cycle; ++count;
+          RunLine(vm);
+        }
+        return;
+      }
+      using clock = std::chrono::steady_clock;
+      auto deadline = clock::now() + std::chrono::microseconds(m_quantum.micros);
+      while (count < limit && vm.begin < vm.end && vm.status == VM_Status_Execute) {
+        ++vm.process_cycle; ++count;
+        RunLine(vm);
+        if ((count & (VM_ASYNC_CLOCK_STRIDE-1)) == 0 && clock::now() >= deadline) {
+          break;
+        }
+      }
+    }
+  };
+
+  class CodeBuilder {
+  public:
+    struct untyped_pair {
+      byte* data;
+      byte size;
+    };
+    static const u64 alloc_size = 8;
+  private:
+    u64 capacity, _code_size, _data_size = 0;
+    mew::stack<u64> _adatas;
+    std::vector<std::pair<std::string, u64>> _labels;
+    mew::stack<const char*> _natives;
+    byte* code = nullptr, *data = nullptr;
+    u64 stack_head = 0;
+  public:
+    CodeBuilder(): capacity(alloc_size), _code_size(0), 
+      code((byte*)realloc(NULL, alloc_size)), _data_size(0) { memset(code, 0, alloc_size); }
+
+    CodeBuilder(Code* code)
+      : capacity(code->capacity), 
+        _code_size(code->capacity), 
+        _data_size(code->data_size), 
+        code((byte*)code->playground),
+        data(code->data)
+      { }
+    
+    byte* GetData() const noexcept {
+      return data;
+    }
+
+    inline u64 code_size() const noexcept {
+      return _code_size;
+    }
+
+    inline u64 cursor() const noexcept {
+      return _code_size;
+    }
+
+    inline u64 data_size() const noexcept {
+      return _data_size;
+    }
+
+    template<typename K>
+    u64 push(K& value) {
+      *this
+        << Instruction_PUSH 
+        << Instruction_NUM
+        << Instruction_STRUCT
+        << sizeof(value);
+      insert(value);
+      return cursor();
+    }
+
+    inline u64 putAtCode(u64 idx, byte* val, u64 _size) {
+      MewUserAssert(idx+_size <= _code_size, "out of code");
+      memcpy(code, val, _size);
+      return cursor();
+    }
+
+    inline u64 putAtCode(u64 idx, u64 val) {
+      MewUserAssert(idx+sizeof(val) <= _code_size, "out of code");
+      memcpy(code, &val, sizeof(val));
+      return cursor();
+    }
+    
+    inline u64 insertAtCode(u64 idx, byte* val, u64 size) {
+      u8* buffer = new u8[size+_code_size];
+      memcpy(buffer, code, idx);
+      memcpy(buffer+idx, val, size);
+      memcpy(buffer+idx+size, code+idx, _code_size - idx);
+      delete code;
+      code = buffer;
+      _code_size += size;
+      return cursor();
+    }
+    
+    inline u64 putAtData(u64 idx, byte* val, u64 _size) {
+      MewUserAssert(idx+_size <= _data_size, "out of data");
+      memcpy(data, val, _size);
+      return _data_size;
+    }
+
+    inline u64 putAtData(u64 idx, u64 val) {
+      MewUserAssert(idx+sizeof(val) <= _data_size, "out of data");
+      memcpy(data, &val, sizeof(val));
+      return cursor();
+    }
+
+    inline u64 putRegister(VM_REG_INFO reg) {
+      *this
+        << Instruction_REG
+        << (byte)reg.type
+        << (byte)reg.idx;
+      return cursor();
+    }
+
+    inline u64 putNumber(s32 num) {
+      *this
+        << Instruction_NUM
+        << num;
+      return cursor();
+    }
+
+    inline u64 putMem(u64 offset, u64 size) {
+      *this
+        << Instruction_MEM
+        << offset
+        << size;
+      return cursor();
+    }
+
+    inline u64 putByte(u8 num) {
+      *this
+        << Instruction_BYTE
+        << num;
+      return cursor();
+    }
+
+    /* names the current cursor, see Code_FindLabel / VM_Resolve */
+    inline u64 label(const char* name) {
+      _labels.emplace_back(name, cursor());
+      return cursor();
+    }
+
+    /* declares a native library for DCALL, returns its lib index */
+    inline u64 native(const char* path) {
+      return _natives.push(strdup(path));
+    }
+
+    /* DCALL with the name stored in data, bound to a slot at load */
+    inline u64 putDCall(u64 lib_idx, const char* name) {
+      u64 offset = _data_size;
+      AddData((byte*)name, strlen(name)+1);
+      *this << Instruction_DCALL;
+      putU64(lib_idx);
+      putU64(offset);
+      return cursor();
+    }
+
+    /* HCALL, takes `argc` slots from the stack and pushes the result */
+    inline u64 putHCall(u32 id, byte argc) {
+      *this << Instruction_HCALL << id << argc;
+      return cursor();
+    }
+
+    /* DCALLB over the VM_NativeBatch at heap `batch`, results at heap `results` */
+    inline u64 putDCallBatch(u64 lib_idx, const char* name, u64 batch, u64 results) {
+      u64 offset = _data_size;
+      AddData((byte*)name, strlen(name)+1);
+      *this << Instruction_DCALLB;
+      putU64(lib_idx);
+      putU64(offset);
+      putU64(batch);
+      putU64(results);
+      return cursor();
+    }
+
+    inline u64 putRdiOffset(u64 offset) {
+      *this
+        << Instruction_ST
+        << offset;
+      return cursor();
+    }
+    
+    void Upsize(u64 _size = alloc_size) {
+      byte* __temp_p = (byte*)realloc(code, capacity+_size);
+      code = __temp_p;
+      capacity += _size;
+    }
+    
+    void UpsizeIfNeeds(u64 needs_size) {
+      if (_code_size+needs_size > capacity) {
+        Upsize(needs_size);
+      }
+    }
+        
+    void AddData(byte* row, u64 size) {
+      u64 __new_size = _data_size+size;
+      data = (byte*)realloc(data, __new_size);
+      memcpy(data+_data_size, row, size);
+      _data_size = __new_size;
+    }
+
+    CodeBuilder& operator+=(const char* text) {
+      AddData((byte*)text, strlen(text));
+      return *this;
+    }
+
+    friend CodeBuilder& operator<<(CodeBuilder& cb, byte i) {
+      cb.UpsizeIfNeeds(sizeof(i));
+      cb.code[cb._code_size++] = i;
+      return cb;
+    } 
+
+    friend CodeBuilder& operator<<(CodeBuilder& cb, u32 i) {
+      cb.UpsizeIfNeeds(sizeof(i));
+      memcpy(cb.code+cb._code_size, &i, sizeof(i));
+      cb._code_size += sizeof(i);
+      return cb;
+    }
+
+    CodeBuilder& putU64(u64 i) {
+      UpsizeIfNeeds(sizeof(i));
+      memcpy(code+_code_size, &i, sizeof(i));
+      _code_size += sizeof(i);
+      return *this;
+    }
+
+    friend CodeBuilder& operator<<(CodeBuilder& cb, Instruction i) {
+      cb.UpsizeIfNeeds(sizeof(i));
+      cb.code[cb._code_size++] = i;
+      return cb;
+    }
+    friend CodeBuilder& operator<<(CodeBuilder& cb, int i) {
+      cb.UpsizeIfNeeds(sizeof(i));
+      memcpy(cb.code+cb._code_size, &i, sizeof(i));
+      cb._code_size += sizeof(i);
+      return cb;
+    }
+    friend CodeBuilder& operator<<(CodeBuilder& cb, size_t i) {
+      cb.UpsizeIfNeeds(sizeof(i));
+      memcpy(cb.code+cb._code_size, &i, sizeof(i));
+      cb._code_size += sizeof(i);
+      return cb;
+    }
+    
+    template<typename K>
+    CodeBuilder& insert(K& value) {
+      UpsizeIfNeeds(sizeof(value));
+      memcpy(code+_code_size, &value, sizeof(value));
+      _code_size += sizeof(value);
+      return *this;
+    }
+
+    friend CodeBuilder& operator<<(CodeBuilder& cb, untyped_pair i) {
+      cb.UpsizeIfNeeds(i.size);
+      memcpy(cb.code+cb._code_size, &i.data, i.size);
+      cb._code_size += i.size;
+      return cb;
+    }
+
+    friend CodeBuilder& operator>>(CodeBuilder& cb, untyped_pair i) {
+      cb.UpsizeIfNeeds(i.size);
+      memmove(cb.code+i.size, cb.code, cb._code_size);
+      memcpy(cb.code, &i.data, i.size);
+      cb._code_size += i.size;
+      return cb;
+    }
+
+    void push_adata(u64 size) {
+      _adatas.push(size);
+    }
+
+    Code* operator*() {
+      Code* c = new Code();
+      c->capacity   = _code_size;
+      c->playground = (Instruction*)(code);
+      c->data_size  = _data_size;
+      c->data       = data;
+      if (!_labels.empty()) { c->symbols = VM_BuildSymbols(_labels); }
+      for (int i = 0; i < _natives.size(); ++i) { c->cme.natives.push(_natives.at(i)); }
+      const char* error = nullptr;
+      MewForUserAssert(Code_Bind(*c, &error), "cant bind native calls (%s)", error);
+      return c;
+    }
+    Code operator*(int) {
+      Code c;
+      c.capacity    = _code_size;
+      c.playground  = (Instruction*)code;
+      c.data_size   = _data_size;
+      c.data        = data;
+      if (!_labels.empty()) { c.symbols = VM_BuildSymbols(_labels); }
+      for (int i = 0; i < _natives.size(); ++i) { c.cme.natives.push(_natives.at(i)); }
+      const char* error = nullptr;
+      MewForUserAssert(Code_Bind(c, &error), "cant bind native calls (%s)", error);
+      return c;
+    }
+
+    byte* at(int idx) {
+      u32 real_idx = (_code_size + idx) % _code_size;
+      MewAssert(real_idx < _code_size);
+      return (code+real_idx);
+    }
+
+    byte* operator[](int idx) {
+      return at(idx);
+    }
+
+    void force_data(u32 _size) {
+      byte* _ndata = new byte[_data_size+_size];
+      memcpy(_ndata, data, _data_size);
+      _data_size += _size;
+      data = _ndata;
+    }
+    
+  };
+
+  constexpr u64 GetVersion() {
+    return VIRTUAL_VERSION;
+  }
+
+  #undef VIRTUAL_VERSION
+  #undef VIRTUAL_REVISION
+#include "mewpop"
+}
+namespace Tests {
+  /* runs a test or bench body, a failed assert inside reports and fails it */
+  template<typename F>
+  bool test_Guard(F&& body) {
+    try {
+      body();
+    } catch (std::exception& e) {
+      MewPrintError(e);
+      return false;
+    }
+    return true;
+  }
+
+  bool test_Virtual() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      CodeBuilder builder;
+      builder << Instruction_PUTS;
+      builder << (u32)0U;
+      builder << Instruction_EXIT;
+      builder += "hellow word";
+      Code* code = *builder;
+      Code_SaveToFile(*code, "./hellow_word.nb");
+      // printf("[%u|%u]\n", code->capacity, code->data_size);
+      Execute("./hellow_word.nb");
+    });
+  }
+
+  /* true if `body` faults, for checks that have to refuse something */
+  template<typename F>
+  bool test_Throws(F&& body) {
+    try {
+      body();
+    } catch (std::exception& e) {
+      return true;
+    }
+    return false;
+  }
+
+  bool test_Report(const char* name, bool ok) {
+    printf("[TEST] %s: %s\n", name, ok ? "ok" : "failed");
+    return ok;
+  }
+
+  /* registers and operand stack, what every engine has to leave the same */
+  bool test_SameState(Virtual::VirtualMachine& a, Virtual::VirtualMachine& b) {
+    if (memcmp(a._r, b._r, sizeof(a._r)) || memcmp(a._fx, b._fx, sizeof(a._fx))
+        || memcmp(a._rx, b._rx, sizeof(a._rx)) || memcmp(a._dx, b._dx, sizeof(a._dx))
+        || a.rdi != b.rdi || a.stack.size() != b.stack.size()) { return false; }
+    for (u64 i = 0; i < a.stack.size(); ++i) {
+      if (a.stack.peek(i) != b.stack.peek(i)) { return false; }
+    }
+    return true;
+  }
+
+  /*
+    counting loop closed by a stack TEST, then a CALL. hot enough for the
+    jit and the profile, ends with r0 = 9*iterations and r2 = iterations-1
+  */
+  Virtual::Code* test_LoopCode(u32 iterations = 5000) {
+    using namespace Virtual;
+    CodeBuilder builder;
+    builder << Instruction_MOV;
+    builder.putRegister({VM_RegType::R, 1});
+    builder.putNumber(3);
+    builder << Instruction_MOV;
+    builder.putRegister({VM_RegType::R, 4});
+    builder.putNumber((s32)iterations);
+    u64 loop = builder.cursor();
+    builder << Instruction_ADD;
+    builder.putRegister({VM_RegType::R, 0});
+    builder.putRegister({VM_RegType::R, 1});
+    builder << Instruction_XOR;
+    builder.putRegister({VM_RegType::R, 3});
+    builder.putRegister({VM_RegType::R, 0});
+    builder << Instruction_INC;
+    builder.putRegister({VM_RegType::R, 2});
+    builder << Instruction_PUSH;
+    builder.putRegister({VM_RegType::R, 2});
+    builder << Instruction_PUSH;
+    builder.putRegister({VM_RegType::R, 4});
+    builder << Instruction_TEST << Instruction_NUM << Instruction_NUM;
+    builder << Instruction_POP << Instruction_POP;
+    builder << Instruction_JNE << (int)loop;
+    builder << Instruction_CALL;
+    u64 call = builder.cursor();
+    builder.putU64(0);
+    builder << Instruction_PUSH;
+    builder.putRegister({VM_RegType::R, 0});
+    builder << Instruction_PUSH;
+    builder.putRegister({VM_RegType::R, 3});
+    builder << Instruction_EXIT;
+    u64 fn = builder.cursor();
+    builder << Instruction_MUL;
+    builder.putRegister({VM_RegType::R, 0});
+    builder.putRegister({VM_RegType::R, 1});
+    builder << Instruction_DEC;
+    builder.putRegister({VM_RegType::R, 2});
+    builder << Instruction_RET;
+    memcpy(builder[(int)call], &fn, sizeof(fn));
+    return *builder;
+  }
+
+  /* counts the top stack slot up to `iterations` with INC TEST JNE, a fusable sequence */
+  Virtual::Code* test_FusableLoopCode(u32 iterations) {
+    using namespace Virtual;
+    CodeBuilder builder;
+    builder << Instruction_PUSH;
+    builder.putNumber((s32)iterations);
+    builder << Instruction_PUSH;
+    builder.putNumber(0);
+    u64 loop = builder.cursor();
+    builder << Instruction_INC << Instruction_ST << (u32)0;
+    builder << Instruction_TEST << Instruction_NUM << Instruction_NUM;
+    builder << Instruction_JNE << (int)loop;
+    builder << Instruction_EXIT;
+    return *builder;
+  }
+
+  u64 test_PipeAdd(Virtual::VirtualMachine* vm) {
+    u64 b = vm->stack.pop();
+    u64 a = vm->stack.pop();
+    return a+b;
+  }
+
+  /* records are two u32, results may be unaligned in the heap */
+  u64 test_BatchAdd(Virtual::VirtualMachine* vm, const Virtual::byte* records, u64 stride, u64* results, u64 count) {
+    for (u64 i = 0; i < count; ++i) {
+      u32 pair[2];
+      memcpy(pair, records+i*stride, sizeof(pair));
+      u64 sum = (u64)pair[0]+pair[1];
+      memcpy(results+i, &sum, sizeof(sum));
+    }
+    return count;
+  }
+
+  u64 test_HostMulAdd(Virtual::VirtualMachine& vm, Virtual::VM_HostArgs args, void* user) {
+    return args.u(0)*args.u(1) + *(u64*)user;
+  }
+
+  /* leaves a marker under its result, the args are already off the stack */
+  u64 test_HostPush(Virtual::VirtualMachine& vm, Virtual::VM_HostArgs args, void* user) {
+    vm.stack.push(7);
+    return args.u(0) - args.u(1);
+  }
+
+  /*
+    math opcodes against what the old do_math switch left in the registers,
+    as raw bits: a register source is read with the destination's kind,
+    so mixed R/FX and RX/DX take bit patterns, NUM converts and bitwise
+    ops leave a float destination alone. every engine has to agree
+  */
+  bool test_MathKernels() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      const VM_RegType R = VM_RegType::R, RX = VM_RegType::RX, FX = VM_RegType::FX,
+        DX = VM_RegType::DX, NUM = VM_RegType::None;
+      struct Case {
+        const char* name;
+        byte code;
+        VM_RegType ta; u64 a;
+        VM_RegType tb; u64 b; // NUM is an immediate source
+        u64 a_after, b_after;
+      } cases[] = {
+        {"R add R", Instruction_ADD, R, 1000, R, 7, 1007, 7},
+        {"R sub NUM", Instruction_SUB, R, 1000, NUM, 7, 993, 7},
+        {"R mul R", Instruction_MUL, R, 1000, R, 7, 7000, 7},
+        {"R div R", Instruction_DIV, R, 1000, R, 7, 142, 7},
+        {"R xor R", Instruction_XOR, R, 1000, R, 7, 1007, 7},
+        {"R or R", Instruction_OR, R, 1000, R, 7, 1007, 7},
+        {"R and R", Instruction_AND, R, 1000, R, 7, 0, 7},
+        {"R ls R", Instruction_LS, R, 1000, R, 7, 128000, 7},
+        {"R rs R", Instruction_RS, R, 1000, R, 7, 7, 7},
+        {"RX add RX", Instruction_ADD, RX, 1ULL << 40, RX, 5, (1ULL << 40) + 5, 5},
+        {"RX sub NUM", Instruction_SUB, RX, 1ULL << 40, NUM, 1, (1ULL << 40) - 1, 1},
+        {"FX div FX", Instruction_DIV, FX, 0x3FC00000, FX, 0x3E800000, 0x40C00000, 0x3E800000}, // 1.5f/0.25f
+        {"DX mul DX", Instruction_MUL, DX, 0x4004000000000000, DX, 0x3FD0000000000000,
+          0x3FE4000000000000, 0x3FD0000000000000},                                          // 2.5*0.25
+        {"FX add NUM", Instruction_ADD, FX, 0x3FC00000, NUM, 2, 0x40600000, 2},                  // 1.5f+2
+        {"DX mov NUM", Instruction_MOV, DX, 0, NUM, 3, 0x4008000000000000, 3},                   // 3.0
+        {"FX xor NUM", Instruction_XOR, FX, 0x3FC00000, NUM, 2, 0x3FC00000, 2},
+        {"DX and DX", Instruction_AND, DX, 0x4004000000000000, DX, 0x3FD0000000000000,
+          0x4004000000000000, 0x3FD0000000000000},
+        /* mixed register kinds */
+        {"R add FX", Instruction_ADD, R, 1000, FX, 0x3FC00000, 1000 + 0x3FC00000, 0x3FC00000},
+        {"R xor FX", Instruction_XOR, R, 0xFF, FX, 0x3FC00000, 0x3FC000FF, 0x3FC00000},
+        {"FX mov R", Instruction_MOV, FX, 0, R, 0x40490FDB, 0x40490FDB, 0x40490FDB},              // pi bits
+        {"FX add R", Instruction_ADD, FX, 0x3FC00000, R, 2, 0x3FC00000, 2},                      // + a denormal
+        {"RX add DX", Instruction_ADD, RX, 5, DX, 0x4000000000000000, 0x4000000000000005, 0x4000000000000000},
+        {"DX mov RX", Instruction_MOV, DX, 0, RX, 0x400921FB54442D18, 0x400921FB54442D18, 0x400921FB54442D18},
+        {"DX mul RX", Instruction_MUL, DX, 0x4000000000000000, RX, 0x3FE0000000000000,
+          0x3FF0000000000000, 0x3FE0000000000000},                                          // 2.0*0.5
+        {"R mov RX", Instruction_MOV, R, 0, RX, 0x100000005, 5, 0x100000005},
+        {"R swap FX", Instruction_SWAP, R, 5, FX, 0x3FC00000, 0x3FC00000, 5},
+      };
+      VM_Engine engines[] = {VM_Engine_Switch, VM_Engine_Threaded, VM_Engine_Decoded, VM_Engine_Profile, VM_Engine_Jit};
+      for (Case& c: cases) {
+        CodeBuilder builder;
+        builder << c.code;
+        builder.putRegister({c.ta, 1});
+        if (c.tb == NUM) { builder.putNumber((s32)c.b); }
+        else { builder.putRegister({c.tb, 3}); }
+        builder << Instruction_EXIT;
+        Code* code = *builder;
+        for (VM_Engine engine: engines) {
+          VirtualMachine vm;
+          Alloc(vm, *code);
+          LoadMemory(vm, *code);
+          Prepare(vm, *code);
+          u64 size_a = 0, size_b = 0;
+          byte* ra = vm.getRegister(c.ta, 1, &size_a);
+          byte* rb = c.tb != NUM ? vm.getRegister(c.tb, 3, &size_b) : nullptr;
+          memcpy(ra, &c.a, size_a);
+          if (rb) { memcpy(rb, &c.b, size_b); }
+          Resume(vm, engine);
+          u64 a = 0, b = c.b;
+          memcpy(&a, ra, size_a);
+          if (rb) { b = 0; memcpy(&b, rb, size_b); }
+          MewForUserAssert(a == c.a_after && b == c.b_after, "%s on engine %i gives %llx, %llx",
+            c.name, (int)engine, (unsigned long long)a, (unsigned long long)b);
+          Free(vm);
+        }
+        Code_Release(code);
+      }
+    });
+  }
+
+  /* runs `code` on `engine` and on RunSwitch, both have to end in the same state */
+  void test_AgainstSwitch(Virtual::Code& code, Virtual::VM_Engine engine) {
+    using namespace Virtual;
+    VirtualMachine expected, vm;
+    Execute(expected, code);
+    Execute(vm, code, engine);
+    MewForUserAssert(test_SameState(expected, vm), "engine %i differs from switch", (int)engine);
+    Free(vm);
+    Free(expected);
+  }
+
+  bool test_Threaded() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      Code* code = test_LoopCode();
+      VirtualMachine vm;
+      Execute(vm, *code, VM_Engine_Threaded);
+      u32 r0, r2;
+      memcpy(&r0, vm._r[0].data, sizeof(r0));
+      memcpy(&r2, vm._r[2].data, sizeof(r2));
+      MewUserAssert(r0 == 9*5000 && r2 == 5000-1 && vm.stack.size() == 2, "threaded result is wrong");
+      Free(vm);
+      test_AgainstSwitch(*code, VM_Engine_Threaded);
+      Code_Release(code);
+    });
+  }
+
+  /*
+    every interpreter instantiation of every engine ends in one state,
+    only debug ones keep vm.debug and it names the EXIT they stopped on
+  */
+  bool test_Configs() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      Code* code = test_LoopCode(64);
+      VirtualMachine expected;
+      Execute(expected, *code);
+      MewUserAssert(expected.debug.last_fn == nullptr, "release run kept debug state");
+      VM_Engine engines[] = {VM_Engine_Switch, VM_Engine_Threaded, VM_Engine_Decoded, VM_Engine_Profile, VM_Engine_Jit};
+      for (VM_Engine engine: engines) {
+        for (int debug = 0; debug < 2; ++debug) {
+          for (int unchecked = 0; unchecked < 2; ++unchecked) {
+            VirtualMachine vm;
+            vm.flags.use_debug = debug;
+            vm.flags.unchecked = unchecked;
+            vm.flags.heap_lock_execute = !unchecked;
+            Execute(vm, *code, engine);
+            MewForUserAssert(test_SameState(expected, vm), "engine %i config %i%i differs",
+              (int)engine, debug, unchecked);
+            MewForUserAssert(debug ? vm.debug.last_head_byte == Instruction_EXIT : vm.debug.last_fn == nullptr,
+              "engine %i config %i%i debug state", (int)engine, debug, unchecked);
+            Free(vm);
+          }
+        }
+      }
+      Free(expected);
+      Code_Release(code);
+    });
+  }
+
+  /* the decode indexes every instruction once and is reused between runs */
+  bool test_Decoded() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      Code* code = test_LoopCode();
+      VM_DecodedCode& dc = Code_Decode(*code);
+      MewUserAssert(dc.ok && dc.count > 0 && dc.index_of[code->capacity] == dc.count, "code was not decoded");
+      for (u32 i = 0; i < dc.count; ++i) {
+        MewForUserAssert(dc.index_of[dc.ops[i].pc] == i, "op %u is not indexed by its pc", i);
+      }
+      test_AgainstSwitch(*code, VM_Engine_Decoded);
+      test_AgainstSwitch(*code, VM_Engine_Decoded);
+      MewUserAssert(code->decoded == &dc, "decoded code was rebuilt");
+      Code_Release(code);
+    });
+  }
+
+  /* every math opcode once, every engine has to run the opcode set of RunSwitch */
+  bool test_MathOpcodes() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      CodeBuilder builder;
+      Instruction ops[] = {Instruction_ADD, Instruction_SUB, Instruction_MUL, Instruction_DIV,
+        Instruction_XOR, Instruction_OR, Instruction_AND, Instruction_LS, Instruction_RS};
+      builder << Instruction_MOV;
+      builder.putRegister({VM_RegType::R, 1});
+      builder.putNumber(0x0FF0);
+      for (u32 i = 0; i < sizeof(ops)/sizeof(*ops); ++i) {
+        builder << Instruction_MOV;
+        builder.putRegister({VM_RegType::R, 2});
+        builder.putNumber(0xF0F0);
+        builder << ops[i];
+        builder.putRegister({VM_RegType::R, 2});
+        builder.putNumber(i == 7 || i == 8 ? 4 : 3);
+        builder << Instruction_PUSH;
+        builder.putRegister({VM_RegType::R, 2});
+      }
+      builder << Instruction_AND;
+      builder.putRegister({VM_RegType::R, 1});
+      builder.putNumber(0xF0F0);
+      builder << Instruction_NOT;
+      builder.putRegister({VM_RegType::R, 0});
+      builder << Instruction_EXIT;
+      Code* code = *builder;
+      VirtualMachine vm;
+      Execute(vm, *code);
+      u32 r0, r1;
+      memcpy(&r0, vm._r[0].data, sizeof(r0));
+      memcpy(&r1, vm._r[1].data, sizeof(r1));
+      MewUserAssert(r1 == 0x00F0 && r0 == ~0U, "and/not differ");
+      Free(vm);
+      VM_Engine engines[] = {VM_Engine_Threaded, VM_Engine_Decoded, VM_Engine_Profile, VM_Engine_Jit};
+      for (VM_Engine engine: engines) {
+        test_AgainstSwitch(*code, engine);
+      }
+      Code_Release(code);
+    });
+  }
+
+  /*
+    a profile run picks hot sequences, the next decoded run fuses them into
+    a new op array. fused ops count and locate every instruction they run
+  */
+  bool test_Fused() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      Code* code = test_FusableLoopCode(5000);
+      Code_Decode(*code);
+      VM_DecodedOp* unfused = code->decoded->ops;
+      test_AgainstSwitch(*code, VM_Engine_Profile);
+      MewUserAssert(code->profile != nullptr
+        && code->profile->triple(Instruction_INC, Instruction_TEST, Instruction_JNE) >= 5000, "profile missed the loop");
+      VirtualMachine expected, vm;
+      Execute(expected, *code);
+      Execute(vm, *code, VM_Engine_Decoded);
+      MewUserAssert(test_SameState(expected, vm), "fused run differs from switch");
+      MewUserAssert(vm.process_cycle == expected.process_cycle, "fused ops miss cycles");
+      Free(vm);
+      Free(expected);
+      VM_DecodedCode& dc = *code->decoded;
+      u32 fused = 0;
+      for (u32 i = 0; i < dc.count; ++i) {
+        fused += dc.ops[i].fn != dc.ops[i].base;
+        MewForUserAssert(unfused[i].fn == unfused[i].base, "op %u was fused in place", i);
+      }
+      MewUserAssert(dc.fused && fused > 0 && dc.unfused == unfused, "profiled code was not fused");
+      Code_Release(code);
+      /* the TEST inside a fused INC TEST JNE faults on the empty stack */
+      CodeBuilder builder;
+      builder << Instruction_INC;
+      builder.putRegister({VM_RegType::R, 0});
+      u64 test = builder.cursor();
+      builder << Instruction_TEST << Instruction_NUM << Instruction_NUM;
+      builder << Instruction_JNE << (int)0;
+      builder << Instruction_EXIT;
+      Code* broken = *builder;
+      Code_Profile(*broken).triple(Instruction_INC, Instruction_TEST, Instruction_JNE) = 2048;
+      VirtualMachine faulted;
+      MewUserAssert(test_Throws([&]() { Execute(faulted, *broken, VM_Engine_Decoded); }), "empty stack passed");
+      MewUserAssert(broken->decoded->fused && faulted.begin == faulted.memory+test && faulted.process_cycle == 2,
+        "fault is reported at the wrong op");
+      Free(faulted);
+      Code_Release(broken);
+    });
+  }
+
+  /* the loop is hot enough to compile, compiled blocks run like RunSwitch */
+  bool test_Jit() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      Code* code = test_LoopCode();
+      test_AgainstSwitch(*code, VM_Engine_Jit);
+#ifdef VM_JIT_SUPPORTED
+      VM_DecodedCode& dc = *code->decoded;
+      u32 compiled = 0;
+      for (u32 i = 0; code->jit != nullptr && i < dc.count; ++i) {
+        compiled += code->jit->blocks[i].fn.load() != nullptr;
+      }
+      MewUserAssert(compiled > 0, "hot loop was not compiled");
+#endif
+      Code_Release(code);
+    });
+  }
+
+  bool test_Verifier() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      const char* error = nullptr;
+      Code* valid = test_LoopCode(4);
+      MewForUserAssert(Code_Verify(*valid, &error), "valid code rejected (%s)", error);
+      Code_Release(valid);
+      VM_RegisterNative("tests", "tests_add", test_PipeAdd);
+      const u64 far = 1ULL << 40;
+      /* one code per rule, refused with the message of that rule */
+      struct Broken {
+        const char* message;
+        void (*build)(CodeBuilder&);
+        byte head; // written over the first opcode after the build, Code_Bind refuses these
+      } broken[] = {
+        {"empty code", [](CodeBuilder& b) { }},
+        {"bound native call in code",
+          [](CodeBuilder& b) { b << Instruction_NONE; b.putU64(0); b.putU64(0); b << Instruction_EXIT; },
+          Instruction_DCALLS},
+        {"undecodable instruction",
+          [](CodeBuilder& b) { b << Instruction_NONE << Instruction_EXIT; }, (byte)Instruction_Count},
+        {"constant heap operand out of heap", [](CodeBuilder& b) {
+          b << Instruction_ADD; b.putRegister({VM_RegType::R, 0}); b.putMem(far, 4); b << Instruction_EXIT;
+        }},
+        {"code can fall through into heap",
+          [](CodeBuilder& b) { b << Instruction_INC; b.putRegister({VM_RegType::R, 0}); }},
+        {"code can fall through into heap", [](CodeBuilder& b) {
+          b << Instruction_TEST << Instruction_NUM << Instruction_NUM << Instruction_JNE << (int)0;
+        }},
+        /* the callee returns past the end of code */
+        {"code can fall through into heap", [](CodeBuilder& b) {
+          b << Instruction_JMP; b.putU64(2+sizeof(u64)); b << Instruction_RET << Instruction_CALL; b.putU64(1+sizeof(u64));
+        }},
+        {"push offset out of heap",
+          [](CodeBuilder& b) { b << Instruction_PUSH << Instruction_MEM << (u32)~0U << Instruction_EXIT; }},
+        {"mset range out of heap",
+          [](CodeBuilder& b) { b << Instruction_MSET; b.putU64(0); b.putU64(far); b.putU64(0); b << Instruction_EXIT; }},
+        {"constant heap operand out of heap", [](CodeBuilder& b) {
+          b << Intruction_GetIPTR; b.putMem(0, 1); b.putNumber(1); b.putMem(far, 1);
+          b << Instruction_EXIT;
+        }},
+        {"heap offset out of heap", [](CodeBuilder& b) { b << Instruction_PUTS; b.putU64(far); b << Instruction_EXIT; }},
+        {"dcall name out of heap", [](CodeBuilder& b) {
+          b.native("tests"); b << Instruction_DCALL; b.putU64(0); b.putU64(far); b << Instruction_EXIT;
+        }},
+        {"dcall batch out of heap", [](CodeBuilder& b) {
+          b.native("tests"); b.putDCallBatch(0, "tests_add", far, 0); b << Instruction_EXIT;
+        }},
+        {"dcall results out of heap", [](CodeBuilder& b) {
+          b.native("tests"); b.putDCallBatch(0, "tests_add", 0, far); b << Instruction_EXIT;
+        }},
+        {"jump target is not an instruction",
+          [](CodeBuilder& b) { b << Instruction_JMP; b.putU64(1); b << Instruction_EXIT; }},
+      };
+      for (Broken& broken_code: broken) {
+        CodeBuilder builder;
+        broken_code.build(builder);
+        Code* code = *builder;
+        if (broken_code.head != Instruction_NONE) { ((byte*)code->playground)[0] = broken_code.head; }
+        error = nullptr;
+        MewForUserAssert(!Code_Verify(*code, &error) && error != nullptr && strcmp(error, broken_code.message) == 0,
+          "broken code not refused for '%s' (%s)", broken_code.message, error ? error : "verified");
+        Code_Release(code);
+      }
+      /* a range may end exactly at the end of the heap */
+      CodeBuilder tail;
+      tail << Instruction_MSET;
+      u64 operands = tail.cursor();
+      tail.putU64(0); tail.putU64(0); tail.putU64(0x7F);
+      tail << Instruction_EXIT;
+      Code* code = *tail;
+      u64 heap_size = Code_MemorySize(*code) - Code_HeapOffset(*code);
+      u64 range[2] = {heap_size-8, 8};
+      memcpy((byte*)code->playground+operands, range, sizeof(range));
+      MewForUserAssert(Code_Verify(*code, &error), "heap tail rejected (%s)", error);
+      VirtualMachine vm;
+      Execute(vm, *code);
+      MewUserAssert(vm.heap[heap_size-1] == 0x7F, "heap tail was not set");
+      Free(vm);
+      Code_Release(code);
+    });
+  }
+
+  /* an image is mapped instead of copied and runs like the code it was saved from */
+  bool test_MappedImage() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      Code* code = test_LoopCode(16);
+      std::filesystem::path path = std::filesystem::temp_directory_path() / "nanvm_tests_mapped.nbi";
+      Code_SaveImage(*code, path);
+      MewUserAssert(Code_IsImage(path), "saved file is not an image");
+      Code* loaded = Code_LoadFromFile(path);
+      MewUserAssert(loaded != nullptr && loaded->image != nullptr, "image was not mapped");
+      MewUserAssert(loaded->capacity == code->capacity
+        && memcmp(loaded->playground, code->playground, code->capacity) == 0, "image code differs");
+      VirtualMachine expected, vm;
+      Execute(expected, *code);
+      Execute(vm, *loaded);
+      MewUserAssert(test_SameState(expected, vm), "mapped code runs differently");
+      Free(expected);
+      Free(vm);
+      Code_Release(loaded);
+      /* an image of another version is refused, not run */
+      {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        u32 version = (u32)GetVersion()+1;
+        file.seekp(offsetof(VM_ImageHeader, version));
+        file.write((const char*)&version, sizeof(version));
+      }
+      MewUserAssert(Code_LoadFromFile(path) == nullptr, "image of another version loaded");
+      Code_Release(code);
+      std::filesystem::remove(path);
+    });
+  }
+
+  /* v2 sections keep data, labels and natives, labels are parsed on first use */
+  bool test_ImageSections() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      VM_RegisterNative("tests", "tests_add", test_PipeAdd);
+      CodeBuilder builder;
+      builder.native("tests");
+      builder += "payload";
+      builder << Instruction_PUSH;
+      builder.putNumber(40);
+      builder.label("second");
+      builder << Instruction_PUSH;
+      builder.putNumber(2);
+      builder.putDCall(0, "tests_add");
+      builder << Instruction_EXIT;
+      Code* code = *builder;
+      std::filesystem::path path = std::filesystem::temp_directory_path() / "nanvm_tests_image.nbi";
+      Code_SaveImage(*code, path);
+      Code* loaded = Code_LoadFromFile(path);
+      MewUserAssert(loaded != nullptr && loaded->image != nullptr, "image was not mapped");
+      MewUserAssert(!(loaded->image->faulted & (1U << VM_Section_Symbols)), "labels parsed on load");
+      MewUserAssert(loaded->data_size == code->data_size
+        && memcmp(loaded->data, code->data, code->data_size) == 0, "image data differs");
+      MewUserAssert(Code_FindLabel(*loaded, "second") == Code_FindLabel(*code, "second")
+        && Code_FindLabel(*loaded, "second") != VM_NOSYMBOL, "image label differs");
+      /* saving a mapped image writes its lazy sections back too */
+      std::filesystem::path copy = std::filesystem::temp_directory_path() / "nanvm_tests_image_copy.nbi";
+      Code_SaveImage(*loaded, copy);
+      Code* reloaded = Code_LoadFromFile(copy);
+      MewUserAssert(reloaded != nullptr && Code_FindLabel(*reloaded, "second") == Code_FindLabel(*code, "second"),
+        "resaved image lost its labels");
+      Code_Release(reloaded);
+      std::filesystem::remove(copy);
+      MewUserAssert(loaded->cme.natives.size() == 1 && strcmp(loaded->cme.natives.at(0), "tests") == 0
+        && loaded->natives != nullptr && loaded->natives->slots.size() == 1, "image natives differ");
+      VirtualMachine a, b;
+      MewUserAssert(Execute(a, *code) == 42 && Execute(b, *loaded) == 42, "image runs differently");
+      Free(a);
+      Free(b);
+      Code_Release(loaded);
+      Code_Release(code);
+      std::filesystem::remove(path);
+    });
+  }
+
+  /* a stored entry loads into an identical Code and runs like the decode */
+  bool test_CodeCache() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      struct CacheScope {
+        ~CacheScope() { Virtual::VM_SetCodeCache(""); }
+      } scope;
+      std::filesystem::path dir = std::filesystem::temp_directory_path() / "nanvm_tests_cache";
+      std::error_code ec;
+      std::filesystem::remove_all(dir, ec);
+      VM_SetCodeCache(dir);
+      Code* stored = test_LoopCode();
+      Code* cached = test_LoopCode();
+      VM_DecodedCode& dc = Code_Decode(*stored);
+      MewUserAssert(Code_StoreCached(*stored), "cache entry not stored");
+      MewUserAssert(Code_LoadCached(*cached), "cache entry not loaded");
+      VM_DecodedCode& lc = *cached->decoded;
+      MewUserAssert(lc.count == dc.count
+        && memcmp(lc.index_of, dc.index_of, (stored->capacity+1)*sizeof(u32)) == 0, "cached index differs");
+      for (u32 i = 0; i < dc.count; ++i) {
+        VM_DecodedOp& x = dc.ops[i];
+        VM_DecodedOp& y = lc.ops[i];
+        MewUserAssert(x.fn == y.fn && x.base == y.base && x.kernel == y.kernel && x.code == y.code
+          && x.pc == y.pc && x.next == y.next && x.target == y.target, "cached op differs");
+      }
+      VirtualMachine expected, vm;
+      Execute(expected, *stored);
+      Execute(vm, *cached, VM_Engine_Decoded);
+      MewUserAssert(test_SameState(expected, vm), "cached code runs differently");
+      Free(expected);
+      Free(vm);
+      Code_Release(cached);
+      /* other content misses, an entry from another vm layout is refused */
+      Code* other = test_LoopCode(7);
+      MewUserAssert(!Code_LoadCached(*other), "cache entry loaded for other code");
+      Code_Release(other);
+      Code* stale = test_LoopCode();
+      {
+        std::fstream file(Code_CachePath(Code_CacheKey(*stale)), std::ios::in | std::ios::out | std::ios::binary);
+        u64 layout = VMC_LayoutHash()+1;
+        file.seekp(offsetof(VM_CacheHeader, layout));
+        file.write((const char*)&layout, sizeof(layout));
+      }
+      MewUserAssert(!Code_LoadCached(*stale) && stale->decoded == nullptr, "stale cache entry loaded");
+      Code_Release(stale);
+      /* an entry that still indexes fine but no longer decodes the code is refused */
+      u32 jump = 0;
+      while (jump < dc.count && dc.ops[jump].code != Instruction_JNE) { ++jump; }
+      struct Tamper { const char* name; u32 op; void (*patch)(VM_DecodedOp&); } tampers[] = {
+        {"operand", 0, [](VM_DecodedOp& op) { op.b.num += 1; }},
+        {"register", 0, [](VM_DecodedOp& op) { op.a.reg += 4; op.a.ri.idx += 1; }},
+        {"target", jump, [](VM_DecodedOp& op) { op.target = 0; }},
+        {"handler", 0, [](VM_DecodedOp& op) { op.fn = (VM_DecodedHandler)(uintptr_t)vmd_handlers_count; }},
+      };
+      for (Tamper& tamper: tampers) {
+        MewUserAssert(Code_StoreCached(*stored), "cache entry not stored");
+        Code* tampered = test_LoopCode();
+        {
+          std::fstream file(Code_CachePath(Code_CacheKey(*tampered)), std::ios::in | std::ios::out | std::ios::binary);
+          VM_CacheHeader header;
+          file.read((char*)&header, sizeof(header));
+          u64 at = header.ops_offset + (u64)tamper.op*sizeof(VM_DecodedOp);
+          VM_DecodedOp op;
+          file.seekg(at);
+          file.read((char*)&op, sizeof(op));
+          tamper.patch(op);
+          file.seekp(at);
+          file.write((const char*)&op, sizeof(op));
+        }
+        MewForUserAssert(!Code_LoadCached(*tampered) && tampered->decoded == nullptr,
+          "cache entry with tampered %s loaded", tamper.name);
+        Code_Release(tampered);
+      }
+      /* fused ops are their own parts, they still load */
+      Code* fused = test_FusableLoopCode(5000);
+      test_AgainstSwitch(*fused, VM_Engine_Profile);
+      test_AgainstSwitch(*fused, VM_Engine_Decoded);
+      MewUserAssert(fused->decoded->fused && Code_StoreCached(*fused), "fused cache entry not stored");
+      Code* reloaded = test_FusableLoopCode(5000);
+      MewUserAssert(Code_LoadCached(*reloaded), "fused cache entry not loaded");
+      VM_DecodedCode& rc = *reloaded->decoded;
+      bool has_fused = false;
+      for (u32 i = 0; i < rc.count; ++i) { has_fused |= rc.ops[i].fn != rc.ops[i].base; }
+      MewUserAssert(has_fused, "fused cache entry lost its superinstructions");
+      VirtualMachine fused_vm;
+      Execute(fused_vm, *reloaded, VM_Engine_Decoded);
+      VirtualMachine plain;
+      Execute(plain, *fused);
+      MewUserAssert(test_SameState(plain, fused_vm), "fused cache entry runs differently");
+      Free(plain);
+      Free(fused_vm);
+      Code_Release(reloaded);
+      Code_Release(fused);
+      Code_Release(stored);
+      std::filesystem::remove_all(dir, ec);
+    });
+  }
+
+  /* one load per path shared by every user, freed with the last reference */
+  bool test_LibraryCache() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      Code* code = test_LoopCode(4);
+      std::filesystem::path path = std::filesystem::temp_directory_path() / "nanvm_tests_lib.nb";
+      Code_SaveToFile(*code, path);
+      Code_Release(code);
+      std::string name = path.string();
+      VM_LibraryCache& cache = VM_Libraries();
+      u64 before = cache.size();
+      Code* a = cache.Acquire(name.c_str());
+      Code* b = cache.Acquire(name.c_str());
+      MewUserAssert(a == b && cache.size() == before+1, "library was loaded twice");
+      cache.Release(a);
+      MewUserAssert(cache.size() == before+1, "library freed with a reference left");
+      cache.Release(b);
+      MewUserAssert(cache.size() == before, "library outlived its references");
+      /* a failed load leaves nothing behind */
+      {
+        std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        u64 version = GetVersion()+1;
+        file.write((const char*)&version, sizeof(version));
+      }
+      MewUserAssert(test_Throws([&]() { cache.Acquire(name.c_str()); }), "library of another version loaded");
+      MewUserAssert(cache.size() == before, "failed load kept an entry");
+      std::filesystem::remove(path);
+    });
+  }
+
+  /* every label of a large table resolves to its own offset, others miss */
+  bool test_Symbols() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      const int count = 300;
+      u64 offsets[count];
+      CodeBuilder builder;
+      for (int i = 0; i < count; ++i) {
+        std::string name = "fn_" + std::to_string(i);
+        offsets[i] = builder.label(name.c_str());
+        builder << Instruction_INC;
+        builder.putRegister({VM_RegType::R, 0});
+      }
+      builder << Instruction_EXIT;
+      Code* code = *builder;
+      for (int i = 0; i < count; ++i) {
+        std::string name = "fn_" + std::to_string(i);
+        MewForUserAssert(Code_FindLabel(*code, name.c_str()) == offsets[i], "label %s resolves wrong", name.c_str());
+      }
+      MewUserAssert(Code_FindLabel(*code, "fn_") == VM_NOSYMBOL
+        && Code_FindLabel(*code, "fn_300") == VM_NOSYMBOL, "unknown label resolved");
+      Code_Release(code);
+    });
+  }
+
+  bool test_Bind() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      VM_RegisterNative("tests", "tests_add", test_PipeAdd);
+      /* a bound code broken after the fact, one way per refusal */
+      const char* refusals[] = {
+        "unresolved native symbol", "cant open native library",
+        "undefined native library", "undecodable instruction",
+      };
+      for (int i = 0; i < 4; ++i) {
+        CodeBuilder builder;
+        builder.native("tests");
+        builder.putDCall(0, "tests_add");
+        builder << Instruction_EXIT;
+        Code* code = *builder;
+        Code_FreeNatives(*code);
+        switch (i) {
+          case 0: memcpy(code->data, "tests_mis", 9); break;
+          case 1: code->cme.natives.at(0) = "./nanvm_tests_missing.so"; break;
+          case 2: code->cme.natives.clear(); break;
+          case 3: ((byte*)code->playground)[0] = Instruction_DCALLS; break;
+        }
+        const char* error = nullptr;
+        MewUserAssert(!Code_Bind(*code, &error) && code->natives == nullptr, "broken call was bound");
+        MewForUserAssert(error != nullptr && strcmp(error, refusals[i]) == 0, "wrong bind error (%s)", error);
+        Code_Release(code);
+      }
+      /* repeated sites of one symbol share a slot of the in-process library */
+      CodeBuilder builder;
+      builder.native("tests");
+      for (int i = 0; i < 2; ++i) {
+        builder << Instruction_PUSH;
+        builder.putNumber(20+i);
+        builder << Instruction_PUSH;
+        builder.putNumber(1);
+        builder.putDCall(0, "tests_add");
+      }
+      builder << Instruction_EXIT;
+      Code* code = *builder;
+      MewUserAssert(code->natives != nullptr && code->natives->slots.size() == 1
+        && code->natives->sites.size() == 2, "calls were not bound to one slot");
+      VirtualMachine vm;
+      Execute(vm, *code);
+      MewUserAssert(vm.stack.size() == 2 && vm.stack.peek(1) == 21 && vm.stack.peek(0) == 22,
+        "bound calls return differently");
+      Free(vm);
+      Code_Release(code);
+    });
+  }
+
+  /* DCALLB runs a batch of records through one bound call */
+  bool test_Batch() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      VM_RegisterNative("tests", "tests_add_batch", (vm_dll_pipe_fn)test_BatchAdd);
+      CodeBuilder builder;
+      builder.native("tests");
+      VM_NativeBatch head = {3, 2*sizeof(u32)};
+      builder.AddData((byte*)&head, sizeof(head));
+      u32 records[] = {1, 2, 3, 4, 5, 6};
+      builder.AddData((byte*)records, sizeof(records));
+      u64 results = builder.data_size();
+      u64 zeros[3] = {0};
+      builder.AddData((byte*)zeros, sizeof(zeros));
+      builder.putDCallBatch(0, "tests_add_batch", 0, results);
+      builder << Instruction_EXIT;
+      Code* code = *builder;
+      MewUserAssert(code->natives != nullptr && code->natives->batch_slots.size() == 1,
+        "batch call was not bound");
+      VirtualMachine vm;
+      Execute(vm, *code);
+      MewUserAssert(vm.stack.size() == 1 && vm.stack.peek(0) == 3, "batch count differs");
+      u64 sums[3];
+      memcpy(sums, vm.heap+results, sizeof(sums));
+      MewUserAssert(sums[0] == 3 && sums[1] == 7 && sums[2] == 11, "batch results differ");
+      Free(vm);
+      Code_Release(code);
+      /* a batch running past the heap faults before the call */
+      CodeBuilder past;
+      past.native("tests");
+      VM_NativeBatch huge = {1U << 30, 2*sizeof(u32)};
+      past.AddData((byte*)&huge, sizeof(huge));
+      past.putDCallBatch(0, "tests_add_batch", 0, 0);
+      past << Instruction_EXIT;
+      Code* bad = *past;
+      VirtualMachine other;
+      MewUserAssert(test_Throws([&]() { Execute(other, *bad); }), "oversized batch did not fault");
+      Free(other);
+      Code_Release(bad);
+    });
+  }
+
+  /* HCALL through a vm host table next to a bound DCALL */
+  bool test_HostCalls() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      VM_RegisterNative("tests", "tests_add", test_PipeAdd);
+      u64 bias = 100;
+      VM_HostTable hosts;
+      hosts.Set(3, test_HostMulAdd, &bias);
+      hosts.Set(4, test_HostPush);
+      CodeBuilder builder;
+      builder.native("tests");
+      builder << Instruction_PUSH;
+      builder.putNumber(6);
+      builder << Instruction_PUSH;
+      builder.putNumber(7);
+      builder.putHCall(3, 2);
+      builder << Instruction_PUSH;
+      builder.putNumber(40);
+      builder << Instruction_PUSH;
+      builder.putNumber(2);
+      builder.putDCall(0, "tests_add");
+      builder << Instruction_PUSH;
+      builder.putNumber(9);
+      builder << Instruction_PUSH;
+      builder.putNumber(4);
+      builder.putHCall(4, 2);
+      builder << Instruction_EXIT;
+      Code* code = *builder;
+      VirtualMachine vm;
+      vm.hosts = &hosts;
+      Execute(vm, *code);
+      MewUserAssert(vm.stack.size() == 4 && vm.stack.peek(3) == 142 && vm.stack.peek(2) == 42
+        && vm.stack.peek(1) == 7 && vm.stack.peek(0) == 5, "host call results differ");
+      Free(vm);
+      Code_Release(code);
+      /* the id comes from bytecode, an unknown one faults even in verified code */
+      CodeBuilder unknown;
+      unknown.putHCall(0xFFFF, 0);
+      unknown << Instruction_EXIT;
+      Code* bad = *unknown;
+      VirtualMachine other;
+      other.hosts = &hosts;
+      MewUserAssert(test_Throws([&]() { Execute(other, *bad); }), "unknown host id did not fault");
+      Free(other);
+      Code_Release(bad);
+    });
+  }
+
+  /* a small quantum interleaves vms step by step, each ends like a plain run */
+  bool test_Quantum() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      u32 loops[] = {50, 200, 800};
+      Code* codes[3];
+      VM_Async async;
+      async.setQuantum(64);
+      for (int i = 0; i < 3; ++i) {
+        codes[i] = test_LoopCode(loops[i]);
+        async.Append(*codes[i]);
+      }
+      /* a finished vm is marked on the step after its EXIT */
+      auto done = [&](int i) { return async.GetById(i)->status == VM_Status_Panding; };
+      u64 steps = 0;
+      while (!(done(0) && done(1) && done(2))) {
+        MewUserAssert(++steps < 10000, "vms did not finish");
+        async.ExecuteStep();
+      }
+      MewUserAssert(steps > 800*9/64, "quantum did not split the runs");
+      for (int i = 0; i < 3; ++i) {
+        VirtualMachine expected;
+        Execute(expected, *codes[i]);
+        MewForUserAssert(test_SameState(expected, *async.GetById(i)), "vm %i differs from a plain run", i);
+        MewForUserAssert(async.get_instructions(i) == expected.process_cycle, "vm %i instruction count differs", i);
+        Free(expected);
+      }
+      async.hardStop();
+      for (Code* code: codes) {
+        Code_Release(code);
+      }
+    });
+  }
+
+  /* vms of different lengths sharded over workers and stolen between them end like plain runs */
+  bool test_Scheduler() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      const int count = 16;
+      Code* codes[count];
+      VM_Async async;
+      async.setQuantum(100);
+      for (int i = 0; i < count; ++i) {
+        codes[i] = test_LoopCode(100 + (u32)i*i*37);
+        MewUserAssert(async.Append(*codes[i]) == i, "ids are not in append order");
+      }
+      async.Start(4);
+      MewUserAssert(async.Wait(count-1) == Execute(*codes[count-1]), "Wait reports another status code");
+      async.Join();
+      MewUserAssert(!async.is_running(), "workers outlived Join");
+      for (int i = 0; i < count; ++i) {
+        VirtualMachine expected;
+        int result = Execute(expected, *codes[i]);
+        MewForUserAssert(async.is_ends(i) && async.get_status_code(i) == result, "vm %i status code differs", i);
+        MewForUserAssert(async.get_instructions(i) == expected.process_cycle, "vm %i instruction count differs", i);
+        MewForUserAssert(test_SameState(expected, *async.GetById(i)), "vm %i differs from a plain run", i);
+        Free(expected);
+      }
+      async.hardStop();
+      for (Code* code: codes) {
+        Code_Release(code);
+      }
+    });
+  }
+
+  /* data, then MSET over its first `dirty` bytes, registers and a push; every run must see the data again */
+  Virtual::Code* test_DirtyCode(const char* data, u64 dirty, byte fill, s32 value) {
+    using namespace Virtual;
+    CodeBuilder builder;
+    builder += data;
+    builder << Instruction_MSET;
+    builder.putU64(0);
+    builder.putU64(dirty);
+    builder.putU64(fill);
+    builder << Instruction_ADD;
+    builder.putRegister({VM_RegType::R, 0});
+    builder.putNumber(value);
+    builder << Instruction_MOV;
+    builder.putRegister({VM_RegType::RX, 2});
+    builder.putRegister({VM_RegType::R, 0});
+    builder << Instruction_PUSH;
+    builder.putRegister({VM_RegType::R, 0});
+    builder << Instruction_EXIT;
+    return *builder;
+  }
+
+  /*
+    A, B, A through one pool: each run ends like a fresh Execute in
+    registers, stack and heap and starts from clean data, not from what
+    the run before dirtied. with A still held while B runs the second A
+    gets A's vm back by generation, released right away one vm takes
+    every code in turn
+  */
+  bool test_PoolReuse() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      Code* a = test_DirtyCode("abcdefgh", 4, 'z', 7);
+      Code* b = test_DirtyCode("0123456789abcdef0123456789abcdef", 24, 'y', -3);
+      auto same_heap = [](VirtualMachine& x, VirtualMachine& y) {
+        u64 size = (u64)(x.end - x.heap) < (u64)(y.end - y.heap) ? (u64)(x.end - x.heap) : (u64)(y.end - y.heap);
+        return memcmp(x.heap, y.heap, size) == 0;
+      };
+      Code* order[] = {a, b, a};
+      for (int held = 1; held >= 0; --held) {
+        VM_Pool pool;
+        VirtualMachine* vms[3];
+        for (int i = 0; i < 3; ++i) {
+          Code& code = *order[i];
+          VirtualMachine loaded;
+          Alloc(loaded, code);
+          LoadMemory(loaded, code);
+          VirtualMachine* vm = vms[i] = pool.Acquire(code);
+          MewForUserAssert(same_heap(loaded, *vm), "run %i starts on a dirty heap", i);
+          VirtualMachine expected;
+          int result = Execute(expected, code);
+          MewForUserAssert(Run(*vm, code) == result && test_SameState(expected, *vm) && same_heap(expected, *vm),
+            "run %i differs from a fresh Execute", i);
+          Free(loaded);
+          Free(expected);
+          if (!held) { pool.Release(vm); }
+          if (held && i == 1) { pool.Release(vms[0]); pool.Release(vms[1]); }
+        }
+        if (held) {
+          MewUserAssert(vms[2] == vms[0] && vms[1] != vms[0], "A did not get its own vm back");
+          pool.Release(vms[2]);
+        } else {
+          MewUserAssert(vms[1] == vms[0] && vms[2] == vms[0], "pool did not reuse the one vm");
+        }
+      }
+      Code_Release(a);
+      Code_Release(b);
+    });
+  }
+
+  /*
+    children of one snapshot finish the program on their own pages: a
+    child's heap writes reach neither the snapshot, its parent nor the
+    siblings forked before or after it
+  */
+  bool test_Fork() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      CodeBuilder builder;
+      u32 zero = 0;
+      builder.AddData((byte*)&zero, sizeof(zero));
+      for (u64 i = 0; i < 64; ++i) {
+        builder << Instruction_INC;
+        builder.putRegister({VM_RegType::R, 0});
+      }
+      u64 point = builder.cursor();
+      for (u64 i = 0; i < 8; ++i) {
+        builder << Instruction_INC;
+        builder.putRegister({VM_RegType::R, 1});
+      }
+      builder << Instruction_MSET;
+      builder.putU64(0);
+      builder.putU64(sizeof(u32));
+      builder.putU64(8);
+      builder << Instruction_EXIT;
+      Code* code = *builder;
+      auto r = [](VirtualMachine& vm, int idx) { u32 value; memcpy(&value, vm._r[idx].data, sizeof(value)); return value; };
+      VirtualMachine expected;
+      Execute(expected, *code);
+      VirtualMachine parent;
+      Alloc(parent, *code);
+      LoadMemory(parent, *code);
+      Prepare(parent, *code);
+      MewUserAssert(RunUntil(parent, point), "fork point not reached");
+      std::filesystem::path path = std::filesystem::temp_directory_path() / "nanvm_tests_fork.bin";
+      Isolate::CreateFileIfNotExists(path.string().c_str());
+      u32 descr = parent.fs.Open(path.string().c_str());
+      {
+        VM_Snapshot snapshot(parent);
+        VirtualMachine first, second;
+        snapshot.Fork(first);
+        snapshot.Fork(second);
+        MewUserAssert(test_Throws([&]() { first.fs.Flush(descr); }), "parent descriptor carried into a fork");
+        Resume(first);
+        u32 stored;
+        memcpy(&stored, first.heap, sizeof(stored));
+        MewUserAssert(r(first, 0) == 64 && r(first, 1) == 8 && stored == 0x08080808, "child did not finish the program");
+        MewUserAssert(test_SameState(expected, first), "child differs from a plain run");
+        memcpy(&stored, second.heap, sizeof(stored));
+        MewUserAssert(stored == 0 && r(second, 1) == 0, "child write leaked into a sibling");
+        memcpy(&stored, parent.heap, sizeof(stored));
+        MewUserAssert(stored == 0 && r(parent, 1) == 0, "child write leaked into the parent");
+        VirtualMachine late;
+        snapshot.Fork(late);
+        memcpy(&stored, late.heap, sizeof(stored));
+        MewUserAssert(stored == 0 && r(late, 0) == 64 && r(late, 1) == 0, "child write leaked into the snapshot");
+        Resume(second);
+        Resume(late);
+        MewUserAssert(test_SameState(expected, second) && test_SameState(expected, late), "sibling differs from a plain run");
+        Free(first);
+        Free(second);
+        Free(late);
+      }
+      MewUserAssert(parent.fs.Close(descr), "cant close file");
+      std::filesystem::remove(path);
+      Free(parent);
+      Free(expected);
+      Code_Release(code);
+    });
+  }
+
+  /* the positional io script on descriptor `descr`, leaves "Jello world!" and pushes 1, 5 */
+  Virtual::Code* test_IOCode(u32 descr, u64* back = nullptr) {
+    using namespace Virtual;
+    CodeBuilder builder;
+    builder += "hello world";
+    u64 patch = builder.data_size();
+    builder += "J";
+    u64 bang = builder.data_size();
+    builder += "!";
+    if (back) { *back = builder.data_size(); }
+    u64 dest = builder.data_size();
+    builder += "-----";
+    builder << Instruction_WRITE << descr;
+    builder.putMem(0, 11);
+    builder << Instruction_PWRITE << descr;
+    builder.putMem(patch, 1);
+    builder.putNumber(0);
+    builder << Instruction_PREAD << descr;
+    builder.putMem(dest, 5);
+    builder.putNumber(0);
+    builder << Instruction_WRITE << descr;
+    builder.putMem(bang, 1);
+    builder << Instruction_SYNC << descr;
+    builder << Instruction_EXIT;
+    return *builder;
+  }
+
+  std::string test_FileContents(const std::filesystem::path& path) {
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  }
+
+  /*
+    async_io: an io opcode suspends its vm and hands the request to the io
+    lane, the other vms keep running in that same step, and every vm ends
+    like a synchronous run, stepped by hand and on workers. hardStop with
+    requests queued and running returns and leaves each file untouched or
+    fully written
+  */
+  bool test_AsyncIO() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      const int count = 3;
+      std::filesystem::path dir = std::filesystem::temp_directory_path();
+      auto path_of = [&](const char* kind, int i) {
+        return dir / ("nanvm_tests_async_" + std::string(kind) + std::to_string(i) + ".bin");
+      };
+      auto touch = [](const std::filesystem::path& path) {
+        std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+      };
+      u64 back = 0;
+      Code* io = test_IOCode(0, &back);
+      Code* loop = test_LoopCode(2000);
+      /* what every io vm has to end with */
+      VirtualMachine expected_io, expected_loop;
+      touch(path_of("sync", 0));
+      expected_io.fs.Open(path_of("sync", 0).string().c_str());
+      int expected_result = Execute(expected_io, *io);
+      MewUserAssert(expected_io.fs.Close(0), "cant close file");
+      Execute(expected_loop, *loop);
+      for (int started = 0; started < 2; ++started) {
+        VM_Async async;
+        async.setQuantum(64);
+        for (int i = 0; i < count; ++i) {
+          touch(path_of("io", i));
+          int id = async.Append(*io);
+          MewUserAssert(async.GetById(id)->fs.Open(path_of("io", i).string().c_str()) == 0, "descriptor is not 0");
+          async.Append(*loop);
+        }
+        if (started) {
+          async.Start(2);
+          async.Join();
+        } else {
+          /* the WRITE suspends each io vm in the first step, the loops run their quantum */
+          async.ExecuteStep();
+          for (int i = 0; i < count; ++i) {
+            VirtualMachine& vm = *async.GetById(2*i);
+            MewForUserAssert(vm.status == VM_Status_Wait && vm.io.submitted, "io vm %i did not suspend", i);
+            MewForUserAssert(async.get_instructions(2*i) == 1 && async.get_instructions(2*i+1) == 64,
+              "vm %i did not progress beside a suspended one", i);
+          }
+          u64 steps = 0;
+          auto done = [&]() {
+            for (int i = 0; i < 2*count; ++i) {
+              if (async.GetById(i)->status != VM_Status_Panding) { return false; }
+            }
+            return true;
+          };
+          while (!done()) {
+            MewUserAssert(++steps < 100000, "vms did not finish");
+            async.ExecuteStep();
+          }
+        }
+        for (int i = 0; i < count; ++i) {
+          VirtualMachine& vm = *async.GetById(2*i);
+          MewForUserAssert(!vm.io.submitted && test_SameState(expected_io, vm)
+            && memcmp(vm.heap+back, expected_io.heap+back, 5) == 0, "io vm %i differs from a synchronous run", i);
+          MewForUserAssert(async.get_status_code(2*i) == expected_result
+            && async.get_instructions(2*i) == expected_io.process_cycle, "io vm %i reports differ", i);
+          MewForUserAssert(test_FileContents(path_of("io", i)) == test_FileContents(path_of("sync", 0)),
+            "io vm %i wrote a different file", i);
+          MewForUserAssert(test_SameState(expected_loop, *async.GetById(2*i+1))
+            && async.get_instructions(2*i+1) == expected_loop.process_cycle, "loop vm %i differs", i);
+        }
+        async.hardStop();
+      }
+      Free(expected_io);
+      Free(expected_loop);
+      /* more large writes than io threads, hardStop drops the queued ones and waits for the rest */
+      const int stopped = VM_ASYNC_IO_THREADS*2;
+      const u64 big = ISOLATE_BUFFER*2; // skips the descriptor buffer, one host write
+      CodeBuilder builder;
+      builder += std::string(big, 'x').c_str();
+      builder << Instruction_WRITE << 0U;
+      builder.putMem(0, big);
+      builder << Instruction_EXIT;
+      Code* writes = *builder;
+      {
+        VM_Async async;
+        for (int i = 0; i < stopped; ++i) {
+          touch(path_of("stop", i));
+          async.GetById(async.Append(*writes))->fs.Open(path_of("stop", i).string().c_str());
+        }
+        async.ExecuteStep();
+        for (int i = 0; i < stopped; ++i) {
+          MewForUserAssert(async.GetById(i)->status == VM_Status_Wait, "vm %i did not suspend", i);
+        }
+        async.hardStop();
+      }
+      for (int i = 0; i < stopped; ++i) {
+        u64 size = std::filesystem::file_size(path_of("stop", i));
+        MewForUserAssert(size == 0 || size == big, "write %i was cut by hardStop", i);
+        std::filesystem::remove(path_of("stop", i));
+      }
+      for (int i = 0; i < count; ++i) { std::filesystem::remove(path_of("io", i)); }
+      std::filesystem::remove(path_of("sync", 0));
+      Code_Release(writes);
+      Code_Release(loop);
+      Code_Release(io);
+    });
+  }
+
+  /*
+    IsolateFile on its own: uneven appends across chunk boundaries, gaps
+    that stay holes, and Clear keeping the chunks without leaking old bytes
+  */
+  bool test_IsolateFile() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      const u64 chunk = ISOLATE_CHUNK;
+      std::vector<u8> pattern(chunk*2 + chunk/2 + 7);
+      for (u64 i = 0; i < pattern.size(); ++i) { pattern[i] = (u8)(i*31 + 7); }
+      IsolateFile file;
+      const u64 pieces[] = {1, chunk-1, 997, chunk, 3};
+      u64 written = 0;
+      u8* first = nullptr;
+      for (u64 k = 0; written < pattern.size(); k = (k+1) % 5) {
+        u64 part = pieces[k] < pattern.size() - written ? pieces[k] : pattern.size() - written;
+        file.Append(pattern.data()+written, part);
+        written += part;
+        if (first == nullptr) { first = file.chunks[0].get(); }
+      }
+      MewUserAssert(file.size == pattern.size() && file.chunks.size() == 3, "appends sized the file wrong");
+      MewUserAssert(file.chunks[0].get() == first, "appends moved a written chunk");
+      std::vector<u8> back(pattern.size());
+      MewUserAssert(file.Read(0, back.data(), back.size()) == back.size() && back == pattern, "chunked read differs");
+      u8 edge[10];
+      MewUserAssert(file.Read(chunk-3, edge, 10) == 10 && memcmp(edge, pattern.data()+chunk-3, 10) == 0,
+        "read across a chunk boundary differs");
+      MewUserAssert(file.Read(file.size-2, edge, 10) == 2 && file.Read(file.size, edge, 10) == 0, "read past the end");
+      /* a write past the end leaves whole chunks as holes that read as zeros */
+      IsolateFile sparse;
+      sparse.Write(3*chunk + 5, (const u8*)"x", 1);
+      MewUserAssert(sparse.size == 3*chunk + 6 && sparse.chunks.size() == 4
+        && !sparse.chunks[0] && !sparse.chunks[1] && !sparse.chunks[2] && sparse.chunks[3], "gap was allocated");
+      std::vector<u8> hole(sparse.size);
+      sparse.Read(0, hole.data(), hole.size());
+      MewUserAssert(hole.back() == 'x' && std::all_of(hole.begin(), hole.end()-1, [](u8 c) { return c == 0; }),
+        "hole does not read as zeros");
+      sparse.Write(chunk + 1, (const u8*)"y", 1);
+      MewUserAssert(sparse.chunks[1] && !sparse.chunks[0] && !sparse.chunks[2], "write filled other holes");
+      /* Clear keeps the chunks, the bytes past the new end never show again */
+      u8* kept = file.chunks[0].get();
+      file.Clear();
+      MewUserAssert(file.size == 0 && file.chunks.size() == 3 && file.Read(0, edge, 10) == 0, "clear kept the contents");
+      file.Append((const u8*)"ab", 2);
+      file.Write(50, (const u8*)"c", 1);
+      MewUserAssert(file.chunks[0].get() == kept, "clear dropped the chunks");
+      u8 reused[51];
+      MewUserAssert(file.Read(0, reused, sizeof(reused)) == 51 && memcmp(reused, "ab", 2) == 0 && reused[50] == 'c'
+        && std::all_of(reused+2, reused+50, [](u8 c) { return c == 0; }), "old bytes leaked after clear");
+      file.Write(2*chunk, (const u8*)"d", 1);
+      MewUserAssert(!file.chunks[1] && file.chunks[2], "old chunk inside a gap was kept");
+      u8 mid[4];
+      file.Read(chunk + 10, mid, 4);
+      MewUserAssert(std::all_of(mid, mid+4, [](u8 c) { return c == 0; }), "old chunk leaked after clear");
+    });
+  }
+
+  /* PWRITE/PREAD between appends on a host file, the append offset stays put */
+  bool test_PositionalIO() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      std::filesystem::path path = std::filesystem::temp_directory_path() / "nanvm_tests_io.bin";
+      std::string name = path.string();
+      {
+        std::ofstream touch(path, std::ios::out | std::ios::binary | std::ios::trunc);
+      }
+      VirtualMachine vm;
+      u32 descr = vm.fs.Open(name.c_str());
+      CodeBuilder builder;
+      builder += "hello world";
+      u64 patch = builder.data_size();
+      builder += "J";
+      u64 bang = builder.data_size();
+      builder += "!";
+      u64 back = builder.data_size();
+      builder += "-----";
+      builder << Instruction_WRITE << descr;
+      builder.putMem(0, 11);
+      builder << Instruction_PWRITE << descr;
+      builder.putMem(patch, 1);
+      builder.putNumber(0);
+      builder << Instruction_PREAD << descr;
+      builder.putMem(back, 5);
+      builder.putNumber(0);
+      builder << Instruction_WRITE << descr;
+      builder.putMem(bang, 1);
+      builder << Instruction_EXIT;
+      Code* code = *builder;
+      Execute(vm, *code);
+      MewUserAssert(vm.stack.size() == 2 && vm.stack.peek(1) == 1 && vm.stack.peek(0) == 5,
+        "positional io counts differ");
+      MewUserAssert(memcmp(vm.heap+back, "Jello", 5) == 0, "pread missed the writes");
+      MewUserAssert(vm.fs.Close(descr), "cant close file");
+      std::ifstream file(path, std::ios::in | std::ios::binary);
+      std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+      file.close();
+      MewForUserAssert(contents == "Jello world!", "file contents differ (%s)", contents.c_str());
+      Free(vm);
+      Code_Release(code);
+      std::filesystem::remove(path);
+    });
+  }
+
+  /* write-behind appends, positional io between them and SYNC before close */
+  bool test_WriteBehind() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      std::filesystem::path path = std::filesystem::temp_directory_path() / "nanvm_tests_behind.bin";
+      std::string name = path.string();
+      {
+        std::ofstream touch(path, std::ios::out | std::ios::binary | std::ios::trunc);
+      }
+      VirtualMachine vm;
+      vm.fs.SetWriteBehind(true);
+      u32 descr = vm.fs.Open(name.c_str());
+      CodeBuilder builder;
+      builder += "hello world";
+      u64 patch = builder.data_size();
+      builder += "J";
+      u64 bang = builder.data_size();
+      builder += "!";
+      u64 back = builder.data_size();
+      builder += "-----";
+      builder << Instruction_WRITE << descr;
+      builder.putMem(0, 11);
+      builder << Instruction_PWRITE << descr;
+      builder.putMem(patch, 1);
+      builder.putNumber(0);
+      builder << Instruction_PREAD << descr;
+      builder.putMem(back, 5);
+      builder.putNumber(0);
+      builder << Instruction_WRITE << descr;
+      builder.putMem(bang, 1);
+      builder << Instruction_SYNC << descr;
+      builder << Instruction_EXIT;
+      Code* code = *builder;
+      Execute(vm, *code);
+      MewUserAssert(vm.stack.size() == 2 && vm.stack.peek(1) == 1 && vm.stack.peek(0) == 5,
+        "positional io counts differ");
+      MewUserAssert(memcmp(vm.heap+back, "Jello", 5) == 0, "pread missed the queued writes");
+      /* SYNC drained the queue, the file is complete before close */
+      std::ifstream file(path, std::ios::in | std::ios::binary);
+      std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+      file.close();
+      MewForUserAssert(contents == "Jello world!", "file contents differ (%s)", contents.c_str());
+      MewUserAssert(vm.fs.Close(descr), "cant close file");
+      Free(vm);
+      Code_Release(code);
+      std::filesystem::remove(path);
+    });
+  }
+
+  /*
+    one script against a non-empty file on every backend: WRITE appends
+    after what was there, also past a PWRITE hole, READ starts at 0
+  */
+  bool test_AppendExisting() {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      std::filesystem::path path = std::filesystem::temp_directory_path() / "nanvm_tests_append.bin";
+      std::string name = path.string();
+      const std::string expected("Zbcdef!\0\0H.", 11);
+      for (int backend = 0; backend < 3; ++backend) {
+        Isolate fs(backend == 0);
+        if (backend == 2) { fs.SetWriteBehind(true); }
+        fs.CreateFileIfNotExist(name.c_str());
+        fs.WriteToFile(name.c_str(), "abc");
+        u32 descr = fs.Open(name.c_str());
+        fs.WriteToFile(descr, (byte*)"def", 3);
+        fs.PWrite(descr, (const byte*)"Z", 1, 0);
+        fs.WriteToFile(descr, (byte*)"!", 1);
+        fs.PWrite(descr, (const byte*)"H", 1, 9);
+        fs.WriteToFile(descr, (byte*)".", 1);
+        byte head[3];
+        fs.ReadFromFile(descr, head, 3);
+        MewForUserAssert(memcmp(head, "Zbc", 3) == 0, "backend %d reads from the wrong position", backend);
+        MewForUserAssert(fs.Close(descr), "backend %d cant close file", backend);
+        size_t size = 0;
+        const char* contents = fs.ReadFromFile(name.c_str(), &size);
+        bool same = std::string(contents, size) == expected;
+        delete[] contents;
+        MewForUserAssert(same, "backend %d file contents differ", backend);
+        std::filesystem::remove(path);
+      }
+    });
+  }
+
+  bool test_All() {
+    bool ok = true;
+    ok &= test_Report("MathKernels", test_MathKernels());
+    ok &= test_Report("Threaded", test_Threaded());
+    ok &= test_Report("Configs", test_Configs());
+    ok &= test_Report("Decoded", test_Decoded());
+    ok &= test_Report("MathOpcodes", test_MathOpcodes());
+    ok &= test_Report("Fused", test_Fused());
+    ok &= test_Report("Jit", test_Jit());
+    ok &= test_Report("Verifier", test_Verifier());
+    ok &= test_Report("Quantum", test_Quantum());
+    ok &= test_Report("Scheduler", test_Scheduler());
+    ok &= test_Report("AsyncIO", test_AsyncIO());
+    ok &= test_Report("Fork", test_Fork());
+    ok &= test_Report("PoolReuse", test_PoolReuse());
+    ok &= test_Report("MappedImage", test_MappedImage());
+    ok &= test_Report("ImageSections", test_ImageSections());
+    ok &= test_Report("CodeCache", test_CodeCache());
+    ok &= test_Report("LibraryCache", test_LibraryCache());
+    ok &= test_Report("Symbols", test_Symbols());
+    ok &= test_Report("Bind", test_Bind());
+    ok &= test_Report("Batch", test_Batch());
+    ok &= test_Report("HostCalls", test_HostCalls());
+    ok &= test_Report("IsolateFile", test_IsolateFile());
+    ok &= test_Report("PositionalIO", test_PositionalIO());
+    ok &= test_Report("WriteBehind", test_WriteBehind());
+    ok &= test_Report("AppendExisting", test_AppendExisting());
+    return ok;
+  }
+
+  u64 bench_HeapUsed() {
+#if defined(__GLIBC__)
+    return (u64)mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+  }
+
+  double bench_Seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  /* steady state heap growth of register heavy code, should be zero */
+  bool bench_GetArg(u64 passes = 100000) {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      const u64 block = 64;
+      CodeBuilder builder;
+      for (u64 i = 0; i < block; ++i) {
+        builder << Instruction_ADD;
+        builder.putRegister({VM_RegType::R, 0});
+        builder.putRegister({VM_RegType::R, 1});
+        builder << Instruction_MOV;
+        builder.putRegister({VM_RegType::RX, 0});
+        builder.putNumber(5);
+        builder << Instruction_INC;
+        builder.putRegister({VM_RegType::R, 2});
+      }
+      builder << Instruction_EXIT;
+      Code* code = *builder;
+      VirtualMachine vm;
+      Execute(vm, *code); // warm up
+      u64 heap_before = bench_HeapUsed();
+      auto start = std::chrono::steady_clock::now();
+      for (u64 i = 0; i < passes; ++i) {
+        vm.begin = vm.memory;
+        vm.status = VM_Status_Execute;
+        RunSwitch(vm);
+      }
+      double seconds = bench_Seconds(start);
+      s64 heap_delta = (s64)(bench_HeapUsed() - heap_before);
+      u64 instructions = passes*(block*3+1);
+      printf("[BENCH] GetArg: %llu instr, %.2f Minstr/s, heap delta %lli bytes (%.4f per instr)\n",
+        (unsigned long long)instructions, instructions/seconds/1e6,
+        (long long)heap_delta, (double)heap_delta/instructions);
+      Free(vm);
+      Code_Release(code);
+    });
+  }
+
+  /* push/pop throughput of the operand stack, against the old byte stack */
+  bool bench_Stack(u64 passes = 100000) {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      const u64 block = 64;
+      CodeBuilder builder;
+      for (u64 i = 0; i < block; ++i) {
+        builder << Instruction_PUSH;
+        builder.putNumber((s32)i);
+        builder << Instruction_RPOP << (byte)VM_RegType::R << (byte)0;
+      }
+      builder << Instruction_EXIT;
+      Code* code = *builder;
+      VirtualMachine vm;
+      Execute(vm, *code); // warm up
+      auto start = std::chrono::steady_clock::now();
+      for (u64 i = 0; i < passes; ++i) {
+        vm.begin = vm.memory;
+        vm.status = VM_Status_Execute;
+        RunSwitch(vm);
+      }
+      double seconds = bench_Seconds(start);
+      u64 instructions = passes*(block*2+1);
+      printf("[BENCH] Stack: %llu instr, %.2f Minstr/s\n",
+        (unsigned long long)instructions, instructions/seconds/1e6);
+      Free(vm);
+      Code_Release(code);
+
+      /* raw container cost, slot stack vs the byte stack it replaced */
+      const u64 ops = passes*block;
+      u64 sink = 0;
+      VM_Stack slots;
+      start = std::chrono::steady_clock::now();
+      for (u64 i = 0; i < ops; ++i) {
+        slots.push(i);
+        sink += slots.peek();
+        slots.drop();
+      }
+      double slot_seconds = bench_Seconds(start);
+      mew::stack<u8, mew::MidAllocator<u8>> legacy;
+      start = std::chrono::steady_clock::now();
+      for (u64 i = 0; i < ops; ++i) {
+        legacy.push((u32)i);
+        sink += legacy.top();
+        legacy.asc_pop(sizeof(u32));
+      }
+      double legacy_seconds = bench_Seconds(start);
+      printf("[BENCH] Stack: slots %.2f Mops/s, byte stack %.2f Mops/s (sink %llu)\n",
+        ops/slot_seconds/1e6, ops/legacy_seconds/1e6, (unsigned long long)(sink & 1));
+    });
+  }
+
+  /* independent vms on one worker against one worker per core */
+  bool bench_Async(u64 vms = 64, u64 block = 4096) {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      CodeBuilder builder;
+      for (u64 i = 0; i < block; ++i) {
+        builder << Instruction_INC;
+        builder.putRegister({VM_RegType::R, 0});
+      }
+      builder << Instruction_EXIT;
+      Code* code = *builder;
+      u32 cores = std::thread::hardware_concurrency();
+      if (cores == 0) { cores = 1; }
+      double rates[2];
+      u32 workers[2] = {1, cores};
+      for (int k = 0; k < 2; ++k) {
+        VM_Async async;
+        for (u64 i = 0; i < vms; ++i) {
+          async.Append(*code);
+        }
+        auto start = std::chrono::steady_clock::now();
+        async.Start(workers[k]);
+        async.Join();
+        double seconds = bench_Seconds(start);
+        rates[k] = vms*(block+1)/seconds/1e6;
+        async.hardStop();
+      }
+      printf("[BENCH] Async: 1 worker %.2f Minstr/s, %u workers %.2f Minstr/s (x%.2f)\n",
+        rates[0], cores, rates[1], rates[1]/rates[0]);
+      Code_Release(code);
+    });
+  }
+
+  /* executions per second of a tiny program, fresh vm each time against VM_Pool */
+  bool bench_Pool(u64 runs = 20000) {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      CodeBuilder builder;
+      for (u64 i = 0; i < 8; ++i) {
+        builder << Instruction_INC;
+        builder.putRegister({VM_RegType::R, 0});
+      }
+      builder << Instruction_EXIT;
+      Code* code = *builder;
+      auto start = std::chrono::steady_clock::now();
+      for (u64 i = 0; i < runs; ++i) {
+        Execute(*code);
+      }
+      double fresh = bench_Seconds(start);
+      double pooled;
+      {
+        /* pooled vms point at code, they go before it */
+        VM_Pool pool;
+        pool.Execute(*code); // warm up
+        start = std::chrono::steady_clock::now();
+        for (u64 i = 0; i < runs; ++i) {
+          pool.Execute(*code);
+        }
+        pooled = bench_Seconds(start);
+      }
+      printf("[BENCH] Pool: fresh %.0f exec/s, pooled %.0f exec/s (x%.2f)\n",
+        runs/fresh, runs/pooled, fresh/pooled);
+      Code_Release(code);
+    });
+  }
+
+  /* forks of a warmed vm, each child finishes the program on its own pages */
+  bool bench_Fork(u64 forks = 1000) {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      CodeBuilder builder;
+      for (u64 i = 0; i < 64; ++i) {
+        builder << Instruction_INC;
+        builder.putRegister({VM_RegType::R, 0});
+      }
+      u64 point = builder.cursor();
+      for (u64 i = 0; i < 8; ++i) {
+        builder << Instruction_INC;
+        builder.putRegister({VM_RegType::R, 1});
+      }
+      builder << Instruction_EXIT;
+      Code* code = *builder;
+      VirtualMachine parent;
+      Alloc(parent, *code);
+      LoadMemory(parent, *code);
+      Prepare(parent, *code);
+      MewUserAssert(RunUntil(parent, point), "fork point not reached");
+      double seconds;
+      {
+        VM_Snapshot snapshot(parent);
+        auto start = std::chrono::steady_clock::now();
+        for (u64 i = 0; i < forks; ++i) {
+          VirtualMachine child;
+          snapshot.Fork(child);
+          Resume(child);
+          Free(child);
+        }
+        seconds = bench_Seconds(start);
+      }
+      printf("[BENCH] Fork: %llu forks, %.0f fork+run/s\n",
+        (unsigned long long)forks, forks/seconds);
+      Free(parent);
+      Code_Release(code);
+    });
+  }
+
+  u64 bench_PipeAdd(Virtual::VirtualMachine* vm) {
+    u64 b = vm->stack.pop();
+    u64 a = vm->stack.pop();
+    return a+b;
+  }
+
+  u64 bench_HostAdd(Virtual::VirtualMachine& vm, Virtual::VM_HostArgs args, void* user) {
+    return args.u(0)+args.u(1);
+  }
+
+  /* host call latency: DCALL by name, DCALL bound to a slot, HCALL by id */
+  bool bench_HostCall(u64 passes = 20000) {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      const u64 block = 64;
+      const u32 host_id = 0;
+      VM_RegisterHost(host_id, bench_HostAdd);
+      VM_RegisterNative("bench", "bench_add", bench_PipeAdd);
+      double rates[3];
+      for (int k = 0; k < 3; ++k) {
+        CodeBuilder builder;
+        builder.native("bench");
+        for (u64 i = 0; i < block; ++i) {
+          builder << Instruction_PUSH;
+          builder.putNumber((s32)i);
+          builder << Instruction_PUSH;
+          builder.putNumber(1);
+          if (k == 2) {
+            builder.putHCall(host_id, 2);
+          } else {
+            builder.putDCall(0, "bench_add");
+          }
+          builder << Instruction_RPOP << (byte)VM_RegType::R << (byte)0;
+        }
+        builder << Instruction_EXIT;
+        Code* code = *builder;
+        /* plain sites look their name up per call, cached in vm.dll_pipes */
+        if (k == 0) { code->natives->sites.clear(); }
+        VirtualMachine vm;
+        Execute(vm, *code); // warm up
+        auto start = std::chrono::steady_clock::now();
+        for (u64 i = 0; i < passes; ++i) {
+          vm.begin = vm.memory;
+          vm.status = VM_Status_Execute;
+          RunSwitch(vm);
+        }
+        rates[k] = passes*block/bench_Seconds(start)/1e6;
+        Free(vm);
+        Code_Release(code);
+      }
+      VM_Hosts().Remove(host_id);
+      printf("[BENCH] HostCall: DCALL %.2f Mcalls/s, bound DCALL %.2f Mcalls/s, HCALL %.2f Mcalls/s\n",
+        rates[0], rates[1], rates[2]);
+    });
+  }
+
+  /* many small files in the isolated fs: create+append, then read back */
+  bool bench_Isolate(u64 files = 20000, u64 writes = 16, u64 record = 256) {
+    return test_Guard([&]() {
+      using namespace Virtual;
+      Isolate fs(true);
+      std::vector<std::string> paths;
+      for (u64 i = 0; i < files; ++i) {
+        paths.push_back("/jobs/" + std::to_string(i) + "/out.bin");
+      }
+      std::vector<byte> block(record, 0x5a);
+      auto start = std::chrono::steady_clock::now();
+      for (auto& path: paths) {
+        fs.CreateFileIfNotExist(path.c_str());
+        u32 descr = fs.Open(path.c_str());
+        for (u64 w = 0; w < writes; ++w) {
+          fs.WriteToFile(descr, block.data(), record);
+        }
+        fs.Close(descr);
+      }
+      double write_seconds = bench_Seconds(start);
+      start = std::chrono::steady_clock::now();
+      for (auto& path: paths) {
+        u32 descr = fs.Open(path.c_str());
+        for (u64 w = 0; w < writes; ++w) {
+          fs.ReadFromFile(descr, block.data(), record);
+        }
+        fs.Close(descr);
+      }
+      double read_seconds = bench_Seconds(start);
+      double megabytes = files*writes*record/1e6;
+      printf("[BENCH] Isolate: %llu files, create+write %.0f files/s (%.1f MB/s), read %.0f files/s (%.1f MB/s)\n",
+        (unsigned long long)files, files/write_seconds, megabytes/write_seconds,
+        files/read_seconds, megabytes/read_seconds);
+    });
+  }
+
+  bool bench_All() {
+    bool ok = true;
+    ok &= bench_GetArg();
+    ok &= bench_Stack();
+    ok &= bench_Async();
+    ok &= bench_Pool();
+    ok &= bench_Fork();
+    ok &= bench_HostCall();
+    ok &= bench_Isolate();
+    return ok;
+  }
 }
 
 #endif
\ No newline at end of file